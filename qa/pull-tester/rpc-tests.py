@@ -131,6 +131,7 @@ testScripts = [
     'addressindex.py',
     'timestampindex.py',
     'spentindex.py',
+    'flagindex.py',
     'txindex.py',
     'decodescript.py',
     'blockchain.py',
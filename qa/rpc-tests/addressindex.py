@@ -105,6 +105,33 @@ class AddressIndexTest(BitcoinTestFramework):
         assert_equal(multitxids[4], txid2)
         assert_equal(multitxids[5], txidb2)
 
+        # Check paging through txids and deltas
+        print("Testing paging with limit and cursor...")
+        page1 = self.nodes[1].getaddresstxids({"addresses": ["2N2JD6wb56AfK4tfmM6PwdVmoYk2dCKf4Br", "mo9ncXisMeAoXwqcV5EWuyncbmCcQN4rVs"], "limit": 4})
+        assert_equal(page1["txids"], [txid0, txidb0, txid1, txidb1])
+        page2 = self.nodes[1].getaddresstxids({"addresses": ["2N2JD6wb56AfK4tfmM6PwdVmoYk2dCKf4Br", "mo9ncXisMeAoXwqcV5EWuyncbmCcQN4rVs"], "limit": 4, "cursor": page1["cursor"]})
+        assert_equal(page2["txids"], [txid2, txidb2])
+        assert("cursor" not in page2)
+
+        # Check that an address given twice is only read once
+        duptxids = self.nodes[1].getaddresstxids({"addresses": ["mo9ncXisMeAoXwqcV5EWuyncbmCcQN4rVs", "mo9ncXisMeAoXwqcV5EWuyncbmCcQN4rVs"]})
+        assert_equal(duptxids, [txid0, txid1, txid2])
+
+        deltas = self.nodes[1].getaddressdeltas({"addresses": ["mo9ncXisMeAoXwqcV5EWuyncbmCcQN4rVs"]})
+        paged_deltas = []
+        cursor = None
+        while True:
+            query = {"addresses": ["mo9ncXisMeAoXwqcV5EWuyncbmCcQN4rVs"], "limit": 2}
+            if cursor is not None:
+                query["cursor"] = cursor
+            page = self.nodes[1].getaddressdeltas(query)
+            assert(len(page["deltas"]) <= 2)
+            paged_deltas += page["deltas"]
+            if "cursor" not in page:
+                break
+            cursor = page["cursor"]
+        assert_equal(paged_deltas, deltas)
+
         # Check that balances are correct
         balance0 = self.nodes[1].getaddressbalance("2N2JD6wb56AfK4tfmM6PwdVmoYk2dCKf4Br")
         assert_equal(balance0["balance"], 45 * 100000000)
@@ -154,6 +181,8 @@ class AddressIndexTest(BitcoinTestFramework):
         self.sync_all()
         balance1 = self.nodes[1].getaddressbalance(address2)
         assert_equal(balance1["balance"], amount)
+        assert_equal(balance1["received"], amount)
+        assert_equal(balance1["txcount"], 1)
 
         tx = CTransaction()
         tx.vin = [CTxIn(COutPoint(int(spending_txid, 16), 0))]
@@ -169,6 +198,8 @@ class AddressIndexTest(BitcoinTestFramework):
 
         balance2 = self.nodes[1].getaddressbalance(address2)
         assert_equal(balance2["balance"], change_amount)
+        assert_equal(balance2["received"], amount + change_amount)
+        assert_equal(balance2["txcount"], 2)
 
         # Check that deltas are returned correctly
         deltas = self.nodes[1].getaddressdeltas({"addresses": [address2], "start": 1, "end": 200})
@@ -210,6 +241,10 @@ class AddressIndexTest(BitcoinTestFramework):
         assert_equal(len(utxos2), 1)
         assert_equal(utxos2[0]["satoshis"], amount)
 
+        utxos_page = self.nodes[1].getaddressutxos({"addresses": [address2], "limit": 1})
+        assert_equal(utxos_page["utxos"], utxos2)
+        assert("cursor" not in utxos_page)
+
         # Check sorting of utxos
         self.nodes[2].generate(150)
 
@@ -342,6 +377,22 @@ class AddressIndexTest(BitcoinTestFramework):
         assert_equal(utxos_with_info["height"], 267)
         assert_equal(utxos_with_info["hash"], expected_tip_block_hash)
 
+        # Switching the index on for an existing chain state builds it in the background
+        print("Testing background index build...")
+
+        stop_node(self.nodes[0], 0)
+        self.nodes[0] = start_node(0, self.options.tmpdir, ["-debug", "-relaypriority=0", "-addressindex"])
+        for i in range(100):
+            try:
+                balance = self.nodes[0].getaddressbalance({"addresses": [address2]})
+                break
+            except JSONRPCException as e:
+                assert_equal(e.error["code"], -28)
+                time.sleep(0.1)
+        assert_equal(balance, self.nodes[1].getaddressbalance({"addresses": [address2]}))
+        assert_equal(self.nodes[0].getaddresstxids({"addresses": [address2]}), self.nodes[1].getaddresstxids({"addresses": [address2]}))
+        assert_equal(self.nodes[0].getblockchaininfo()["indexes"], {})
+
         print("Passed\n")
 
 
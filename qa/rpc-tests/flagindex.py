@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+# Copyright (c) 2016 The Sexcoin developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test flagindex generation and fetching
+#
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+
+
+class FlagIndexTest(BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 2)
+
+    def setup_network(self):
+        self.nodes = []
+        # Node 0 is the "wallet" node, node 1 indexes the flags
+        self.nodes.append(start_node(0, self.options.tmpdir, ["-debug"]))
+        self.nodes.append(start_node(1, self.options.tmpdir, ["-debug", "-flagindex", "-addressindex"]))
+        connect_nodes(self.nodes[0], 1)
+
+        self.is_network_split = False
+        self.sync_all()
+
+    def run_test(self):
+        print("Mining blocks...")
+        self.nodes[0].generate(105)
+        self.sync_all()
+
+        address1 = self.nodes[1].getnewaddress()
+        address2 = self.nodes[1].getnewaddress()
+        txid18 = self.nodes[0].sendtoaddress(address1, 1, "over18")
+        txid21 = self.nodes[0].sendtoaddress(address2, 1, "over21")
+        self.nodes[0].sendtoaddress(address1, 1)
+        self.sync_all()
+
+        print("Testing mempool flag index...")
+        assert_equal(self.nodes[1].getflaggedtxids({"flag": "over18"}), [])
+        mempool = self.nodes[1].getflaggedtxids({"flag": "over18", "mempool": True})
+        assert_equal([entry["txid"] for entry in mempool], [txid18])
+        assert("timestamp" in mempool[0])
+
+        self.nodes[0].generate(1)
+        self.sync_all()
+
+        print("Testing getflaggedtxids...")
+        over18 = self.nodes[1].getflaggedtxids({"flag": "over18"})
+        assert_equal(len(over18), 1)
+        assert_equal(over18[0]["txid"], txid18)
+        assert_equal(over18[0]["height"], 106)
+        assert_equal(over18[0]["flags"], 2)
+        assert_equal(self.nodes[1].getflaggedtxids({"flag": "TX_F_IS_OVER_21"})[0]["txid"], txid21)
+        assert_equal(self.nodes[1].getflaggedtxids({"flag": 4, "start": 1, "end": 105}), [])
+        assert_equal(self.nodes[1].getflaggedtxids({"flag": "consent"}), [])
+
+        # Only the flagged payments of the given addresses
+        assert_equal(self.nodes[1].getflaggedtxids({"flag": "over18", "addresses": [address2]}), [])
+        assert_equal(len(self.nodes[1].getflaggedtxids({"flag": "over18", "addresses": [address1]})), 1)
+
+        assert_raises(JSONRPCException, self.nodes[1].getflaggedtxids, {"flag": 3})
+        assert_raises(JSONRPCException, self.nodes[0].getflaggedtxids, {"flag": "over18"})
+
+        print("Testing disconnecting the block...")
+        self.nodes[1].invalidateblock(self.nodes[1].getbestblockhash())
+        assert_equal(self.nodes[1].getflaggedtxids({"flag": "over18"}), [])
+
+        print("Passed\n")
+
+
+if __name__ == '__main__':
+    FlagIndexTest().main()
@@ -71,6 +71,13 @@ class SpentIndexTest(BitcoinTestFramework):
         assert_equal(info["index"], 0)
         assert_equal(info["height"], 106)
 
+        # Check that many outputs can be looked up at once, unspent ones give null
+        infos = self.nodes[1].getspentinfo([{"txid": unspent[0]["txid"], "index": unspent[0]["vout"]},
+                                            {"txid": txid, "index": 0}])
+        assert_equal(len(infos), 2)
+        assert_equal(infos[0], info)
+        assert_equal(infos[1], None)
+
         print("Testing getrawtransaction method...")
 
         # Check that verbose raw transaction includes spent info
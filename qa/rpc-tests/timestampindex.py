@@ -54,6 +54,12 @@ class TimestampIndexTest(BitcoinTestFramework):
 
         assert_equal(hashes, blockhashes)
 
+        print("Checking timestamp index after a restart...")
+        stop_node(self.nodes[1], 1)
+        self.nodes[1] = start_node(1, self.options.tmpdir, ["-debug", "-timestampindex"])
+        assert_equal(self.nodes[1].getblockhashes(high, low), blockhashes)
+        assert_equal(self.nodes[1].getblockhashes(high, low + 76), [])
+
         print("Passed\n")
 
 
@@ -9,8 +9,68 @@
 #include "uint256.h"
 #include "amount.h"
 
+#include "compressor.h"
 #include "script/script.h"
 
+/** Current on-disk format of the address and address unspent index */
+static const int ADDRESSINDEX_FORMAT_VERSION = 1;
+
+/**
+ * Variable length encoding for the integer fields of index keys that keeps
+ * the byte order of the keys equal to the order of the values: the top two
+ * bits of the first byte count the bytes that follow, the remaining bits
+ * are the value in big-endian order. Values up to MAX_ORDERED_COMPACT.
+ */
+static const uint32_t MAX_ORDERED_COMPACT = (1U << 30) - 1;
+
+inline unsigned int GetOrderedCompactSize(uint32_t n)
+{
+    return n < (1U << 6) ? 1 : n < (1U << 14) ? 2 : n < (1U << 22) ? 3 : 4;
+}
+
+template<typename Stream>
+void ser_writeorderedcompact(Stream& s, uint32_t n)
+{
+    if (n > MAX_ORDERED_COMPACT)
+        throw std::ios_base::failure("ser_writeorderedcompact(): value out of range");
+    const unsigned int nSize = GetOrderedCompactSize(n);
+    ser_writedata8(s, ((nSize - 1) << 6) | (n >> (8 * (nSize - 1))));
+    for (unsigned int i = nSize - 1; i-- > 0;)
+        ser_writedata8(s, (n >> (8 * i)) & 0xff);
+}
+
+template<typename Stream>
+uint32_t ser_readorderedcompact(Stream& s)
+{
+    uint8_t ch = ser_readdata8(s);
+    uint32_t n = ch & 0x3f;
+    for (unsigned int i = ch >> 6; i > 0; i--)
+        n = (n << 8) | ser_readdata8(s);
+    return n;
+}
+
+/** Script of a P2PKH (type 1) or P2SH (type 2) address */
+inline CScript GetAddressScript(unsigned int type, const uint160& hashBytes)
+{
+    if (type == 2)
+        return CScript() << OP_HASH160 << ToByteVector(hashBytes) << OP_EQUAL;
+    return CScript() << OP_DUP << OP_HASH160 << ToByteVector(hashBytes) << OP_EQUALVERIFY << OP_CHECKSIG;
+}
+
+/** Address type (1 for P2PKH, 2 for P2SH, 0 for anything else) and hash of a script */
+inline int GetScriptAddress(const CScript& script, uint160& hashBytes)
+{
+    if (script.IsPayToScriptHash()) {
+        hashBytes = uint160(std::vector<unsigned char>(script.begin()+2, script.begin()+22));
+        return 2;
+    } else if (script.IsPayToPublicKeyHash()) {
+        hashBytes = uint160(std::vector<unsigned char>(script.begin()+3, script.begin()+23));
+        return 1;
+    }
+    hashBytes.SetNull();
+    return 0;
+}
+
 struct CAddressUnspentKey {
     unsigned int type;
     uint160 hashBytes;
@@ -18,21 +78,21 @@ struct CAddressUnspentKey {
     size_t index;
 
     size_t GetSerializeSize(int nType, int nVersion) const {
-        return 57;
+        return 53 + GetOrderedCompactSize(index);
     }
     template<typename Stream>
     void Serialize(Stream& s, int nType, int nVersion) const {
         ser_writedata8(s, type);
         hashBytes.Serialize(s, nType, nVersion);
         txhash.Serialize(s, nType, nVersion);
-        ser_writedata32(s, index);
+        ser_writeorderedcompact(s, index);
     }
     template<typename Stream>
     void Unserialize(Stream& s, int nType, int nVersion) {
         type = ser_readdata8(s);
         hashBytes.Unserialize(s, nType, nVersion);
         txhash.Unserialize(s, nType, nVersion);
-        index = ser_readdata32(s);
+        index = ser_readorderedcompact(s);
     }
 
     CAddressUnspentKey(unsigned int addressType, uint160 addressHash, uint256 txid, size_t indexValue) {
@@ -63,9 +123,16 @@ struct CAddressUnspentValue {
 
     template <typename Stream, typename Operation>
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
-        READWRITE(satoshis);
-        READWRITE(*(CScriptBase*)(&script));
-        READWRITE(blockHeight);
+        // The script is not stored, it follows from the address in the key
+        if (!ser_action.ForRead()) {
+            uint64_t nAmount = CTxOutCompressor::CompressAmount(satoshis);
+            READWRITE(VARINT(nAmount));
+        } else {
+            uint64_t nAmount = 0;
+            READWRITE(VARINT(nAmount));
+            satoshis = CTxOutCompressor::DecompressAmount(nAmount);
+        }
+        READWRITE(VARINT(blockHeight));
     }
 
     CAddressUnspentValue(CAmount sats, CScript scriptPubKey, int height) {
@@ -99,30 +166,28 @@ struct CAddressIndexKey {
     bool spending;
 
     size_t GetSerializeSize(int nType, int nVersion) const {
-        return 66;
+        return 53 + GetOrderedCompactSize(blockHeight) + GetOrderedCompactSize(txindex) + GetOrderedCompactSize(index * 2 + spending);
     }
     template<typename Stream>
     void Serialize(Stream& s, int nType, int nVersion) const {
         ser_writedata8(s, type);
         hashBytes.Serialize(s, nType, nVersion);
-        // Heights are stored big-endian for key sorting in LevelDB
-        ser_writedata32be(s, blockHeight);
-        ser_writedata32be(s, txindex);
+        // Order preserving, so that LevelDB sorts the keys by height
+        ser_writeorderedcompact(s, blockHeight);
+        ser_writeorderedcompact(s, txindex);
         txhash.Serialize(s, nType, nVersion);
-        ser_writedata32(s, index);
-        char f = spending;
-        ser_writedata8(s, f);
+        ser_writeorderedcompact(s, index * 2 + spending);
     }
     template<typename Stream>
     void Unserialize(Stream& s, int nType, int nVersion) {
         type = ser_readdata8(s);
         hashBytes.Unserialize(s, nType, nVersion);
-        blockHeight = ser_readdata32be(s);
-        txindex = ser_readdata32be(s);
+        blockHeight = ser_readorderedcompact(s);
+        txindex = ser_readorderedcompact(s);
         txhash.Unserialize(s, nType, nVersion);
-        index = ser_readdata32(s);
-        char f = ser_readdata8(s);
-        spending = f;
+        uint32_t n = ser_readorderedcompact(s);
+        index = n >> 1;
+        spending = n & 1;
     }
 
     CAddressIndexKey(unsigned int addressType, uint160 addressHash, int height, int blockindex,
@@ -191,19 +256,19 @@ struct CAddressIndexIteratorHeightKey {
     int blockHeight;
 
     size_t GetSerializeSize(int nType, int nVersion) const {
-        return 25;
+        return 21 + GetOrderedCompactSize(blockHeight);
     }
     template<typename Stream>
     void Serialize(Stream& s, int nType, int nVersion) const {
         ser_writedata8(s, type);
         hashBytes.Serialize(s, nType, nVersion);
-        ser_writedata32be(s, blockHeight);
+        ser_writeorderedcompact(s, blockHeight);
     }
     template<typename Stream>
     void Unserialize(Stream& s, int nType, int nVersion) {
         type = ser_readdata8(s);
         hashBytes.Unserialize(s, nType, nVersion);
-        blockHeight = ser_readdata32be(s);
+        blockHeight = ser_readorderedcompact(s);
     }
 
     CAddressIndexIteratorHeightKey(unsigned int addressType, uint160 addressHash, int height) {
@@ -223,6 +288,107 @@ struct CAddressIndexIteratorHeightKey {
     }
 };
 
+/**
+ * Value of an address index entry: the compressed amount, with the sign in
+ * the lowest bit.
+ */
+class CAddressIndexAmount
+{
+private:
+    CAmount &amount;
+
+public:
+    CAddressIndexAmount(CAmount &amountIn) : amount(amountIn) { }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        if (!ser_action.ForRead()) {
+            uint64_t nVal = CTxOutCompressor::CompressAmount(amount < 0 ? -amount : amount) * 2 + (amount < 0);
+            READWRITE(VARINT(nVal));
+        } else {
+            uint64_t nVal = 0;
+            READWRITE(VARINT(nVal));
+            amount = CTxOutCompressor::DecompressAmount(nVal >> 1);
+            if (nVal & 1)
+                amount = -amount;
+        }
+    }
+};
+
+/**
+ * Orders address index keys by their position in the chain first, so that
+ * the entries of one transaction for all addresses end up next to each other.
+ */
+struct CAddressIndexKeyHeightCompare
+{
+    bool operator()(const CAddressIndexKey& a, const CAddressIndexKey& b) const {
+        if (a.blockHeight != b.blockHeight)
+            return a.blockHeight < b.blockHeight;
+        if (a.txindex != b.txindex)
+            return a.txindex < b.txindex;
+        if (a.txhash != b.txhash)
+            return a.txhash < b.txhash;
+        if (a.type != b.type)
+            return a.type < b.type;
+        if (a.hashBytes != b.hashBytes)
+            return a.hashBytes < b.hashBytes;
+        if (a.index != b.index)
+            return a.index < b.index;
+        return a.spending < b.spending;
+    }
+};
+
+struct CAddressUnspentKeyCompare
+{
+    bool operator()(const CAddressUnspentKey& a, const CAddressUnspentKey& b) const {
+        if (a.type != b.type)
+            return a.type < b.type;
+        if (a.hashBytes != b.hashBytes)
+            return a.hashBytes < b.hashBytes;
+        if (a.txhash != b.txhash)
+            return a.txhash < b.txhash;
+        return a.index < b.index;
+    }
+};
+
+/** Running totals over the whole address index history of one address */
+struct CAddressBalanceValue {
+    CAmount balance;
+    CAmount received;
+    int64_t txCount;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(balance);
+        READWRITE(received);
+        READWRITE(VARINT(txCount));
+    }
+
+    CAddressBalanceValue(CAmount balanceIn, CAmount receivedIn, int64_t txCountIn) {
+        balance = balanceIn;
+        received = receivedIn;
+        txCount = txCountIn;
+    }
+
+    CAddressBalanceValue() {
+        SetNull();
+    }
+
+    void SetNull() {
+        balance = 0;
+        received = 0;
+        txCount = 0;
+    }
+
+    bool IsNull() const {
+        return (txCount == 0);
+    }
+};
+
 struct CMempoolAddressDelta
 {
     int64_t time;
@@ -245,6 +411,18 @@ struct CMempoolAddressDelta
     }
 };
 
+/** A mempool address index entry, stored under the address it belongs to */
+struct CMempoolAddressEntry
+{
+    uint256 txhash;
+    unsigned int index;
+    bool spending;
+    CMempoolAddressDelta delta;
+
+    CMempoolAddressEntry(const uint256 &hash, unsigned int i, bool s, const CMempoolAddressDelta &d) :
+        txhash(hash), index(i), spending(s), delta(d) {}
+};
+
 struct CMempoolAddressDeltaKey
 {
     int type;
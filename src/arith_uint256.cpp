@@ -92,6 +92,17 @@ base_uint<BITS>& base_uint<BITS>::operator/=(const base_uint& b)
         throw uint_error("Division by zero");
     if (div_bits > num_bits) // the result is certainly 0.
         return *this;
+    if (div_bits <= 32) {
+        // Short division by a single word, most significant word first.
+        uint64_t d = div.pn[0];
+        uint64_t rem = 0;
+        for (int i = WIDTH - 1; i >= 0; i--) {
+            uint64_t cur = (rem << 32) | num.pn[i];
+            pn[i] = (uint32_t)(cur / d);
+            rem = cur % d;
+        }
+        return *this;
+    }
     int shift = num_bits - div_bits;
     div <<= shift; // shift so that div and num align.
     while (shift >= 0) {
@@ -9,6 +9,8 @@
 #include "util.h"
 #include "base58.h"
 #include "auxpow.h"
+#include "core_memusage.h"
+#include "memusage.h"
 
 using namespace std;
 using namespace boost;
@@ -16,6 +18,8 @@ using namespace boost;
 /** Global dirty block merged mining entries. */
 map<uint256, std::shared_ptr<CAuxPow> > mapDirtyAuxPow;
 
+CAuxPowCache auxpowCache(DEFAULT_AUXPOW_CACHE << 20);
+
 unsigned char pchMergedMiningHeader[] = { 0xfa, 0xbe, 'm', 'm' } ;
 
 int GetAuxPowStartBlock(const Consensus::Params& params)
@@ -157,3 +161,98 @@ CKeyID GetAuxpowMiningKey(void)
     }
     return result;
 }
+
+CAuxPowCache::CAuxPowCache(size_t nMaxUsageIn) : nMaxUsage(nMaxUsageIn), nUsage(0), nHits(0), nMisses(0)
+{
+}
+
+bool CAuxPowCache::Get(const uint256& hash, std::shared_ptr<CAuxPow>& auxpow)
+{
+    LOCK(cs);
+    std::map<uint256, EntryList::iterator>::iterator it = mapEntries.find(hash);
+    if (it == mapEntries.end()) {
+        nMisses++;
+        return false;
+    }
+    nHits++;
+    lru.splice(lru.begin(), lru, it->second);
+    auxpow = it->second->auxpow;
+    return true;
+}
+
+void CAuxPowCache::Insert(const uint256& hash, const std::shared_ptr<CAuxPow>& auxpow)
+{
+    LOCK(cs);
+    if (nMaxUsage == 0 || mapEntries.count(hash))
+        return;
+    CEntry entry;
+    entry.hash = hash;
+    entry.auxpow = auxpow;
+    // The auxpow itself, its transaction and branches, plus the list and
+    // map nodes that track it.
+    entry.nUsage = memusage::MallocUsage(sizeof(CAuxPow)) +
+                   RecursiveDynamicUsage(*(const CTransaction*)auxpow.get()) +
+                   memusage::DynamicUsage(auxpow->vMerkleBranch) +
+                   memusage::DynamicUsage(auxpow->vChainMerkleBranch) +
+                   memusage::MallocUsage(sizeof(CEntry) + 2 * sizeof(void*)) +
+                   memusage::MallocUsage(sizeof(std::pair<const uint256, EntryList::iterator>) + 4 * sizeof(void*));
+    lru.push_front(entry);
+    mapEntries.insert(std::make_pair(hash, lru.begin()));
+    nUsage += entry.nUsage;
+    Trim();
+}
+
+void CAuxPowCache::Trim()
+{
+    AssertLockHeld(cs);
+    while (nUsage > nMaxUsage && !lru.empty()) {
+        nUsage -= lru.back().nUsage;
+        mapEntries.erase(lru.back().hash);
+        lru.pop_back();
+    }
+}
+
+void CAuxPowCache::SetMaxUsage(size_t nMaxUsageIn)
+{
+    LOCK(cs);
+    nMaxUsage = nMaxUsageIn;
+    Trim();
+}
+
+void CAuxPowCache::Clear()
+{
+    LOCK(cs);
+    lru.clear();
+    mapEntries.clear();
+    nUsage = 0;
+}
+
+size_t CAuxPowCache::Size() const
+{
+    LOCK(cs);
+    return mapEntries.size();
+}
+
+size_t CAuxPowCache::DynamicMemoryUsage() const
+{
+    LOCK(cs);
+    return nUsage;
+}
+
+size_t CAuxPowCache::MaxUsage() const
+{
+    LOCK(cs);
+    return nMaxUsage;
+}
+
+uint64_t CAuxPowCache::Hits() const
+{
+    LOCK(cs);
+    return nHits;
+}
+
+uint64_t CAuxPowCache::Misses() const
+{
+    LOCK(cs);
+    return nMisses;
+}
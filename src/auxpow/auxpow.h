@@ -5,6 +5,7 @@
 #ifndef BITCOIN_AUXPOW_H
 #define BITCOIN_AUXPOW_H
 
+#include <list>
 #include <memory.h>
 #include "versionbits.h"
 #include "consensus/params.h"
@@ -12,6 +13,7 @@
 #include "primitives/blockheader.h"
 #include "auxpow/consensus.h"
 #include "serialize.h"
+#include "sync.h"
 
 
 class CAuxPow : public CMerkleTx
@@ -71,6 +73,54 @@ template<typename Stream> void SerReadWrite(Stream& s, std::shared_ptr<CAuxPow>&
         pobj.reset();
 }
 
+/** Default for -auxpowcache, the auxpow cache size in MiB */
+static const int64_t DEFAULT_AUXPOW_CACHE = 16;
+
+/**
+ * Bounded LRU cache of auxpows loaded back from the block tree database,
+ * so that repeatedly serving the headers of merge-mined blocks does not
+ * cost a database read and deserialization each time. Entries not yet
+ * flushed live in mapDirtyAuxPow instead.
+ */
+class CAuxPowCache
+{
+private:
+    struct CEntry {
+        uint256 hash;
+        std::shared_ptr<CAuxPow> auxpow;
+        size_t nUsage;
+    };
+    typedef std::list<CEntry> EntryList;
+
+    mutable CCriticalSection cs;
+    //! Most recently used entries first
+    EntryList lru;
+    std::map<uint256, EntryList::iterator> mapEntries;
+    size_t nMaxUsage;
+    size_t nUsage;
+    uint64_t nHits;
+    uint64_t nMisses;
+
+    void Trim();
+
+public:
+    CAuxPowCache(size_t nMaxUsageIn);
+
+    //! Look up the auxpow of a block, counting a hit or miss
+    bool Get(const uint256& hash, std::shared_ptr<CAuxPow>& auxpow);
+    void Insert(const uint256& hash, const std::shared_ptr<CAuxPow>& auxpow);
+    void SetMaxUsage(size_t nMaxUsageIn);
+    void Clear();
+
+    size_t Size() const;
+    size_t DynamicMemoryUsage() const;
+    size_t MaxUsage() const;
+    uint64_t Hits() const;
+    uint64_t Misses() const;
+};
+
+/** Global cache of auxpows read from the block tree database. */
+extern CAuxPowCache auxpowCache;
 
 extern void RemoveMergedMiningHeader(std::vector<unsigned char>& vchAux);
 extern int GetAuxPowStartBlock(const Consensus::Params& params);
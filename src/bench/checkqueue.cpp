@@ -0,0 +1,87 @@
+// Copyright (c) 2016 The Sexcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "checkqueue.h"
+#include "key.h"
+#include "pubkey.h"
+#include "random.h"
+#include "uint256.h"
+
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+// A script-heavy block: 2000 transactions with two signature checks each.
+static const int SIGBLOCK_TRANSACTIONS = 2000;
+static const int SIGBLOCK_INPUTS = 2;
+
+struct SigCheck
+{
+    const CPubKey *pubkey;
+    const uint256 *hash;
+    const std::vector<unsigned char> *sig;
+
+    SigCheck() : pubkey(NULL), hash(NULL), sig(NULL) {}
+    SigCheck(const CPubKey& pubkeyIn, const uint256& hashIn, const std::vector<unsigned char>& sigIn) :
+        pubkey(&pubkeyIn), hash(&hashIn), sig(&sigIn) {}
+
+    bool operator()() {
+        return pubkey->Verify(*hash, *sig);
+    }
+
+    void swap(SigCheck& check) {
+        std::swap(pubkey, check.pubkey);
+        std::swap(hash, check.hash);
+        std::swap(sig, check.sig);
+    }
+};
+
+// Verify the block with the master and nThreads - 1 workers, adding the
+// checks one transaction at a time as ConnectBlock does.
+static void CheckQueueSigBlock(benchmark::State& state, int nThreads)
+{
+    ECCVerifyHandle verifyHandle;
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    std::vector<uint256> hashes(SIGBLOCK_TRANSACTIONS * SIGBLOCK_INPUTS);
+    std::vector<std::vector<unsigned char> > sigs(hashes.size());
+    for (size_t i = 0; i < hashes.size(); i++) {
+        hashes[i] = GetRandHash();
+        key.Sign(hashes[i], sigs[i]);
+    }
+
+    CCheckQueue<SigCheck> queue(128);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nThreads - 1; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<SigCheck>::Thread, boost::ref(queue)));
+
+    while (state.KeepRunning()) {
+        CCheckQueueControl<SigCheck> control(&queue);
+        for (int tx = 0; tx < SIGBLOCK_TRANSACTIONS; tx++) {
+            std::vector<SigCheck> vChecks;
+            for (int i = tx * SIGBLOCK_INPUTS; i < (tx + 1) * SIGBLOCK_INPUTS; i++)
+                vChecks.push_back(SigCheck(pubkey, hashes[i], sigs[i]));
+            control.Add(vChecks);
+        }
+        assert(control.Wait());
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+static void CheckQueueSigBlock1Thread(benchmark::State& state) { CheckQueueSigBlock(state, 1); }
+static void CheckQueueSigBlock2Threads(benchmark::State& state) { CheckQueueSigBlock(state, 2); }
+static void CheckQueueSigBlock4Threads(benchmark::State& state) { CheckQueueSigBlock(state, 4); }
+static void CheckQueueSigBlock8Threads(benchmark::State& state) { CheckQueueSigBlock(state, 8); }
+static void CheckQueueSigBlock16Threads(benchmark::State& state) { CheckQueueSigBlock(state, 16); }
+
+BENCHMARK(CheckQueueSigBlock1Thread);
+BENCHMARK(CheckQueueSigBlock2Threads);
+BENCHMARK(CheckQueueSigBlock4Threads);
+BENCHMARK(CheckQueueSigBlock8Threads);
+BENCHMARK(CheckQueueSigBlock16Threads);
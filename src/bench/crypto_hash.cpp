@@ -10,6 +10,7 @@
 #include "uint256.h"
 #include "utiltime.h"
 #include "crypto/ripemd160.h"
+#include "crypto/scrypt.h"
 #include "crypto/sha1.h"
 #include "crypto/sha256.h"
 #include "crypto/sha512.h"
@@ -69,6 +70,24 @@ static void SipHash_32b(benchmark::State& state)
     }
 }
 
+static void Scrypt(benchmark::State& state)
+{
+    uint256 hash;
+    std::vector<char> in(80 * SCRYPT_MAX_LANES, 0);
+    while (state.KeepRunning())
+        for (int i = 0; i < SCRYPT_MAX_LANES; i++)
+            scrypt_1024_1_1_256(&in[i * 80], (char*)hash.begin());
+}
+
+static void ScryptBatch(benchmark::State& state)
+{
+    std::vector<uint256> hashes(SCRYPT_MAX_LANES);
+    std::vector<char> in(80 * SCRYPT_MAX_LANES, 0);
+    scrypt_detect_batch();
+    while (state.KeepRunning())
+        scrypt_1024_1_1_256_batch(&in[0], (char*)hashes[0].begin(), SCRYPT_MAX_LANES);
+}
+
 BENCHMARK(RIPEMD160);
 BENCHMARK(SHA1);
 BENCHMARK(SHA256);
@@ -76,3 +95,6 @@ BENCHMARK(SHA512);
 
 BENCHMARK(SHA256_32b);
 BENCHMARK(SipHash_32b);
+
+BENCHMARK(Scrypt);
+BENCHMARK(ScryptBatch);
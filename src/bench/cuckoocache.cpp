@@ -0,0 +1,91 @@
+// Copyright (c) 2016 The Sexcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "checkqueue.h"
+#include "cuckoocache.h"
+#include "random.h"
+#include "uint256.h"
+
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+// A block's worth of signature cache traffic: every check looks up the
+// signatures of an input, most of them cached on mempool acceptance, and
+// inserts a signature as a newly relayed transaction would.
+static const int CACHE_CHECKS = 4000;
+static const int CACHE_LOOKUPS_PER_CHECK = 4;
+
+struct CacheCheck
+{
+    CCuckooCache *cache;
+    const uint256 *lookups;
+    const uint256 *insert;
+
+    CacheCheck() : cache(NULL), lookups(NULL), insert(NULL) {}
+    CacheCheck(CCuckooCache& cacheIn, const uint256* lookupsIn, const uint256& insertIn) :
+        cache(&cacheIn), lookups(lookupsIn), insert(&insertIn) {}
+
+    bool operator()() {
+        for (int i = 0; i < CACHE_LOOKUPS_PER_CHECK; i++)
+            cache->Contains(lookups[i], false);
+        cache->Insert(*insert);
+        return true;
+    }
+
+    void swap(CacheCheck& check) {
+        std::swap(cache, check.cache);
+        std::swap(lookups, check.lookups);
+        std::swap(insert, check.insert);
+    }
+};
+
+// Run the checks on the master and nThreads - 1 workers, as -par=nThreads would
+static void CuckooCacheContention(benchmark::State& state, int nThreads)
+{
+    CCuckooCache cache;
+    size_t nSlots = cache.Setup(32 << 20);
+    std::vector<uint256> vCached(nSlots / 2);
+    for (size_t i = 0; i < vCached.size(); i++) {
+        vCached[i] = GetRandHash();
+        cache.Insert(vCached[i]);
+    }
+    std::vector<uint256> vLookups(CACHE_CHECKS * CACHE_LOOKUPS_PER_CHECK);
+    for (size_t i = 0; i < vLookups.size(); i++)
+        vLookups[i] = i % 8 ? vCached[insecure_rand() % vCached.size()] : GetRandHash();
+    std::vector<uint256> vInserts(CACHE_CHECKS);
+    for (size_t i = 0; i < vInserts.size(); i++)
+        vInserts[i] = GetRandHash();
+
+    CCheckQueue<CacheCheck> queue(128);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nThreads - 1; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<CacheCheck>::Thread, boost::ref(queue)));
+
+    while (state.KeepRunning()) {
+        CCheckQueueControl<CacheCheck> control(&queue);
+        std::vector<CacheCheck> vChecks;
+        for (int i = 0; i < CACHE_CHECKS; i++)
+            vChecks.push_back(CacheCheck(cache, &vLookups[i * CACHE_LOOKUPS_PER_CHECK], vInserts[i]));
+        control.Add(vChecks);
+        control.Wait();
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+static void CuckooCacheContention1Thread(benchmark::State& state) { CuckooCacheContention(state, 1); }
+static void CuckooCacheContention2Threads(benchmark::State& state) { CuckooCacheContention(state, 2); }
+static void CuckooCacheContention4Threads(benchmark::State& state) { CuckooCacheContention(state, 4); }
+static void CuckooCacheContention8Threads(benchmark::State& state) { CuckooCacheContention(state, 8); }
+static void CuckooCacheContention16Threads(benchmark::State& state) { CuckooCacheContention(state, 16); }
+
+BENCHMARK(CuckooCacheContention1Thread);
+BENCHMARK(CuckooCacheContention2Threads);
+BENCHMARK(CuckooCacheContention4Threads);
+BENCHMARK(CuckooCacheContention8Threads);
+BENCHMARK(CuckooCacheContention16Threads);
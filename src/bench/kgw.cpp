@@ -0,0 +1,61 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "pow.h"
+#include "random.h"
+
+#include <vector>
+
+// A chain mined at the target spacing, so every walk goes back the full
+// PastBlocksMax blocks.
+static const int KGW_CHAIN_LENGTH = 10200;
+
+static void BuildSteadyChain(std::vector<CBlockIndex>& blocks, std::vector<uint256>& hashes, const Consensus::Params& params)
+{
+    blocks.resize(KGW_CHAIN_LENGTH);
+    hashes.resize(KGW_CHAIN_LENGTH);
+    for (int i = 0; i < KGW_CHAIN_LENGTH; i++) {
+        hashes[i] = GetRandHash();
+        blocks[i].pprev = i ? &blocks[i - 1] : NULL;
+        blocks[i].nHeight = params.Fork3Height + i;
+        blocks[i].nTime = 1400000000 + i * 60;
+        blocks[i].nBits = 0x1b0404cb + (i % 7);
+    }
+}
+
+// Full walk for a tip that has not been seen before.
+static void KimotoGravityWellWalk(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    const Consensus::Params& params = Params().GetConsensus();
+    std::vector<CBlockIndex> blocks;
+    std::vector<uint256> hashes;
+    BuildSteadyChain(blocks, hashes, params);
+
+    while (state.KeepRunning()) {
+        KimotoGravityWell(&blocks.back(), params);
+    }
+}
+
+// Repeated requests on the same tip, as for the header, the block and the
+// block templates built on it.
+static void KimotoGravityWellCached(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    const Consensus::Params& params = Params().GetConsensus();
+    std::vector<CBlockIndex> blocks;
+    std::vector<uint256> hashes;
+    BuildSteadyChain(blocks, hashes, params);
+    blocks.back().phashBlock = &hashes.back();
+
+    while (state.KeepRunning()) {
+        KimotoGravityWell(&blocks.back(), params);
+    }
+}
+
+BENCHMARK(KimotoGravityWellWalk);
+BENCHMARK(KimotoGravityWellCached);
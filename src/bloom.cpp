@@ -6,6 +6,7 @@
 
 #include "primitives/transaction.h"
 #include "hash.h"
+#include "memusage.h"
 #include "script/script.h"
 #include "script/standard.h"
 #include "random.h"
@@ -313,3 +314,48 @@ void CRollingBloomFilter::reset()
         *it = 0;
     }
 }
+
+CBlockedBloomFilter::CBlockedBloomFilter(unsigned int nElements, double fpRate) :
+    k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max()))
+{
+    /* Same sizing as CBloomFilter, with a whole number of 512-bit blocks. */
+    nHashFuncs = std::max(1, std::min((int)round(log(fpRate) / log(0.5)), 16));
+    uint64_t nFilterBits = (uint64_t)ceil(-1 / LN2SQUARED * nElements * log(fpRate));
+    data.resize(std::max<uint64_t>(1, (nFilterBits + 511) / 512) * 8);
+}
+
+size_t CBlockedBloomFilter::DynamicMemoryUsage() const
+{
+    return memusage::DynamicUsage(data);
+}
+
+uint64_t CBlockedBloomFilter::Hash(const COutPoint& outpoint) const
+{
+    return CSipHasher(k0, k1).Write(outpoint.hash.GetUint64(0)).Write(outpoint.hash.GetUint64(1))
+                             .Write(outpoint.hash.GetUint64(2)).Write(outpoint.hash.GetUint64(3)).Write(outpoint.n).Finalize();
+}
+
+/* The upper half of the hash picks the block, the lower half the bits in it. */
+void CBlockedBloomFilter::insert(const COutPoint& outpoint)
+{
+    uint64_t h = Hash(outpoint);
+    uint64_t* block = &data[((h >> 32) * (data.size() / 8)) >> 32 << 3];
+    uint32_t h1 = h & 0xFFFF, h2 = ((h >> 16) & 0xFFFF) | 1;
+    for (int n = 0; n < nHashFuncs; n++) {
+        uint32_t bit = (h1 + n * h2) & 0x1FF;
+        block[bit >> 6] |= ((uint64_t)1) << (bit & 0x3F);
+    }
+}
+
+bool CBlockedBloomFilter::contains(const COutPoint& outpoint) const
+{
+    uint64_t h = Hash(outpoint);
+    const uint64_t* block = &data[((h >> 32) * (data.size() / 8)) >> 32 << 3];
+    uint32_t h1 = h & 0xFFFF, h2 = ((h >> 16) & 0xFFFF) | 1;
+    for (int n = 0; n < nHashFuncs; n++) {
+        uint32_t bit = (h1 + n * h2) & 0x1FF;
+        if (!((block[bit >> 6] >> (bit & 0x3F)) & 1))
+            return false;
+    }
+    return true;
+}
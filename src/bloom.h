@@ -140,4 +140,32 @@ private:
     int nHashFuncs;
 };
 
+/**
+ * BlockedBloomFilter is a probabilistic set of outpoints that never forgets
+ * an element. contains(outpoint) returns false only for outpoints that were
+ * never insert()'ed, and may return true for others at around the given
+ * false-positive rate while at most nElements are stored.
+ *
+ * All bits of an element lie in one 512-bit block, so every lookup touches
+ * a single cache line.
+ */
+class CBlockedBloomFilter
+{
+public:
+    // Salted with GetRand() at creation time, see CRollingBloomFilter.
+    CBlockedBloomFilter(unsigned int nElements, double nFPRate);
+
+    void insert(const COutPoint& outpoint);
+    bool contains(const COutPoint& outpoint) const;
+
+    size_t DynamicMemoryUsage() const;
+
+private:
+    std::vector<uint64_t> data;
+    uint64_t k0, k1;
+    int nHashFuncs;
+
+    uint64_t Hash(const COutPoint& outpoint) const;
+};
+
 #endif // BITCOIN_BLOOM_H
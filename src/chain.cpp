@@ -43,13 +43,12 @@ CBlockHeader CBlockIndex::GetBlockHeader(const std::map<uint256, std::shared_ptr
             std::map<uint256, std::shared_ptr<CAuxPow> >::const_iterator it = mapDirtyAuxPow.find(*phashBlock);
             if (it != mapDirtyAuxPow.end()) {
                 block.auxpow = it->second;
-            } else {
-                CDiskBlockIndex diskblockindex;
-                // auxpow is not in memory, load CDiskBlockHeader
-                // from database to get it
+            } else if (!auxpowCache.Get(*phashBlock, block.auxpow)) {
+                // auxpow is not in memory, load it from its own
+                // record in the database
 
-                pblocktree->ReadDiskBlockIndex(*phashBlock, diskblockindex);
-                block.auxpow = diskblockindex.auxpow;
+                if (pblocktree->ReadAuxPow(*phashBlock, block.auxpow))
+                    auxpowCache.Insert(*phashBlock, block.auxpow);
             }
     }
 
@@ -436,6 +436,42 @@ public:
     std::string ToString() const;
 };
 
+/**
+ * Immutable part of a block index entry as stored in the block tree
+ * database. Unlike CDiskBlockIndex it never carries the auxpow, which is
+ * kept in a record of its own and only loaded when needed.
+ */
+class CDiskBlockHeaderIndex : public CDiskBlockIndex
+{
+public:
+    CDiskBlockHeaderIndex() {}
+
+    explicit CDiskBlockHeaderIndex(const CBlockIndex* pindex) : CDiskBlockIndex(pindex, std::shared_ptr<CAuxPow>()) {}
+
+    explicit CDiskBlockHeaderIndex(const CDiskBlockIndex& diskindex) : CDiskBlockIndex(diskindex) {
+        auxpow.reset();
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        if (!(nType & SER_GETHASH))
+            READWRITE(VARINT(nVersion));
+
+        READWRITE(VARINT(nHeight));
+        READWRITE(VARINT(nTx));
+
+        // block header
+        READWRITE(this->nVersion);
+        READWRITE(hashPrev);
+        READWRITE(hashMerkleRoot);
+        READWRITE(nTime);
+        READWRITE(nBits);
+        READWRITE(nNonce);
+    }
+};
+
 /** An in-memory indexed chain of blocks. */
 class CChain {
 private:
@@ -120,6 +120,9 @@ public:
         // The best chain should have at least this much work.
         consensus.nMinimumChainWork = uint256S("0x000000000000000000000000000000000000000000000000b22b163c2b81fb4d");
 
+        // No block is assumed valid by default; -assumevalid is opt-in.
+        consensus.defaultAssumeValid = uint256S("0x00");
+
         /**
          * The message start string is designed to be unlikely to occur in normal data.
          * The characters are rarely used upper ASCII, not valid as UTF-8, and produce
@@ -253,6 +256,9 @@ public:
         // consensus.nMinimumChainWork = uint256S("0x00000000000000000000000000000000000000000000000000006fce5d67766e");
         consensus.nMinimumChainWork = uint256S("0x0");
 
+        // No block is assumed valid by default; -assumevalid is opt-in.
+        consensus.defaultAssumeValid = uint256S("0x00");
+
         pchMessageStart[0] = 0xfa;
         pchMessageStart[1] = 0xce;
         pchMessageStart[2] = 0x96;
@@ -337,6 +343,9 @@ public:
         // The best chain should have at least this much work.
         consensus.nMinimumChainWork = uint256S("0x00");
 
+        // No block is assumed valid by default; -assumevalid is opt-in.
+        consensus.defaultAssumeValid = uint256S("0x00");
+
         pchMessageStart[0] = 0xfa;
         pchMessageStart[1] = 0xce;
         pchMessageStart[2] = 0x99;
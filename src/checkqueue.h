@@ -5,10 +5,13 @@
 #ifndef BITCOIN_CHECKQUEUE_H
 #define BITCOIN_CHECKQUEUE_H
 
+#include <assert.h>
+
 #include <algorithm>
+#include <atomic>
+#include <deque>
 #include <vector>
 
-#include <boost/foreach.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
@@ -16,7 +19,10 @@
 template <typename T>
 class CCheckQueueControl;
 
-/** 
+/** Maximum number of threads, including the master, that can share a CCheckQueue */
+static const int MAX_CHECKQUEUE_THREADS = 64;
+
+/**
  * Queue for verifications that have to be performed.
   * The verifications are represented by a type T, which must provide an
   * operator(), returning a bool.
@@ -25,135 +31,180 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Every thread has a work queue of its own. The master spreads the checks
+  * it adds over these, every thread takes batches from the front of its
+  * own queue, and once that is empty steals half of what is left at the
+  * back of another thread's queue. The locks of the work queues are
+  * rarely contended; progress is tracked with atomic counters, and the
+  * shared mutex is only taken to go to sleep and to wake sleepers up.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
-    boost::mutex mutex;
-
-    //! Worker threads block on this when out of work
-    boost::condition_variable condWorker;
-
-    //! Master thread blocks on this when out of work
-    boost::condition_variable condMaster;
+    /** The work of one thread; its owner takes from the front, thieves from the back */
+    struct WorkQueue
+    {
+        boost::mutex mutex;
+        std::deque<T> checks;
+    };
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+    //! The work queues; the first one belongs to the master
+    WorkQueue vQueues[MAX_CHECKQUEUE_THREADS];
 
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
+    //! The number of worker threads, each owning the next work queue
+    std::atomic<int> nWorkers;
 
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! The queue the next batch added goes to
+    unsigned int nNextQueue;
 
-    //! The temporary evaluation result.
-    bool fAllOk;
+    //! Number of checks sitting in the work queues, not taken by any thread yet.
+    //! It may briefly go negative, as checks are counted after they are queued.
+    std::atomic<int> nQueued;
 
     /**
      * Number of verifications that haven't completed yet.
      * This includes elements that are no longer queued, but still in the
      * worker's own batches.
      */
-    unsigned int nTodo;
+    std::atomic<unsigned int> nTodo;
 
-    //! Whether we're shutting down.
-    bool fQuit;
+    //! The temporary evaluation result.
+    std::atomic<bool> fAllOk;
+
+    //! Mutex that sleeping threads wait on
+    boost::mutex mutex;
+
+    //! Worker threads block on this when out of work
+    boost::condition_variable condWorker;
+
+    //! Master thread blocks on this when out of work
+    boost::condition_variable condMaster;
 
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    //! Take a batch from the front of our own work queue
+    bool TakeOwn(int nQueue, std::vector<T>& vChecks)
+    {
+        WorkQueue& queue = vQueues[nQueue];
+        boost::unique_lock<boost::mutex> lock(queue.mutex);
+        if (queue.checks.empty())
+            return false;
+        // Leave some for others to steal when there is little left
+        size_t nNow = std::max((size_t)1, std::min((size_t)nBatchSize, (queue.checks.size() + 1) / 2));
+        vChecks.resize(nNow);
+        for (size_t i = 0; i < nNow; i++) {
+            vChecks[i].swap(queue.checks.front());
+            queue.checks.pop_front();
+        }
+        return true;
+    }
+
+    //! Steal half of what is left at the back of the first other work queue that has any
+    bool Steal(int nQueue, std::vector<T>& vChecks)
+    {
+        int nQueues = nWorkers + 1;
+        for (int i = 1; i < nQueues; i++) {
+            WorkQueue& victim = vQueues[(nQueue + i) % nQueues];
+            boost::unique_lock<boost::mutex> lock(victim.mutex);
+            if (victim.checks.empty())
+                continue;
+            size_t nNow = std::max((size_t)1, std::min((size_t)nBatchSize, victim.checks.size() / 2));
+            vChecks.resize(nNow);
+            for (size_t j = 0; j < nNow; j++) {
+                vChecks[j].swap(victim.checks.back());
+                victim.checks.pop_back();
+            }
+            return true;
+        }
+        return false;
+    }
+
     /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    bool Loop(int nQueue)
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
+        const bool fMaster = nQueue == 0;
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
-        do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
+        while (true) {
+            if (TakeOwn(nQueue, vChecks) || Steal(nQueue, vChecks)) {
+                unsigned int nNow = vChecks.size();
+                nQueued -= nNow;
+                // execute work, unless a check already failed
+                bool fOk = fAllOk;
+                for (typename std::vector<T>::iterator it = vChecks.begin(); it != vChecks.end() && fOk; it++)
+                    fOk = (*it)();
+                vChecks.clear();
+                if (!fOk)
+                    fAllOk = false;
+                if (nTodo.fetch_sub(nNow) == nNow && !fMaster) {
+                    // We processed the last element; inform the master it can exit and return the result
+                    boost::unique_lock<boost::mutex> lock(mutex);
+                    condMaster.notify_one();
                 }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
-                }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+                continue;
+            }
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (fMaster && nTodo == 0) {
+                // reset the status for new work later, and return the current status
+                return fAllOk.exchange(true);
+            }
+            if (nQueued > 0)
+                continue;
+            if (fMaster) {
+                condMaster.wait(lock);
+            } else {
+                condWorker.wait(lock);
             }
-            // execute work
-            BOOST_FOREACH (T& check, vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
-        } while (true);
+        }
     }
 
 public:
     //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    CCheckQueue(unsigned int nBatchSizeIn) : nWorkers(0), nNextQueue(0), nQueued(0), nTodo(0), fAllOk(true), nBatchSize(nBatchSizeIn) {}
 
     //! Worker thread
     void Thread()
     {
-        Loop();
+        int nQueue = ++nWorkers;
+        assert(nQueue < MAX_CHECKQUEUE_THREADS);
+        Loop(nQueue);
     }
 
     //! Wait until execution finishes, and return whether all evaluations were successful.
     bool Wait()
     {
-        return Loop(true);
+        return Loop(0);
     }
 
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        BOOST_FOREACH (T& check, vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
-        }
+        if (vChecks.empty())
+            return;
         nTodo += vChecks.size();
+
+        // Spread the batch over the work queues in runs, starting where the
+        // previous batch stopped, so small batches land on different threads
+        int nQueues = nWorkers + 1;
+        size_t nRun = (vChecks.size() + nQueues - 1) / nQueues;
+        for (size_t i = 0; i < vChecks.size(); i += nRun) {
+            WorkQueue& queue = vQueues[nNextQueue++ % nQueues];
+            boost::unique_lock<boost::mutex> lock(queue.mutex);
+            for (size_t j = i; j < std::min(vChecks.size(), i + nRun); j++) {
+                queue.checks.push_back(T());
+                vChecks[j].swap(queue.checks.back());
+            }
+        }
+
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nQueued += vChecks.size();
         if (vChecks.size() == 1)
             condWorker.notify_one();
-        else if (vChecks.size() > 1)
+        else
             condWorker.notify_all();
     }
 
@@ -163,13 +214,12 @@ public:
 
     bool IsIdle()
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        return (nTotal == nIdle && nTodo == 0 && fAllOk == true);
+        return nTodo == 0 && fAllOk;
     }
 
 };
 
-/** 
+/**
  * RAII-style controller object for a CCheckQueue that guarantees the passed
  * queue is finished before continuing.
  */
@@ -73,6 +73,7 @@ struct Params {
     int64_t DifficultyAdjustmentInterval2() const { return nPowTargetTimespan2 / nPowTargetSpacing2; }
     int64_t DifficultyAdjustmentInterval3() const { return nPowTargetTimespan3 / nPowTargetSpacing3; }
     uint256 nMinimumChainWork;
+    uint256 defaultAssumeValid;
     
     /**
       * Sexcoin previous fork heighths
@@ -27,13 +27,23 @@
  * online backup system.
  */
 
+#if defined(HAVE_CONFIG_H)
+#include "bitcoin-config.h"
+#endif
+
 #include "crypto/scrypt.h"
 //#include "util.h"
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <vector>
 #include <openssl/sha.h>
 
+#if defined(ENABLE_AVX2) && !defined(BUILD_BITCOIN_INTERNAL)
+#define USE_SCRYPT_AVX2 1
+#include <cpuid.h>
+#endif
+
 #if defined(USE_SSE2) && !defined(USE_SSE2_ALWAYS)
 #ifdef _MSC_VER
 // MSVC 64bit is unable to use inline asm
@@ -329,3 +339,80 @@ void scrypt_1024_1_1_256(const char *input, char *output)
 	char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
     scrypt_1024_1_1_256_sp(input, output, scratchpad);
 }
+
+// The AVX2 kernel stays disabled until scrypt_detect_batch() has checked the CPU
+static bool scrypt_batch_use_avx2 = false;
+
+#if defined(USE_SCRYPT_AVX2)
+/** Check for AVX2 support in both the CPU and the OS (saving of the YMM registers). */
+static bool scrypt_cpu_has_avx2()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return false;
+    // OSXSAVE and AVX
+    if ((ecx & (1 << 27)) == 0 || (ecx & (1 << 28)) == 0)
+        return false;
+    unsigned int xcr0_lo, xcr0_hi;
+    __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    if ((xcr0_lo & 6) != 6)
+        return false;
+    if (__get_cpuid_max(0, NULL) < 7)
+        return false;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return (ebx & (1 << 5)) != 0;
+}
+#endif
+
+std::string scrypt_detect_batch()
+{
+#if defined(USE_SCRYPT_AVX2)
+    scrypt_batch_use_avx2 = scrypt_cpu_has_avx2();
+    if (scrypt_batch_use_avx2)
+        return "scrypt: batch hashing using 8-way avx2";
+#endif
+#if defined(USE_SCRYPT_4WAY)
+    return "scrypt: batch hashing using 4-way sse2";
+#else
+    return "scrypt: batch hashing using scrypt-generic";
+#endif
+}
+
+void scrypt_1024_1_1_256_batch(const char *input, char *output, size_t count)
+{
+    if (count == 0)
+        return;
+    size_t nScratchpadSize = SCRYPT_SCRATCHPAD_SIZE;
+#if defined(USE_SCRYPT_4WAY)
+    if (count >= (size_t)SCRYPT_4WAY_LANES)
+        nScratchpadSize = SCRYPT_4WAY_SCRATCHPAD_SIZE;
+#endif
+#if defined(USE_SCRYPT_AVX2)
+    if (scrypt_batch_use_avx2 && count >= (size_t)SCRYPT_8WAY_LANES)
+        nScratchpadSize = SCRYPT_8WAY_SCRATCHPAD_SIZE;
+#endif
+    // Too large for the stack once several lanes share it
+    std::vector<char> scratchpad(nScratchpadSize);
+
+#if defined(USE_SCRYPT_AVX2)
+    if (scrypt_batch_use_avx2) {
+        for (; count >= (size_t)SCRYPT_8WAY_LANES; count -= SCRYPT_8WAY_LANES) {
+            scrypt_1024_1_1_256_sp_avx2(input, output, &scratchpad[0]);
+            input += 80 * SCRYPT_8WAY_LANES;
+            output += 32 * SCRYPT_8WAY_LANES;
+        }
+    }
+#endif
+#if defined(USE_SCRYPT_4WAY)
+    for (; count >= (size_t)SCRYPT_4WAY_LANES; count -= SCRYPT_4WAY_LANES) {
+        scrypt_1024_1_1_256_sp_4way(input, output, &scratchpad[0]);
+        input += 80 * SCRYPT_4WAY_LANES;
+        output += 32 * SCRYPT_4WAY_LANES;
+    }
+#endif
+    for (; count > 0; count--) {
+        scrypt_1024_1_1_256_sp(input, output, &scratchpad[0]);
+        input += 80;
+        output += 32;
+    }
+}
@@ -2,14 +2,42 @@
 #define SCRYPT_H
 #include <stdlib.h>
 #include <stdint.h>
+#include <string>
 
 static const int SCRYPT_SCRATCHPAD_SIZE = 131072 + 63;
 
+/** Widest number of inputs hashed together by the interleaved kernels */
+static const int SCRYPT_MAX_LANES = 8;
+
 void scrypt_1024_1_1_256(const char *input, char *output);
 void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scratchpad);
 
+/**
+ * Hash count 80-byte inputs stored back to back in input into count 32-byte
+ * outputs. Independent inputs are run through the widest interleaved kernel
+ * the CPU supports; the results are identical to scrypt_1024_1_1_256.
+ */
+void scrypt_1024_1_1_256_batch(const char *input, char *output, size_t count);
+/** Select the batch kernel for this CPU; returns a description for the log. */
+std::string scrypt_detect_batch();
+
+/**
+ * Interleaved kernels hash SCRYPT_*WAY_LANES consecutive 80-byte inputs into
+ * as many consecutive 32-byte outputs. The 4-way kernel needs nothing beyond
+ * SSE2, the AVX2 kernel is only built when the compiler supports it and must
+ * only be called after scrypt_detect_batch() found AVX2 on the running CPU.
+ */
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define USE_SCRYPT_4WAY 1
+static const int SCRYPT_4WAY_LANES = 4;
+static const int SCRYPT_4WAY_SCRATCHPAD_SIZE = SCRYPT_4WAY_LANES * 131072 + 63;
+void scrypt_1024_1_1_256_sp_4way(const char *input, char *output, char *scratchpad);
+#endif
+static const int SCRYPT_8WAY_LANES = 8;
+static const int SCRYPT_8WAY_SCRATCHPAD_SIZE = SCRYPT_8WAY_LANES * 131072 + 63;
+void scrypt_1024_1_1_256_sp_avx2(const char *input, char *output, char *scratchpad);
+
 #if defined(USE_SSE2)
-#include <string>
 #if defined(_M_X64) || defined(__x86_64__) || defined(_M_AMD64) || (defined(MAC_OSX) && defined(__i386__))
 #define USE_SSE2_ALWAYS 1
 #define scrypt_1024_1_1_256_sp(input, output, scratchpad) scrypt_1024_1_1_256_sp_sse2((input), (output), (scratchpad))
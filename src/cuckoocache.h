@@ -0,0 +1,247 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CUCKOOCACHE_H
+#define BITCOIN_CUCKOOCACHE_H
+
+#include "uint256.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <new>
+
+/**
+ * Fixed-size set of uint256 entries that any number of threads can look up,
+ * insert and erase concurrently without taking a lock.
+ *
+ * The entries must be uniformly random, such as salted hashes, since their
+ * own bits pick their places. Every entry has two candidate buckets, and
+ * every bucket is one cache line holding two entries, so a lookup touches at
+ * most two cache lines. An insert takes a free or expired slot among the
+ * four candidates, or else moves an entry to its other bucket to make room,
+ * cuckoo style, up to MAX_DEPTH times before dropping the oldest entry.
+ *
+ * Entries are stamped with the generation they were inserted in, and the
+ * generation advances every time half the slots' worth of entries has been
+ * inserted. Entries more than one generation old are expired and freely
+ * overwritten, so the cache keeps the most recent entries without ever
+ * having to scan or resize the table.
+ *
+ * Slots are written word by word with relaxed atomics. A lookup racing with
+ * a write may see a mix of the old and new entry, which only matters if that
+ * mix equals the entry being looked up; for random 256-bit entries this is
+ * as unlikely as guessing one. A lost race between two inserts just loses an
+ * entry, which a cache is allowed to do.
+ */
+class CCuckooCache
+{
+private:
+    static const int SLOTS_PER_BUCKET = 2;
+    static const int MAX_DEPTH = 8;
+
+    struct alignas(64) Bucket
+    {
+        std::atomic<uint64_t> words[SLOTS_PER_BUCKET][4];
+    };
+    static_assert(sizeof(Bucket) == 64, "a bucket must fill exactly one cache line");
+
+    void* pAlloc;
+    Bucket* vBuckets;
+    //! Generation of every slot's entry, zero if the slot is free
+    std::atomic<uint32_t>* vGeneration;
+    uint32_t nBuckets;
+
+    std::atomic<uint32_t> nGeneration;
+    std::atomic<uint32_t> nGenerationInserts;
+
+    static void Load(uint64_t words[4], const uint256& entry)
+    {
+        memcpy(words, entry.begin(), 32);
+    }
+
+    uint32_t BucketIndex(uint32_t hash) const
+    {
+        return ((uint64_t)hash * nBuckets) >> 32;
+    }
+
+    void Candidates(const uint64_t words[4], uint32_t vSlots[2 * SLOTS_PER_BUCKET]) const
+    {
+        uint32_t b1 = BucketIndex((uint32_t)words[0]);
+        uint32_t b2 = BucketIndex((uint32_t)(words[0] >> 32));
+        for (int i = 0; i < SLOTS_PER_BUCKET; i++) {
+            vSlots[i] = b1 * SLOTS_PER_BUCKET + i;
+            vSlots[SLOTS_PER_BUCKET + i] = b2 * SLOTS_PER_BUCKET + i;
+        }
+    }
+
+    std::atomic<uint64_t>* Slot(uint32_t nSlot) const
+    {
+        return vBuckets[nSlot / SLOTS_PER_BUCKET].words[nSlot % SLOTS_PER_BUCKET];
+    }
+
+    static bool Matches(const std::atomic<uint64_t>* slot, const uint64_t words[4])
+    {
+        for (int i = 0; i < 4; i++) {
+            if (slot[i].load(std::memory_order_relaxed) != words[i])
+                return false;
+        }
+        return true;
+    }
+
+    void Write(uint32_t nSlot, const uint64_t words[4], uint32_t nGen)
+    {
+        std::atomic<uint64_t>* slot = Slot(nSlot);
+        // Invalidate the old entry before writing the new one over it
+        slot[0].store(0, std::memory_order_relaxed);
+        for (int i = 1; i < 4; i++)
+            slot[i].store(words[i], std::memory_order_relaxed);
+        slot[0].store(words[0], std::memory_order_relaxed);
+        vGeneration[nSlot].store(nGen, std::memory_order_relaxed);
+    }
+
+    void Free()
+    {
+        ::operator delete(pAlloc);
+        delete[] vGeneration;
+        pAlloc = NULL;
+        vBuckets = NULL;
+        vGeneration = NULL;
+        nBuckets = 0;
+    }
+
+    CCuckooCache(const CCuckooCache&);
+    CCuckooCache& operator=(const CCuckooCache&);
+
+public:
+    CCuckooCache() : pAlloc(NULL), vBuckets(NULL), vGeneration(NULL), nBuckets(0), nGeneration(1), nGenerationInserts(0) {}
+
+    ~CCuckooCache()
+    {
+        Free();
+    }
+
+    /**
+     * Allocate a table of up to nBytes, dropping all entries. Returns the
+     * number of entries it holds. Not safe to call while the cache is in use.
+     */
+    size_t Setup(size_t nBytes)
+    {
+        Free();
+        uint64_t nSlots = nBytes / (sizeof(Bucket) / SLOTS_PER_BUCKET + sizeof(std::atomic<uint32_t>));
+        nBuckets = std::min(nSlots / SLOTS_PER_BUCKET, (uint64_t)std::numeric_limits<uint32_t>::max());
+        if (nBuckets == 0)
+            return 0;
+
+        pAlloc = ::operator new(nBuckets * sizeof(Bucket) + sizeof(Bucket) - 1);
+        vBuckets = reinterpret_cast<Bucket*>(((uintptr_t)pAlloc + sizeof(Bucket) - 1) & ~(uintptr_t)(sizeof(Bucket) - 1));
+        vGeneration = new std::atomic<uint32_t>[Slots()];
+        for (uint32_t b = 0; b < nBuckets; b++) {
+            new (&vBuckets[b]) Bucket();
+            for (int i = 0; i < SLOTS_PER_BUCKET; i++) {
+                for (int j = 0; j < 4; j++)
+                    vBuckets[b].words[i][j].store(0, std::memory_order_relaxed);
+            }
+        }
+        for (size_t i = 0; i < Slots(); i++)
+            vGeneration[i].store(0, std::memory_order_relaxed);
+        nGeneration = 1;
+        nGenerationInserts = 0;
+        return Slots();
+    }
+
+    size_t Slots() const { return (size_t)nBuckets * SLOTS_PER_BUCKET; }
+
+    //! Memory used by the table, which is fixed by Setup()
+    size_t DynamicMemoryUsage() const
+    {
+        return nBuckets ? nBuckets * sizeof(Bucket) + sizeof(Bucket) - 1 + Slots() * sizeof(std::atomic<uint32_t>) : 0;
+    }
+
+    /** Look up an entry, erasing it if found and fErase is set */
+    bool Contains(const uint256& entry, bool fErase)
+    {
+        if (nBuckets == 0)
+            return false;
+        uint64_t words[4];
+        Load(words, entry);
+        uint32_t vSlots[2 * SLOTS_PER_BUCKET];
+        Candidates(words, vSlots);
+        for (int i = 0; i < 2 * SLOTS_PER_BUCKET; i++) {
+            if (Matches(Slot(vSlots[i]), words)) {
+                if (fErase) {
+                    Slot(vSlots[i])[0].store(0, std::memory_order_relaxed);
+                    vGeneration[vSlots[i]].store(0, std::memory_order_relaxed);
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Insert(const uint256& entry)
+    {
+        if (nBuckets == 0)
+            return;
+        uint64_t words[4];
+        Load(words, entry);
+        uint32_t nGen = nGeneration.load(std::memory_order_relaxed);
+        uint32_t nEntryGen = nGen;
+
+        if (++nGenerationInserts >= Slots() / 2) {
+            nGenerationInserts = 0;
+            uint32_t nExpected = nGen;
+            nGeneration.compare_exchange_strong(nExpected, nGen + 1 == 0 ? 1 : nGen + 1);
+        }
+
+        uint32_t nFrom = std::numeric_limits<uint32_t>::max();
+        for (int depth = 0; depth < MAX_DEPTH; depth++) {
+            uint32_t vSlots[2 * SLOTS_PER_BUCKET];
+            Candidates(words, vSlots);
+
+            // Take a free or expired slot; find the oldest entry otherwise,
+            // other than the one just displaced this entry
+            uint32_t nVictim = nFrom;
+            uint32_t nVictimAge = 0;
+            for (int k = 0; k < 2 * SLOTS_PER_BUCKET; k++) {
+                uint32_t nSlot = vSlots[(k + depth) % (2 * SLOTS_PER_BUCKET)];
+                if (depth == 0 && Matches(Slot(nSlot), words))
+                    return;
+                uint32_t nSlotGen = vGeneration[nSlot].load(std::memory_order_relaxed);
+                uint32_t nAge = nGen - nSlotGen;
+                // A concurrent insert may have written the slot in the next
+                // generation already; that entry is the newest, not expired
+                if (nAge > std::numeric_limits<uint32_t>::max() / 2)
+                    nAge = 0;
+                if (nSlotGen == 0 || nAge >= 2) {
+                    Write(nSlot, words, nEntryGen);
+                    return;
+                }
+                if (nSlot != nFrom && (nVictim == nFrom || nAge > nVictimAge)) {
+                    nVictim = nSlot;
+                    nVictimAge = nAge;
+                }
+            }
+            if (nVictim == nFrom)
+                return;
+
+            // Swap the entry in, and go place the one it displaced
+            std::atomic<uint64_t>* slot = Slot(nVictim);
+            uint64_t victim[4];
+            for (int i = 0; i < 4; i++)
+                victim[i] = slot[i].load(std::memory_order_relaxed);
+            uint32_t nVictimGen = vGeneration[nVictim].load(std::memory_order_relaxed);
+            Write(nVictim, words, nEntryGen);
+            memcpy(words, victim, sizeof(words));
+            nEntryGen = nVictimGen;
+            nFrom = nVictim;
+        }
+        // Out of moves; the entry in hand, one of the oldest seen, is dropped
+    }
+};
+
+#endif // BITCOIN_CUCKOOCACHE_H
@@ -0,0 +1,161 @@
+// Copyright (c) 2016 The Sexcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SEXCOIN_FLAGINDEX_H
+#define SEXCOIN_FLAGINDEX_H
+
+#include "primitives/transaction.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+/**
+ * Flag index record of a transaction with one age-verification flag set,
+ * one record for every flag. Big endian, so that the records of one flag
+ * are ordered by height.
+ */
+struct CFlagIndexKey {
+    uint16_t flag;
+    int blockHeight;
+    uint256 txhash;
+
+    size_t GetSerializeSize(int nType, int nVersion) const {
+        return 38;
+    }
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const {
+        ser_writedata16be(s, flag);
+        ser_writedata32be(s, blockHeight);
+        txhash.Serialize(s, nType, nVersion);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion) {
+        flag = ser_readdata16be(s);
+        blockHeight = ser_readdata32be(s);
+        txhash.Unserialize(s, nType, nVersion);
+    }
+
+    CFlagIndexKey(uint16_t f, int height, uint256 txid) {
+        flag = f;
+        blockHeight = height;
+        txhash = txid;
+    }
+
+    CFlagIndexKey() {
+        SetNull();
+    }
+
+    void SetNull() {
+        flag = 0;
+        blockHeight = 0;
+        txhash.SetNull();
+    }
+};
+
+struct CFlagIndexIteratorHeightKey {
+    uint16_t flag;
+    int blockHeight;
+
+    size_t GetSerializeSize(int nType, int nVersion) const {
+        return 6;
+    }
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const {
+        ser_writedata16be(s, flag);
+        ser_writedata32be(s, blockHeight);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion) {
+        flag = ser_readdata16be(s);
+        blockHeight = ser_readdata32be(s);
+    }
+
+    CFlagIndexIteratorHeightKey(uint16_t f, int height) {
+        flag = f;
+        blockHeight = height;
+    }
+
+    CFlagIndexIteratorHeightKey() {
+        SetNull();
+    }
+
+    void SetNull() {
+        flag = 0;
+        blockHeight = 0;
+    }
+};
+
+/** All age-verification flags of the transaction; none erases the record */
+struct CFlagIndexValue {
+    uint16_t flags;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(flags);
+    }
+
+    CFlagIndexValue(uint16_t f) {
+        flags = f;
+    }
+
+    CFlagIndexValue() {
+        SetNull();
+    }
+
+    void SetNull() {
+        flags = 0;
+    }
+
+    bool IsNull() const {
+        return flags == 0;
+    }
+};
+
+struct CFlagIndexKeyCompare
+{
+    bool operator()(const CFlagIndexKey& a, const CFlagIndexKey& b) const {
+        if (a.flag != b.flag)
+            return a.flag < b.flag;
+        if (a.blockHeight != b.blockHeight)
+            return a.blockHeight < b.blockHeight;
+        return a.txhash < b.txhash;
+    }
+};
+
+/** A transaction in the mempool with an age-verification flag set */
+struct CMempoolFlagEntry {
+    uint256 txhash;
+    int64_t time;
+    uint16_t flags;
+
+    CMempoolFlagEntry(uint256 hash, int64_t t, uint16_t f) {
+        txhash = hash;
+        time = t;
+        flags = f;
+    }
+};
+
+/**
+ * Append the flag index records of a transaction, one for every flag it
+ * has set. With fErase the records get null values, which erase them.
+ */
+inline void GetFlagIndexRecords(const CTransaction& tx, int nHeight, bool fErase,
+                                std::vector<std::pair<CFlagIndexKey, CFlagIndexValue> >& vect)
+{
+    const uint16_t flags = tx.GetRawFlags();
+    if (flags == 0)
+        return;
+    for (unsigned int bit = 0; bit < 16; bit++) {
+        const uint16_t flag = 1 << bit;
+        if (flags & flag)
+            vect.push_back(std::make_pair(CFlagIndexKey(flag, nHeight, tx.GetHash()), fErase ? CFlagIndexValue() : CFlagIndexValue(flags)));
+    }
+}
+
+#endif // SEXCOIN_FLAGINDEX_H
@@ -0,0 +1,406 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "indexbuilder.h"
+
+#include "chainparams.h"
+#include "main.h"
+#include "txdb.h"
+#include "txmempool.h"
+#include "undo.h"
+#include "util.h"
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+namespace {
+
+/**
+ * Builds one index from the block and undo files. It follows the active
+ * chain from the last block it indexed, undoing blocks that were
+ * reorganized away, and commits every block together with its new
+ * position. Once it reaches the tip, ConnectBlock and DisconnectBlock take
+ * over and the builder exits.
+ */
+class CIndexBuilder
+{
+public:
+    const std::string strName;
+    std::atomic<int> nHeight;
+    std::atomic<bool> fFailed;
+
+    CIndexBuilder(const std::string& strNameIn, std::atomic<bool>& fIndexIn, const CBlockIndex* pindexBestIn, bool fWipeIn) :
+        strName(strNameIn), nHeight(pindexBestIn ? pindexBestIn->nHeight : -1), fFailed(false),
+        fIndex(fIndexIn), pindexBest(pindexBestIn), fWipe(fWipeIn) {}
+    virtual ~CIndexBuilder() {}
+
+    //! Whether the index is not yet maintained by ConnectBlock; requires cs_main
+    bool IsBuilding() const { return !fIndex; }
+
+    void ThreadBuild();
+
+protected:
+    //! Whether the records are made from the block and its undo data, or from the block index alone
+    virtual bool NeedsBlockData() const { return true; }
+    //! Whether the records also need the spent outputs from the undo data
+    virtual bool NeedsUndoData() const { return NeedsBlockData(); }
+    virtual bool Wipe() = 0;
+    virtual void GetRecords(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, CIndexBlockUpdate& update) = 0;
+    //! Add the mempool records of a transaction accepted while the index was built; requires cs_main
+    virtual void AddMempoolRecords(const CTxMemPoolEntry& entry, const CCoinsViewCache& view) {}
+
+private:
+    std::atomic<bool>& fIndex;
+    const CBlockIndex* pindexBest;
+    bool fWipe;
+
+    bool Build();
+};
+
+void CIndexBuilder::ThreadBuild()
+{
+    if (!Build()) {
+        fFailed = true;
+        LogPrintf("%s: building the %s stopped at height %d\n", __func__, strName, (int)nHeight);
+    }
+}
+
+bool CIndexBuilder::Build()
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+
+    if (fWipe) {
+        // Records left behind when the index was switched off before
+        LogPrintf("Removing old %s records...\n", strName);
+        if (!Wipe() || !pblocktree->WriteIndexBuildBlock(strName, uint256(), CIndexBlockUpdate()))
+            return error("%s: failed to reset the %s", __func__, strName);
+        fWipe = false;
+    }
+    LogPrintf("Building the %s from height %d\n", strName, nHeight + 1);
+
+    while (true) {
+        boost::this_thread::interruption_point();
+
+        const CBlockIndex* pindex;
+        bool fDisconnect = false;
+        CDiskBlockPos undoPos;
+        {
+            LOCK(cs_main);
+            if (pindexBest && !chainActive.Contains(pindexBest)) {
+                // The last block we indexed was reorganized away
+                pindex = pindexBest;
+                fDisconnect = true;
+            } else {
+                pindex = pindexBest ? chainActive.Next(pindexBest) : chainActive.Genesis();
+                if (pindex == NULL) {
+                    // At the tip: the next block is indexed by ConnectBlock
+                    if (!pblocktree->FinishIndexBuild(strName, pindexBest ? pindexBest->GetBlockHash() : uint256()))
+                        return error("%s: failed to finish the %s", __func__, strName);
+                    fIndex = true;
+                    // Transactions accepted to the mempool meanwhile got no
+                    // mempool records; with cs_main held, no more can slip in
+                    LOCK(mempool.cs);
+                    CCoinsViewMemPool viewMemPool(pcoinsTip, mempool);
+                    CCoinsViewCache view(&viewMemPool);
+                    for (CTxMemPool::indexed_transaction_set::const_iterator mi = mempool.mapTx.begin(); mi != mempool.mapTx.end(); mi++)
+                        AddMempoolRecords(*mi, view);
+                    LogPrintf("Finished building the %s at height %d\n", strName, (int)nHeight);
+                    return true;
+                }
+            }
+            undoPos = pindex->GetUndoPos();
+        }
+
+        // The genesis block is never connected, so it has no records
+        CIndexBlockUpdate update;
+        update.fDisconnect = fDisconnect;
+        if (pindex->pprev) {
+            CBlock block;
+            CBlockUndo blockundo;
+            if (NeedsBlockData()) {
+                if (!ReadBlockFromDisk(block, pindex, consensusParams))
+                    return error("%s: failed to read block %s", __func__, pindex->GetBlockHash().ToString());
+            }
+            if (NeedsUndoData()) {
+                if (undoPos.IsNull() || !UndoReadFromDisk(blockundo, undoPos, pindex->pprev->GetBlockHash()))
+                    return error("%s: failed to read undo data of block %s", __func__, pindex->GetBlockHash().ToString());
+                if (blockundo.vtxundo.size() + 1 != block.vtx.size())
+                    return error("%s: block %s and undo data inconsistent", __func__, pindex->GetBlockHash().ToString());
+            }
+            GetRecords(block, blockundo, pindex, update);
+        }
+
+        const CBlockIndex* pindexNew = fDisconnect ? pindex->pprev : pindex;
+        if (!pblocktree->WriteIndexBuildBlock(strName, pindexNew->GetBlockHash(), update))
+            return error("%s: failed to write the %s", __func__, strName);
+        pindexBest = pindexNew;
+        nHeight = pindexNew->nHeight;
+    }
+}
+
+/**
+ * Same records as ConnectBlock and DisconnectBlock write, with the spent
+ * outputs taken from the undo data. A block is undone in reverse, so that
+ * outputs created and spent within it end up erased either way.
+ */
+class CAddressIndexBuilder : public CIndexBuilder
+{
+public:
+    CAddressIndexBuilder(const std::string& strNameIn, std::atomic<bool>& fIndexIn, const CBlockIndex* pindexBestIn, bool fWipeIn) :
+        CIndexBuilder(strNameIn, fIndexIn, pindexBestIn, fWipeIn) {}
+
+protected:
+    bool Wipe() { return pblocktree->WipeAddressIndex(); }
+    void AddMempoolRecords(const CTxMemPoolEntry& entry, const CCoinsViewCache& view) { mempool.addAddressIndex(entry, view); }
+
+    void GetRecords(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, CIndexBlockUpdate& update)
+    {
+        for (unsigned int n = 0; n < block.vtx.size(); n++) {
+            const unsigned int i = update.fDisconnect ? block.vtx.size() - 1 - n : n;
+            if (!update.fDisconnect)
+                GetInputRecords(block, blockundo, pindex, i, update);
+            GetOutputRecords(block, pindex, i, update);
+            if (update.fDisconnect)
+                GetInputRecords(block, blockundo, pindex, i, update);
+        }
+    }
+
+private:
+    void GetInputRecords(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, unsigned int i, CIndexBlockUpdate& update)
+    {
+        if (i == 0)
+            return;
+        const CTransaction& tx = block.vtx[i];
+        const CTxUndo& txundo = blockundo.vtxundo[i-1];
+        for (unsigned int j = 0; j < tx.vin.size() && j < txundo.vprevout.size(); j++) {
+            const CTxInUndo& undo = txundo.vprevout[j];
+            const CTxOut& prevout = undo.txout;
+            uint160 hashBytes;
+            int addressType = GetScriptAddress(prevout.scriptPubKey, hashBytes);
+            if (addressType == 0)
+                continue;
+
+            update.addressIndex.push_back(std::make_pair(CAddressIndexKey(addressType, hashBytes, pindex->nHeight, i, tx.GetHash(), j, true), prevout.nValue * -1));
+            CAddressUnspentValue value;
+            if (update.fDisconnect)
+                value = CAddressUnspentValue(prevout.nValue, prevout.scriptPubKey, undo.nHeight);
+            update.addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(addressType, hashBytes, tx.vin[j].prevout.hash, tx.vin[j].prevout.n), value));
+        }
+    }
+
+    void GetOutputRecords(const CBlock& block, const CBlockIndex* pindex, unsigned int i, CIndexBlockUpdate& update)
+    {
+        const CTransaction& tx = block.vtx[i];
+        for (unsigned int k = 0; k < tx.vout.size(); k++) {
+            const CTxOut& out = tx.vout[k];
+            uint160 hashBytes;
+            int addressType = GetScriptAddress(out.scriptPubKey, hashBytes);
+            if (addressType == 0)
+                continue;
+
+            update.addressIndex.push_back(std::make_pair(CAddressIndexKey(addressType, hashBytes, pindex->nHeight, i, tx.GetHash(), k, false), out.nValue));
+            CAddressUnspentValue value;
+            if (!update.fDisconnect)
+                value = CAddressUnspentValue(out.nValue, out.scriptPubKey, pindex->nHeight);
+            update.addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(addressType, hashBytes, tx.GetHash(), k), value));
+        }
+    }
+};
+
+class CSpentIndexBuilder : public CIndexBuilder
+{
+public:
+    CSpentIndexBuilder(const std::string& strNameIn, std::atomic<bool>& fIndexIn, const CBlockIndex* pindexBestIn, bool fWipeIn) :
+        CIndexBuilder(strNameIn, fIndexIn, pindexBestIn, fWipeIn) {}
+
+protected:
+    bool Wipe() { return pblocktree->WipeSpentIndex(); }
+    void AddMempoolRecords(const CTxMemPoolEntry& entry, const CCoinsViewCache& view) { mempool.addSpentIndex(entry, view); }
+
+    void GetRecords(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, CIndexBlockUpdate& update)
+    {
+        for (unsigned int i = 1; i < block.vtx.size(); i++) {
+            const CTransaction& tx = block.vtx[i];
+            const CTxUndo& txundo = blockundo.vtxundo[i-1];
+            for (unsigned int j = 0; j < tx.vin.size() && j < txundo.vprevout.size(); j++) {
+                const CTxOut& prevout = txundo.vprevout[j].txout;
+                CSpentIndexValue value;
+                if (!update.fDisconnect) {
+                    uint160 hashBytes;
+                    int addressType = GetScriptAddress(prevout.scriptPubKey, hashBytes);
+                    value = CSpentIndexValue(tx.GetHash(), j, pindex->nHeight, prevout.nValue, addressType, hashBytes);
+                }
+                update.spentIndex.push_back(std::make_pair(CSpentIndexKey(tx.vin[j].prevout.hash, tx.vin[j].prevout.n), value));
+            }
+        }
+    }
+};
+
+/** Made from the block index alone; like DisconnectBlock it keeps the records of disconnected blocks */
+class CTimestampIndexBuilder : public CIndexBuilder
+{
+public:
+    CTimestampIndexBuilder(const std::string& strNameIn, std::atomic<bool>& fIndexIn, const CBlockIndex* pindexBestIn, bool fWipeIn) :
+        CIndexBuilder(strNameIn, fIndexIn, pindexBestIn, fWipeIn) {}
+
+protected:
+    bool NeedsBlockData() const { return false; }
+    bool Wipe() { return pblocktree->WipeTimestampIndex(); }
+
+    void GetRecords(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, CIndexBlockUpdate& update)
+    {
+        if (update.fDisconnect)
+            return;
+
+        // Logical timestamps strictly increase along the chain
+        unsigned int logicalTS = pindex->nTime;
+        unsigned int prevLogicalTS = 0;
+        pblocktree->ReadTimestampBlockIndex(pindex->pprev->GetBlockHash(), prevLogicalTS);
+        if (logicalTS <= prevLogicalTS)
+            logicalTS = prevLogicalTS + 1;
+        update.timestampIndex.push_back(CTimestampIndexKey(logicalTS, pindex->GetBlockHash()));
+    }
+};
+
+/** Made from the transactions alone, erased again when a block is disconnected */
+class CFlagIndexBuilder : public CIndexBuilder
+{
+public:
+    CFlagIndexBuilder(const std::string& strNameIn, std::atomic<bool>& fIndexIn, const CBlockIndex* pindexBestIn, bool fWipeIn) :
+        CIndexBuilder(strNameIn, fIndexIn, pindexBestIn, fWipeIn) {}
+
+protected:
+    bool NeedsUndoData() const { return false; }
+    bool Wipe() { return pblocktree->WipeFlagIndex(); }
+    void AddMempoolRecords(const CTxMemPoolEntry& entry, const CCoinsViewCache& view) { mempool.addFlagIndex(entry); }
+
+    void GetRecords(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, CIndexBlockUpdate& update)
+    {
+        for (unsigned int i = 0; i < block.vtx.size(); i++)
+            GetFlagIndexRecords(block.vtx[i], pindex->nHeight, update.fDisconnect, update.flagIndex);
+    }
+};
+
+std::vector<std::shared_ptr<CIndexBuilder> > vIndexBuilders;
+
+void ThreadLoadSpentFilter()
+{
+    const int64_t nStart = GetTimeMillis();
+    if (pblocktree->LoadSpentFilter())
+        LogPrintf("Loaded the spent index filter in %dms\n", GetTimeMillis() - nStart);
+}
+
+template<typename Builder>
+bool InitIndexBuilder(const std::string& strName, std::atomic<bool>& fIndex, bool fDefault, std::string& strError)
+{
+    const bool fWanted = GetBoolArg("-" + strName, fDefault);
+    uint256 hashBest;
+    const bool fBuilding = pblocktree->ReadIndexBuildBest(strName, hashBest);
+
+    if (!fWanted) {
+        if (fIndex || fBuilding) {
+            LogPrintf("%s: %s switched off\n", __func__, strName);
+            if (!pblocktree->WriteFlag(strName, false) || (fBuilding && !pblocktree->EraseIndexBuild(strName)))
+                return error("%s: failed to switch off the %s", __func__, strName);
+            fIndex = false;
+        }
+        return true;
+    }
+    if (fIndex) {
+        // The records are written with the block index, ahead of the chain
+        // state. After a crash they can be at another block, which would
+        // count the updates of the blocks in between twice or not at all:
+        // build them over to the chain state instead.
+        uint256 hashIndexBest;
+        const CBlockIndex* pindexTip = chainActive.Tip();
+        if (!pblocktree->ReadIndexBest(strName, hashIndexBest) || hashIndexBest == (pindexTip ? pindexTip->GetBlockHash() : uint256()))
+            return true;
+        BlockMap::iterator mi = mapBlockIndex.find(hashIndexBest);
+        const CBlockIndex* pindexBest = (pindexTip && mi != mapBlockIndex.end()) ? mi->second : NULL;
+        LogPrintf("%s: %s is at block %s, the chain state at %s\n", __func__, strName, hashIndexBest.ToString(),
+                  pindexTip ? pindexTip->GetBlockHash().ToString() : "none");
+        if (!pblocktree->ResumeIndexBuild(strName, pindexBest ? hashIndexBest : uint256()))
+            return error("%s: failed to resume the %s", __func__, strName);
+        fIndex = false;
+        vIndexBuilders.push_back(std::shared_ptr<CIndexBuilder>(new Builder(strName, fIndex, pindexBest, pindexBest == NULL)));
+        return true;
+    }
+
+    if (fPruneMode || fHavePruned) {
+        strError = strprintf(_("Prune mode is incompatible with building -%s for an existing chain state"), strName);
+        return false;
+    }
+
+    // Continue where a previous run stopped, or start over from the genesis block
+    const CBlockIndex* pindexBest = NULL;
+    bool fWipe = !fBuilding;
+    if (fBuilding && !hashBest.IsNull()) {
+        BlockMap::iterator mi = mapBlockIndex.find(hashBest);
+        if (mi == mapBlockIndex.end())
+            fWipe = true;
+        else
+            pindexBest = mi->second;
+    }
+    vIndexBuilders.push_back(std::shared_ptr<CIndexBuilder>(new Builder(strName, fIndex, pindexBest, fWipe)));
+    return true;
+}
+
+} // anon namespace
+
+bool InitIndexBuilders(std::string& strError)
+{
+    LOCK(cs_main);
+    vIndexBuilders.clear();
+    if (!InitIndexBuilder<CAddressIndexBuilder>("addressindex", fAddressIndex, DEFAULT_ADDRESSINDEX, strError) ||
+        !InitIndexBuilder<CSpentIndexBuilder>("spentindex", fSpentIndex, DEFAULT_SPENTINDEX, strError) ||
+        !InitIndexBuilder<CTimestampIndexBuilder>("timestampindex", fTimestampIndex, DEFAULT_TIMESTAMPINDEX, strError) ||
+        !InitIndexBuilder<CFlagIndexBuilder>("flagindex", fFlagIndex, DEFAULT_FLAGINDEX, strError)) {
+        if (strError.empty())
+            strError = _("Error initializing block database");
+        return false;
+    }
+    return true;
+}
+
+void StartIndexBuilders(boost::thread_group& threadGroup)
+{
+    LOCK(cs_main);
+    bool fSpentFilter = GetBoolArg("-spentindex", DEFAULT_SPENTINDEX);
+    if (fSpentFilter) {
+        // Room for about three spent outputs per transaction in the chain;
+        // beyond that the filter only gets less selective until a restart.
+        // Set up before any builder runs, so that none of the spent index
+        // records it writes are missed.
+        const uint64_t nElements = std::max<uint64_t>(chainActive.Tip() ? chainActive.Tip()->nChainTx * 3 : 0, 1000000);
+        pblocktree->InitSpentFilter(std::min<uint64_t>(nElements, std::numeric_limits<unsigned int>::max()));
+    }
+
+    for (std::vector<std::shared_ptr<CIndexBuilder> >::const_iterator it = vIndexBuilders.begin(); it != vIndexBuilders.end(); it++) {
+        boost::function<void()> build = boost::bind(&CIndexBuilder::ThreadBuild, it->get());
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, (*it)->strName.c_str(), build));
+    }
+
+    if (fSpentFilter)
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "spentfilter", &ThreadLoadSpentFilter));
+}
+
+bool GetIndexBuildProgress(const std::string& strIndex, int& nHeight, bool& fFailed)
+{
+    LOCK(cs_main);
+    for (std::vector<std::shared_ptr<CIndexBuilder> >::const_iterator it = vIndexBuilders.begin(); it != vIndexBuilders.end(); it++) {
+        if ((*it)->strName == strIndex && (*it)->IsBuilding()) {
+            nHeight = (*it)->nHeight;
+            fFailed = (*it)->fFailed;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,35 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEXBUILDER_H
+#define BITCOIN_INDEXBUILDER_H
+
+#include <string>
+
+namespace boost {
+class thread_group;
+} // namespace boost
+
+/**
+ * Set up background builders for -addressindex, -spentindex, -timestampindex
+ * and -flagindex when they are switched on for an existing chain state.
+ * Switching an index off only clears its flag; its records are wiped when
+ * it is switched on again. Call after the block index has been loaded.
+ */
+bool InitIndexBuilders(std::string& strError);
+
+/**
+ * Start one thread for every index that is being built, and one that loads
+ * the filter of spent outputs used by spent index lookups.
+ */
+void StartIndexBuilders(boost::thread_group& threadGroup);
+
+/**
+ * Whether the index named strIndex ("addressindex", "spentindex",
+ * "timestampindex" or "flagindex") is still being built. nHeight is the
+ * last block it covers, fFailed is set when the builder stopped on an error.
+ */
+bool GetIndexBuildProgress(const std::string& strIndex, int& nHeight, bool& fFailed);
+
+#endif // BITCOIN_INDEXBUILDER_H
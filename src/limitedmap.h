@@ -38,6 +38,11 @@ public:
     bool empty() const { return map.empty(); }
     const_iterator find(const key_type& k) const { return map.find(k); }
     size_type count(const key_type& k) const { return map.count(k); }
+    void clear()
+    {
+        map.clear();
+        rmap.clear();
+    }
     void insert(const value_type& x)
     {
         std::pair<iterator, bool> ret = map.insert(x);
@@ -14,6 +14,7 @@
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "crypto/scrypt.h"
 #include "hash.h"
 #include "init.h"
 #include "merkleblock.h"
@@ -39,6 +40,7 @@
 #include "versionbits.h"
 
 #include <atomic>
+#include <limits>
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
@@ -73,15 +75,18 @@ int nScriptCheckThreads = 0;
 bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = false;
-bool fAddressIndex = false;
-bool fTimestampIndex = false;
-bool fSpentIndex = false;
+std::atomic<bool> fAddressIndex(false);
+std::atomic<bool> fTimestampIndex(false);
+std::atomic<bool> fSpentIndex(false);
+std::atomic<bool> fFlagIndex(false);
 bool fHavePruned = false;
+bool fHaveTxOutSnapshot = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
+uint256 hashAssumeValid;
 size_t nCoinCacheUsage = 5000 * 300;
 uint64_t nPruneTarget = 0;
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
@@ -117,6 +122,7 @@ void EraseOrphansFor(NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
  * in the last Consensus::Params::nMajorityWindow blocks, starting at pstart and going backwards.
  */
 static bool IsSuperMajority(int minVersion, const CBlockIndex* pstart, unsigned nRequired, const Consensus::Params& consensusParams);
+static unsigned int GetBlockScriptFlags(const CBlockIndex* pindexPrev, int32_t nVersion, int64_t nTime, const Consensus::Params& consensusparams);
 static void CheckBlockIndex(const Consensus::Params& consensusParams);
 
 /** Constant stuff for coinbase transactions we create: */
@@ -701,7 +707,9 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
     return chain.Genesis();
 }
 
+CCoinsViewDB *pcoinsdbview = NULL;
 CCoinsViewCache *pcoinsTip = NULL;
+CCoinsViewBackgroundFlush *pcoinsflusher = NULL;
 CBlockTreeDB *pblocktree = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
@@ -985,15 +993,15 @@ bool CheckSequenceLocks(const CTransaction &tx, int flags, LockPoints* lp, bool
         prevheights.resize(tx.vin.size());
         for (size_t txinIndex = 0; txinIndex < tx.vin.size(); txinIndex++) {
             const CTxIn& txin = tx.vin[txinIndex];
-            CCoins coins;
-            if (!viewMemPool.GetCoins(txin.prevout.hash, coins)) {
+            Coin coin;
+            if (!viewMemPool.GetCoin(txin.prevout, coin)) {
                 return error("%s: Missing input", __func__);
             }
-            if (coins.nHeight == MEMPOOL_HEIGHT) {
+            if (coin.nHeight == MEMPOOL_HEIGHT) {
                 // Assume all mempool transaction confirm in the next block
                 prevheights[txinIndex] = tip->nHeight + 1;
             } else {
-                prevheights[txinIndex] = coins.nHeight;
+                prevheights[txinIndex] = coin.nHeight;
             }
         }
         lockPair = CalculateSequenceLocks(tx, flags, &prevheights, index);
@@ -1132,9 +1140,9 @@ void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age) {
     if (expired != 0)
         LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
 
-    std::vector<uint256> vNoSpendsRemaining;
+    std::vector<COutPoint> vNoSpendsRemaining;
     pool.TrimToSize(limit, &vNoSpendsRemaining);
-    BOOST_FOREACH(const uint256& removed, vNoSpendsRemaining)
+    BOOST_FOREACH(const COutPoint& removed, vNoSpendsRemaining)
         pcoinsTip->Uncache(removed);
 }
 
@@ -1149,7 +1157,7 @@ std::string FormatStateMessage(const CValidationState &state)
 
 bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree,
                               bool* pfMissingInputs, bool fOverrideMempoolLimit, const CAmount& nAbsurdFee,
-                              std::vector<uint256>& vHashTxnToUncache)
+                              std::vector<COutPoint>& vCoinsToUncache)
 {
     const uint256 hash = tx.GetHash();
     AssertLockHeld(cs_main);
@@ -1249,21 +1257,18 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
         view.SetBackend(viewMemPool);
 
-        // do we already have it?
-        bool fHadTxInCache = pcoinsTip->HaveCoinsInCache(hash);
-        if (view.HaveCoins(hash)) {
-            if (!fHadTxInCache)
-                vHashTxnToUncache.push_back(hash);
-            return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-known");
-        }
-
         // do all inputs exist?
-        // Note that this does not check for the presence of actual outputs (see the next check for that),
-        // and only helps with filling in pfMissingInputs (to determine missing vs spent).
         BOOST_FOREACH(const CTxIn txin, tx.vin) {
-            if (!pcoinsTip->HaveCoinsInCache(txin.prevout.hash))
-                vHashTxnToUncache.push_back(txin.prevout.hash);
-            if (!view.HaveCoins(txin.prevout.hash)) {
+            if (!pcoinsTip->HaveCoinInCache(txin.prevout))
+                vCoinsToUncache.push_back(txin.prevout);
+            if (!view.HaveCoin(txin.prevout)) {
+                // Are inputs missing because we already have the tx?
+                for (size_t out = 0; out < tx.vout.size(); out++) {
+                    // Optimistically just do efficient check of cache for outputs
+                    if (pcoinsTip->HaveCoinInCache(COutPoint(hash, out)))
+                        return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-known");
+                }
+                // Otherwise assume this might be an orphan tx for which we just haven't seen parents yet
                 if (pfMissingInputs)
                     *pfMissingInputs = true;
                 return false; // fMissingInputs and !state.IsInvalid() is used to detect this condition, don't set state.Invalid()
@@ -1315,8 +1320,8 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         // during reorgs to ensure COINBASE_MATURITY is still met.
         bool fSpendsCoinbase = false;
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            const CCoins *coins = view.AccessCoins(txin.prevout.hash);
-            if (coins->IsCoinBase()) {
+            const Coin &coin = view.AccessCoin(txin.prevout);
+            if (coin.IsCoinBase()) {
                 fSpendsCoinbase = true;
                 break;
             }
@@ -1532,12 +1537,12 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
         PrecomputedTransactionData txdata(tx);
-        if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, txdata)) {
+        if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, false, txdata)) {
             // SCRIPT_VERIFY_CLEANSTACK requires SCRIPT_VERIFY_WITNESS, so we
             // need to turn both off, and compare against just turning off CLEANSTACK
             // to see if the failure is specifically due to witness validation.
-            if (tx.wit.IsNull() && CheckInputs(tx, state, view, true, scriptVerifyFlags & ~(SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_CLEANSTACK), true, txdata) &&
-                !CheckInputs(tx, state, view, true, scriptVerifyFlags & ~SCRIPT_VERIFY_CLEANSTACK, true, txdata)) {
+            if (tx.wit.IsNull() && CheckInputs(tx, state, view, true, scriptVerifyFlags & ~(SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_CLEANSTACK), true, false, txdata) &&
+                !CheckInputs(tx, state, view, true, scriptVerifyFlags & ~SCRIPT_VERIFY_CLEANSTACK, true, false, txdata)) {
                 // Only the witness is missing, so the transaction itself may be fine.
                 state.SetCorruptionPossible();
             }
@@ -1553,12 +1558,25 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         // There is a similar check in CreateNewBlock() to prevent creating
         // invalid blocks, however allowing such transactions into the mempool
         // can be exploited as a DoS attack.
-        if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata))
+        if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, false, txdata))
         {
             return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s, %s",
                 __func__, hash.ToString(), FormatStateMessage(state));
         }
 
+        // Check once more with the flags the next block on top of the tip
+        // would get, and remember the result, so that connecting a block
+        // containing this transaction does not run its scripts again. The
+        // signatures are in the signature cache by now.
+        CBlockIndex* pindexTip = chainActive.Tip();
+        const Consensus::Params& consensusParams = Params().GetConsensus();
+        unsigned int currentBlockScriptVerifyFlags = GetBlockScriptFlags(pindexTip, ComputeBlockVersion(pindexTip, consensusParams), GetAdjustedTime(), consensusParams);
+        if (!CheckInputs(tx, state, view, true, currentBlockScriptVerifyFlags, true, true, txdata))
+        {
+            return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against block but not STANDARD flags %s, %s",
+                __func__, hash.ToString(), FormatStateMessage(state));
+        }
+
         // Remove conflicting transactions from the mempool
         BOOST_FOREACH(const CTxMemPool::txiter it, allConflicting)
         {
@@ -1583,6 +1601,11 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
             pool.addSpentIndex(entry, view);
         }
 
+        // Add memory flag index
+        if (fFlagIndex) {
+            pool.addFlagIndex(entry);
+        }
+
         // trim mempool and check if tx was trimmed
         if (!fOverrideMempoolLimit) {
             LimitMempoolSize(pool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
@@ -1599,25 +1622,95 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
                         bool* pfMissingInputs, bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
 {
-    std::vector<uint256> vHashTxToUncache;
-    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, fOverrideMempoolLimit, nAbsurdFee, vHashTxToUncache);
+    std::vector<COutPoint> vCoinsToUncache;
+    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, fOverrideMempoolLimit, nAbsurdFee, vCoinsToUncache);
     if (!res) {
-        BOOST_FOREACH(const uint256& hashTx, vHashTxToUncache)
-            pcoinsTip->Uncache(hashTx);
+        BOOST_FOREACH(const COutPoint& outpoint, vCoinsToUncache)
+            pcoinsTip->Uncache(outpoint);
     }
     return res;
 }
 
 
-/** Return transaction in txOut, and if it was found inside a block, its hash is placed in hashBlock */
+namespace {
+
+typedef std::pair<unsigned int, CBlockIndex*> TimestampIndexEntry;
+
+/** Orders entries like the timestamp index records: by logical timestamp, then block hash */
+struct CompareTimestampIndexEntry
+{
+    bool operator()(const TimestampIndexEntry& a, const TimestampIndexEntry& b) const
+    {
+        if (a.first != b.first)
+            return a.first < b.first;
+        return a.second->GetBlockHash() < b.second->GetBlockHash();
+    }
+
+    bool operator()(const TimestampIndexEntry& a, unsigned int timestamp) const
+    {
+        return a.first < timestamp;
+    }
+};
+
+/**
+ * Logical timestamps of the blocks in the timestamp index, active chain and
+ * side chains alike, kept sorted so that range queries are a binary search.
+ * The database records are only read to fill it. Guarded by cs_main.
+ */
+std::vector<TimestampIndexEntry> vTimestampIndex;
+bool fTimestampIndexLoaded = false;
+
+} // anon namespace
+
+/** Fill vTimestampIndex from the database, flushing buffered records first */
+static bool LoadTimestampIndex()
+{
+    std::vector<std::pair<uint256, unsigned int> > hashes;
+    if (!pblocktree->ReadTimestampIndex(std::numeric_limits<unsigned int>::max(), 0, false, hashes))
+        return false;
+
+    vTimestampIndex.clear();
+    vTimestampIndex.reserve(hashes.size());
+    for (std::vector<std::pair<uint256, unsigned int> >::const_iterator it = hashes.begin(); it != hashes.end(); ++it) {
+        BlockMap::iterator mi = mapBlockIndex.find(it->first);
+        if (mi != mapBlockIndex.end())
+            vTimestampIndex.push_back(std::make_pair(it->second, mi->second));
+    }
+    std::sort(vTimestampIndex.begin(), vTimestampIndex.end(), CompareTimestampIndexEntry());
+    fTimestampIndexLoaded = true;
+    LogPrintf("%s: loaded %u timestamp index entries\n", __func__, vTimestampIndex.size());
+    return true;
+}
+
+/** Record a connected block's logical timestamp, unless it is already known */
+static void AddTimestampIndex(unsigned int logicalTS, CBlockIndex* pindex)
+{
+    if (!fTimestampIndexLoaded)
+        return;
+
+    const TimestampIndexEntry entry(logicalTS, pindex);
+    std::vector<TimestampIndexEntry>::iterator it = std::lower_bound(vTimestampIndex.begin(), vTimestampIndex.end(), entry, CompareTimestampIndexEntry());
+    if (it == vTimestampIndex.end() || it->second != pindex)
+        vTimestampIndex.insert(it, entry);
+}
+
 bool GetTimestampIndex(const unsigned int &high, const unsigned int &low, const bool fActiveOnly, std::vector<std::pair<uint256, unsigned int> > &hashes)
 {
     if (!fTimestampIndex)
         return error("Timestamp index not enabled");
 
-    if (!pblocktree->ReadTimestampIndex(high, low, fActiveOnly, hashes))
+    LOCK(cs_main);
+    // A reindex or a background build finishes with nothing loaded yet
+    if (!fTimestampIndexLoaded && !LoadTimestampIndex())
         return error("Unable to get hashes for timestamps");
 
+    std::vector<TimestampIndexEntry>::const_iterator it = std::lower_bound(vTimestampIndex.begin(), vTimestampIndex.end(), low, CompareTimestampIndexEntry());
+    for (; it != vTimestampIndex.end() && it->first < high; ++it) {
+        if (fActiveOnly && !chainActive.Contains(it->second))
+            continue;
+        hashes.push_back(std::make_pair(it->second->GetBlockHash(), it->first));
+    }
+
     return true;
 }
 
@@ -1635,6 +1728,46 @@ bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
     return true;
 }
 
+bool GetFlagIndex(uint16_t flag, int start, int end, std::vector<std::pair<CFlagIndexKey, CFlagIndexValue> > &flagIndex)
+{
+    if (!fFlagIndex)
+        return error("flag index not enabled");
+
+    if (!pblocktree->ReadFlagIndex(flag, start, end, flagIndex))
+        return error("unable to get txids for flag");
+
+    return true;
+}
+
+bool ParseFlagIndexFlag(const std::string &str, uint16_t &flag)
+{
+    if (str == "consent") {
+        flag = TX_F_IS_OVER_CONSENT;
+        return true;
+    } else if (str == "over18") {
+        flag = TX_F_IS_OVER_18;
+        return true;
+    } else if (str == "over21") {
+        flag = TX_F_IS_OVER_21;
+        return true;
+    }
+
+    const CTransaction tx;
+    for (unsigned int bit = 0; bit < 16; bit++) {
+        if (str == tx.GetFlagName((transflag_t)(1 << bit))) {
+            flag = 1 << bit;
+            return true;
+        }
+    }
+
+    int32_t n;
+    if (ParseInt32(str, &n) && n > 0 && n <= 0xffff && (n & (n - 1)) == 0) {
+        flag = n;
+        return true;
+    }
+    return false;
+}
+
 bool HashOnchainActive(const uint256 &hash)
 {
     CBlockIndex* pblockindex = mapBlockIndex[hash];
@@ -1647,24 +1780,51 @@ bool HashOnchainActive(const uint256 &hash)
 }
 
 bool GetAddressIndex(uint160 addressHash, int type,
-                     std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex, int start, int end)
+                     std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex, int start, int end,
+                     const CAddressIndexKey *pAfter, size_t nLimit)
 {
     if (!fAddressIndex)
         return error("address index not enabled");
 
-    if (!pblocktree->ReadAddressIndex(addressHash, type, addressIndex, start, end))
+    if (!pblocktree->ReadAddressIndex(addressHash, type, addressIndex, start, end, pAfter, nLimit))
         return error("unable to get txids for address");
 
     return true;
 }
 
+bool GetAddressIndexMerged(const std::vector<std::pair<uint160, int> > &addresses, int start, int end,
+                           const CAddressIndexKey *pAfter,
+                           boost::function<bool(const CAddressIndexKey&, CAmount)> visit)
+{
+    if (!fAddressIndex)
+        return error("address index not enabled");
+
+    if (!pblocktree->ReadAddressIndexMerged(addresses, start, end, pAfter, visit))
+        return error("unable to get txids for addresses");
+
+    return true;
+}
+
+bool GetAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &value)
+{
+    if (!fAddressIndex)
+        return error("address index not enabled");
+
+    // Addresses that were never seen have no record
+    if (!pblocktree->ReadAddressBalance(addressHash, type, value))
+        value.SetNull();
+
+    return true;
+}
+
 bool GetAddressUnspent(uint160 addressHash, int type,
-                       std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs)
+                       std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs,
+                       const CAddressUnspentKey *pAfter, size_t nLimit)
 {
     if (!fAddressIndex)
         return error("address index not enabled");
 
-    if (!pblocktree->ReadAddressUnspentIndex(addressHash, type, unspentOutputs))
+    if (!pblocktree->ReadAddressUnspentIndex(addressHash, type, unspentOutputs, pAfter, nLimit))
         return error("unable to get txids for address");
 
     return true;
@@ -1709,10 +1869,9 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
     if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
         int nHeight = -1;
         {
-            const CCoinsViewCache& view = *pcoinsTip;
-            const CCoins* coins = view.AccessCoins(hash);
-            if (coins)
-                nHeight = coins->nHeight;
+            const Coin& coin = AccessByTxid(*pcoinsTip, hash);
+            if (!coin.IsSpent())
+                nHeight = coin.nHeight;
         }
         if (nHeight > 0)
             pindexSlow = chainActive[nHeight];
@@ -1765,7 +1924,8 @@ bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHea
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+/** Deserialize a block from disk without checking its proof of work. */
+static bool ReadBlockFromDiskUnchecked(CBlock& block, const CDiskBlockPos& pos)
 {
     block.SetNull();
 
@@ -1782,6 +1942,14 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
         return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
     }
 
+    return true;
+}
+
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+{
+    if (!ReadBlockFromDiskUnchecked(block, pos))
+        return false;
+
     // Check the header
     if (!CheckBlockProofOfWork(&block,  consensusParams))
         return error("ReadBlockFromDisk: Errors in block header at %s", pos.ToString());
@@ -1791,7 +1959,17 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
 
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
 {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), consensusParams))
+    // A block that reached BLOCK_VALID_TRANSACTIONS had these very bytes
+    // checked by CheckBlock before AcceptBlock wrote them, its auxpow
+    // included, and block data is never rewritten in place. Matching the
+    // hash against the index is then enough to tell the data on disk is
+    // that block, and saves a scrypt or auxpow check per read. The block
+    // hash does not commit to the auxpow, so a block only known to have a
+    // valid header still gets its proof of work checked in full.
+    if (pindex->IsValid(BLOCK_VALID_TRANSACTIONS)) {
+        if (!ReadBlockFromDiskUnchecked(block, pindex->GetBlockPos()))
+            return false;
+    } else if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), consensusParams))
         return false;
     if (block.GetHash() != pindex->GetBlockHash())
         return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
@@ -2037,24 +2215,15 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txund
     if (!tx.IsCoinBase()) {
         txundo.vprevout.reserve(tx.vin.size());
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            CCoinsModifier coins = inputs.ModifyCoins(txin.prevout.hash);
-            unsigned nPos = txin.prevout.n;
-
-            if (nPos >= coins->vout.size() || coins->vout[nPos].IsNull())
-                assert(false);
             // mark an outpoint spent, and construct undo information
-            txundo.vprevout.push_back(CTxInUndo(coins->vout[nPos]));
-            coins->Spend(nPos);
-            if (coins->vout.size() == 0) {
-                CTxInUndo& undo = txundo.vprevout.back();
-                undo.nHeight = coins->nHeight;
-                undo.fCoinBase = coins->fCoinBase;
-                undo.nVersion = coins->nVersion;
-            }
+            Coin coin;
+            bool is_spent = inputs.SpendCoin(txin.prevout, &coin);
+            assert(is_spent);
+            txundo.vprevout.push_back(CTxInUndo(coin.out, coin.fCoinBase, coin.nHeight));
         }
     }
     // add outputs
-    inputs.ModifyNewCoins(tx.GetHash(), tx.IsCoinBase())->FromTx(tx, nHeight);
+    AddCoins(inputs, tx, nHeight);
 }
 
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight)
@@ -2094,20 +2263,20 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
         for (unsigned int i = 0; i < tx.vin.size(); i++)
         {
             const COutPoint &prevout = tx.vin[i].prevout;
-            const CCoins *coins = inputs.AccessCoins(prevout.hash);
-            assert(coins);
+            const Coin& coin = inputs.AccessCoin(prevout);
+            assert(!coin.IsSpent());
 
             // If prev is coinbase, check that it's matured
-            if (coins->IsCoinBase()) {
-                if (nSpendHeight - coins->nHeight < nMaturity)
+            if (coin.IsCoinBase()) {
+                if (nSpendHeight - coin.nHeight < nMaturity)
                     return state.Invalid(false,
                         REJECT_INVALID, "bad-txns-premature-spend-of-coinbase",
-                        strprintf("tried to spend coinbase at depth %d", nSpendHeight - coins->nHeight));
+                        strprintf("tried to spend coinbase at depth %d", nSpendHeight - coin.nHeight));
             }
 
             // Check for negative or overflow input values
-            nValueIn += coins->vout[prevout.n].nValue;
-            if (!MoneyRange(coins->vout[prevout.n].nValue) || !MoneyRange(nValueIn))
+            nValueIn += coin.out.nValue;
+            if (!MoneyRange(coin.out.nValue) || !MoneyRange(nValueIn))
                 return state.DoS(100, false, REJECT_INVALID, "bad-txns-inputvalues-outofrange");
 
         }
@@ -2127,7 +2296,7 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
 }
 }// namespace Consensus
 
-bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks)
+bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks)
 {
     if (!tx.IsCoinBase())
     {
@@ -2148,13 +2317,22 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         // the checkpoint is for a chain that's invalid due to false scriptSigs
         // this optimization would allow an invalid chain to be accepted.
         if (fScriptChecks) {
+            // Skip the scripts of a transaction that already passed them all
+            // with these flags, typically on its way into the memory pool.
+            // Like signature cache entries, the entry is consumed when not
+            // storing results, as the block is actually being connected.
+            uint256 hashCacheEntry;
+            scriptExecutionCache.ComputeEntry(hashCacheEntry, tx, flags);
+            if (scriptExecutionCache.Get(hashCacheEntry, !cacheStore))
+                return true;
+
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
-                const CCoins* coins = inputs.AccessCoins(prevout.hash);
-                assert(coins);
+                const Coin& coin = inputs.AccessCoin(prevout);
+                assert(!coin.IsSpent());
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore, &txdata);
+                CScriptCheck check(coin.out, tx, i, flags, cacheStore, &txdata);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -2166,7 +2344,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                         // arguments; if so, don't trigger DoS protection to
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
-                        CScriptCheck check2(*coins, tx, i,
+                        CScriptCheck check2(coin.out, tx, i,
                                 flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore, &txdata);
                         if (check2())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
@@ -2181,12 +2359,44 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                     return state.DoS(100,false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
                 }
             }
+
+            // Checks handed to the caller haven't run yet, so only a
+            // transaction verified right here can go into the cache.
+            if (cacheFullScriptStore && !pvChecks)
+                scriptExecutionCache.Set(hashCacheEntry);
         }
     }
 
     return true;
 }
 
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
+{
+    // Open history file to read
+    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: OpenUndoFile failed", __func__);
+
+    // Read block
+    uint256 hashChecksum;
+    try {
+        filein >> blockundo;
+        filein >> hashChecksum;
+    }
+    catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
+
+    // Verify checksum
+    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+    hasher << hashBlock;
+    hasher << blockundo;
+    if (hashChecksum != hasher.GetHash())
+        return error("%s: Checksum mismatch", __func__);
+
+    return true;
+}
+
 namespace {
 
 bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
@@ -2216,33 +2426,6 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     return true;
 }
 
-bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
-{
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("%s: OpenUndoFile failed", __func__);
-
-    // Read block
-    uint256 hashChecksum;
-    try {
-        filein >> blockundo;
-        filein >> hashChecksum;
-    }
-    catch (const std::exception& e) {
-        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
-    }
-
-    // Verify checksum
-    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
-    hasher << hashBlock;
-    hasher << blockundo;
-    if (hashChecksum != hasher.GetHash())
-        return error("%s: Checksum mismatch", __func__);
-
-    return true;
-}
-
 /** Abort with a message */
 bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
 {
@@ -2274,24 +2457,23 @@ static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const CO
 {
     bool fClean = true;
 
-    CCoinsModifier coins = view.ModifyCoins(out.hash);
-    if (undo.nHeight != 0) {
-        // undo data contains height: this is the last output of the prevout tx being spent
-        if (!coins->IsPruned())
-            fClean = fClean && error("%s: undo data overwriting existing transaction", __func__);
-        coins->Clear();
-        coins->fCoinBase = undo.fCoinBase;
-        coins->nHeight = undo.nHeight;
-        coins->nVersion = undo.nVersion;
-    } else {
-        if (coins->IsPruned())
+    if (view.HaveCoin(out))
+        fClean = fClean && error("%s: undo data overwriting existing output", __func__);
+
+    Coin coin(undo.txout, undo.nHeight, undo.fCoinBase);
+    if (undo.nHeight == 0) {
+        // Missing undo metadata (height and coinbase). Undo data written before
+        // the per-output chainstate only has it for the last spent output of a
+        // transaction, so it must be present for some other output of the same tx.
+        const Coin& alternate = AccessByTxid(view, out.hash);
+        if (!alternate.IsSpent()) {
+            coin.nHeight = alternate.nHeight;
+            coin.fCoinBase = alternate.fCoinBase;
+        } else {
             fClean = fClean && error("%s: undo data adding output to missing transaction", __func__);
+        }
     }
-    if (coins->IsAvailable(out.n))
-        fClean = fClean && error("%s: undo data overwriting existing output", __func__);
-    if (coins->vout.size() < out.n+1)
-        coins->vout.resize(out.n+1);
-    coins->vout[out.n] = undo.txout;
+    view.AddCoin(out, coin, !fClean);
 
     return fClean;
 }
@@ -2318,12 +2500,16 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
     std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
     std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
     std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
+    std::vector<std::pair<CFlagIndexKey, CFlagIndexValue> > flagIndex;
 
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction &tx = block.vtx[i];
         uint256 hash = tx.GetHash();
 
+        if (fFlagIndex)
+            GetFlagIndexRecords(tx, pindex->nHeight, true, flagIndex);
+
 
 
        if (fAddressIndex) {
@@ -2360,21 +2546,14 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
 
         // Check that all outputs are available and match the outputs in the block itself
         // exactly.
-        {
-        CCoinsModifier outs = view.ModifyCoins(hash);
-        outs->ClearUnspendable();
-
-        CCoins outsBlock(tx, pindex->nHeight);
-        // The CCoins serialization does not serialize negative numbers.
-        // No network rules currently depend on the version here, so an inconsistency is harmless
-        // but it must be corrected before txout nversion ever influences a network rule.
-        if (outsBlock.nVersion < 0)
-            outs->nVersion = outsBlock.nVersion;
-        if (*outs != outsBlock)
-            fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
-
-        // remove outputs
-        outs->Clear();
+        for (unsigned int o = 0; o < tx.vout.size(); o++) {
+            if (tx.vout[o].scriptPubKey.IsUnspendable())
+                continue;
+            // remove outputs
+            Coin coin;
+            bool is_spent = view.SpendCoin(COutPoint(hash, o), &coin);
+            if (!is_spent || tx.vout[o] != coin.out || pindex->nHeight != (int)coin.nHeight || tx.IsCoinBase() != (bool)coin.fCoinBase)
+                fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
         }
 
         // restore inputs
@@ -2434,14 +2613,13 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
     }
 
     if (fAddressIndex) {
-        if (!pblocktree->EraseAddressIndex(addressIndex)) {
-            return AbortNode(state, "Failed to delete address index");
-        }
-        if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex)) {
-            return AbortNode(state, "Failed to write address unspent index");
-        }
+        pblocktree->CacheAddressIndex(addressIndex, true);
+        pblocktree->CacheAddressUnspentIndex(addressUnspentIndex);
     }
 
+    if (fFlagIndex)
+        pblocktree->CacheFlagIndex(flagIndex);
+
     return fClean;
 }
 
@@ -2477,6 +2655,178 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+/**
+ * Closure checking the proof of work of a run of consecutive headers from
+ * one headers message. Plain scrypt headers are hashed together through the
+ * batch API; merge-mined headers take the regular auxpow check.
+ */
+class CPoWCheck
+{
+private:
+    const CBlockHeader *pbegin;
+    const CBlockHeader *pend;
+    const Consensus::Params *pparams;
+
+public:
+    CPoWCheck(): pbegin(NULL), pend(NULL), pparams(NULL) {}
+    CPoWCheck(const CBlockHeader* pbeginIn, const CBlockHeader* pendIn, const Consensus::Params& paramsIn) :
+        pbegin(pbeginIn), pend(pendIn), pparams(&paramsIn) { }
+
+    bool operator()();
+
+    void swap(CPoWCheck &check) {
+        std::swap(pbegin, check.pbegin);
+        std::swap(pend, check.pend);
+        std::swap(pparams, check.pparams);
+    }
+};
+
+bool CPoWCheck::operator()()
+{
+    assert(pend - pbegin <= SCRYPT_MAX_LANES);
+    char vchHeaders[SCRYPT_MAX_LANES * 80];
+    char vchHashes[SCRYPT_MAX_LANES * 32];
+    const CBlockHeader *vpHeaders[SCRYPT_MAX_LANES];
+    size_t nHeaders = 0;
+    for (const CBlockHeader *pheader = pbegin; pheader != pend; pheader++) {
+        if (pheader->auxpow) {
+            if (!CheckBlockProofOfWork(pheader, *pparams))
+                return false;
+            continue;
+        }
+        memcpy(&vchHeaders[nHeaders * 80], BEGIN(pheader->nVersion), 80);
+        vpHeaders[nHeaders++] = pheader;
+    }
+    if (nHeaders == 0)
+        return true;
+    scrypt_1024_1_1_256_batch(vchHeaders, vchHashes, nHeaders);
+    for (size_t i = 0; i < nHeaders; i++) {
+        uint256 hash;
+        memcpy(hash.begin(), &vchHashes[i * 32], 32);
+        if (!CheckProofOfWork(hash, vpHeaders[i]->nBits, *pparams))
+            return false;
+    }
+    return true;
+}
+
+static CCheckQueue<CPoWCheck> powcheckqueue(128);
+
+void ThreadPoWCheck() {
+    RenameThread("sexcoin-powch");
+    powcheckqueue.Thread();
+}
+
+/** A prevout of a block about to be connected, as read by a prefetch thread */
+struct CCoinsPrefetchResult
+{
+    COutPoint outpoint;
+    Coin coin;
+    bool fFound;
+
+    CCoinsPrefetchResult(const COutPoint& outpointIn) : outpoint(outpointIn), fFound(false) {}
+};
+
+/**
+ * Closure reading one prevout from the view behind pcoinsTip. A failed read
+ * leaves the coin to be fetched on demand, which reports the error.
+ */
+class CCoinsPrefetch
+{
+private:
+    const CCoinsView *view;
+    CCoinsPrefetchResult *presult;
+
+public:
+    CCoinsPrefetch(): view(NULL), presult(NULL) {}
+    CCoinsPrefetch(const CCoinsView* viewIn, CCoinsPrefetchResult* presultIn) :
+        view(viewIn), presult(presultIn) { }
+
+    bool operator()() {
+        try {
+            presult->fFound = view->GetCoin(presult->outpoint, presult->coin);
+        } catch (const std::exception&) {
+            presult->fFound = false;
+        }
+        return true;
+    }
+
+    void swap(CCoinsPrefetch &check) {
+        std::swap(view, check.view);
+        std::swap(presult, check.presult);
+    }
+};
+
+static CCheckQueue<CCoinsPrefetch> coinsprefetchqueue(128);
+
+void ThreadCoinsPrefetch() {
+    RenameThread("sexcoin-prefetch");
+    coinsprefetchqueue.Thread();
+}
+
+/**
+ * Read the coins spent by a block into pcoinsTip before it is connected.
+ * The reads are spread over the prefetch threads, so cache misses become
+ * overlapping database reads instead of one serial read per input in
+ * ConnectBlock.
+ */
+static void PrefetchBlockInputs(const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    if (!nScriptCheckThreads)
+        return;
+
+    // Outputs created within the block are not in the database yet
+    std::set<uint256> setBlockTxids;
+    std::vector<CCoinsPrefetchResult> vResults;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        if (!tx.IsCoinBase()) {
+            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                if (!setBlockTxids.count(txin.prevout.hash) && !pcoinsTip->HaveCoinInCache(txin.prevout))
+                    vResults.push_back(CCoinsPrefetchResult(txin.prevout));
+            }
+        }
+        setBlockTxids.insert(tx.GetHash());
+    }
+    if (vResults.empty())
+        return;
+
+    const CCoinsView *view = pcoinsTip->GetBackend();
+    CCheckQueueControl<CCoinsPrefetch> control(&coinsprefetchqueue);
+    std::vector<CCoinsPrefetch> vChecks;
+    vChecks.reserve(vResults.size());
+    for (size_t i = 0; i < vResults.size(); i++)
+        vChecks.push_back(CCoinsPrefetch(view, &vResults[i]));
+    control.Add(vChecks);
+    control.Wait();
+
+    BOOST_FOREACH(const CCoinsPrefetchResult& result, vResults) {
+        if (result.fFound && !result.coin.IsSpent())
+            pcoinsTip->CacheCoin(result.outpoint, result.coin);
+    }
+}
+
+/**
+ * Check the proof of work of the headers of a headers message from nBegin
+ * on, spread over the PoW check threads. Does not take cs_main.
+ */
+static bool CheckHeadersProofOfWork(const std::vector<CBlockHeader>& headers, size_t nBegin, const Consensus::Params& consensusParams)
+{
+    CCheckQueueControl<CPoWCheck> control(nScriptCheckThreads ? &powcheckqueue : NULL);
+    std::vector<CPoWCheck> vChecks;
+    for (size_t i = nBegin; i < headers.size(); i += SCRYPT_MAX_LANES) {
+        size_t nEnd = std::min(headers.size(), i + SCRYPT_MAX_LANES);
+        CPoWCheck check(&headers[i], &headers[0] + nEnd, consensusParams);
+        if (nScriptCheckThreads) {
+            vChecks.push_back(CPoWCheck());
+            check.swap(vChecks.back());
+        } else if (!check()) {
+            return false;
+        }
+    }
+    control.Add(vChecks);
+    return control.Wait();
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
@@ -2523,6 +2873,67 @@ public:
 // Protected by cs_main
 static ThresholdConditionCache warningcache[VERSIONBITS_NUM_BITS];
 
+/**
+ * The script verification flags of a block with the given version and time
+ * on top of pindexPrev.
+ */
+static unsigned int GetBlockScriptFlags(const CBlockIndex* pindexPrev, int32_t nVersion, int64_t nTime, const Consensus::Params& consensusparams)
+{
+    AssertLockHeld(cs_main);
+    const int nHeight = pindexPrev->nHeight + 1;
+
+    // BIP16 didn't become active until Oct 1 2012
+    int64_t nBIP16SwitchTime = 1349049600;
+    bool fStrictPayToScriptHash = (nTime >= nBIP16SwitchTime);
+
+    unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
+
+    // NOP2 is redefined as CHECKLOCKTIMEVERIFY in blocks with nVersion >= 3
+    //
+    // Introduce CHECKLOCKTIMEVERIFY at the same time as AuxPow.
+    if ((nVersion & 0xFF) < VERSIONBITS_TOP_BITS
+        && (nVersion & 0xFF) >= 3
+        && nHeight >= consensusparams.nCLTVStartBlock)
+    {
+        flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
+    }
+
+    // Start enforcing the DERSIG (BIP66) rules, for block.nVersion=4 blocks, when 75% of the network has upgraded:
+    if ((nVersion & 0xFF) < VERSIONBITS_TOP_BITS
+        && (nVersion & 0xff) >= 4
+        && IsSuperMajority(4, pindexPrev, consensusparams.nMajorityEnforceBlockUpgrade, consensusparams)
+        && nHeight >= consensusparams.nBIP66MinStartBlock)
+    {
+        flags |= SCRIPT_VERIFY_DERSIG;
+    }
+
+    // Start enforcing BIP112 (CHECKSEQUENCEVERIFY) using versionbits logic.
+    if (VersionBitsState(pindexPrev, consensusparams, Consensus::DEPLOYMENT_CSV, versionbitscache) == THRESHOLD_ACTIVE ||
+        nHeight >= consensusparams.nWitnessStartHeight) {
+        flags |= SCRIPT_VERIFY_CHECKSEQUENCEVERIFY;
+    }
+
+    // Start enforcing WITNESS rules using versionbits logic.
+    if (IsWitnessEnabled(pindexPrev, consensusparams)) {
+        flags |= SCRIPT_VERIFY_WITNESS;
+        flags |= SCRIPT_VERIFY_NULLDUMMY;
+    }
+
+    return flags;
+}
+
+bool IsAssumedValid(const CBlockIndex* pindex, const CBlockIndex* pindexAssumeValid, const CBlockIndex* pindexHeader, const Consensus::Params& consensusParams)
+{
+    // The block has to be a member of the assumed verified chain and an ancestor of the best header, and we
+    // must not have been denied access to a chain at least as good as the expected one. Blocks within two
+    // weeks' worth of work of the best header are still checked, so that an invalid block has to be buried
+    // deep to benefit, rather than just named in a setting.
+    return pindexAssumeValid->GetAncestor(pindex->nHeight) == pindex &&
+           pindexHeader->GetAncestor(pindex->nHeight) == pindex &&
+           pindexHeader->nChainWork >= UintToArith256(consensusParams.nMinimumChainWork) &&
+           GetBlockProofEquivalentTime(*pindexHeader, *pindex, *pindexHeader, consensusParams) > 60 * 60 * 24 * 7 * 2;
+}
+
 static int64_t nTimeCheck = 0;
 static int64_t nTimeForks = 0;
 static int64_t nTimeVerify = 0;
@@ -2562,6 +2973,15 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             fScriptChecks = false;
         }
     }
+    if (fScriptChecks && !hashAssumeValid.IsNull()) {
+        // We've been configured with the hash of a block which has been externally verified to have a valid history.
+        // A suitable default value is included with the software and updated from time to time. This setting
+        // doesn't force the selection of any particular chain, it only skips the script checks of the blocks
+        // leading up to the assumed valid one; the UTXO set and amounts are still fully checked.
+        BlockMap::const_iterator it = mapBlockIndex.find(hashAssumeValid);
+        if (it != mapBlockIndex.end() && IsAssumedValid(pindex, it->second, pindexBestHeader, chainparams.GetConsensus()))
+            fScriptChecks = false;
+    }
 
     int64_t nTime1 = GetTimeMicros(); nTimeCheck += nTime1 - nTimeStart;
     LogPrint("bench", "    - Sanity checks: %.2fms [%.2fs]\n", 0.001 * (nTime1 - nTimeStart), nTimeCheck * 0.000001);
@@ -2595,51 +3015,20 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     if (fEnforceBIP30) {
         BOOST_FOREACH(const CTransaction& tx, block.vtx) {
-            const CCoins* coins = view.AccessCoins(tx.GetHash());
-            if (coins && !coins->IsPruned())
-                return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
-                                 REJECT_INVALID, "bad-txns-BIP30");
+            for (unsigned int o = 0; o < tx.vout.size(); o++) {
+                if (view.HaveCoin(COutPoint(tx.GetHash(), o)))
+                    return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
+                                     REJECT_INVALID, "bad-txns-BIP30");
+            }
         }
     }
 
-    // BIP16 didn't become active until Oct 1 2012
-    int64_t nBIP16SwitchTime = 1349049600;
-    bool fStrictPayToScriptHash = (pindex->GetBlockTime() >= nBIP16SwitchTime);
-
-    unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
-
-    // NOP2 is redefined as CHECKLOCKTIMEVERIFY in blocks with nVersion >= 3
-    //
-    // Introduce CHECKLOCKTIMEVERIFY at the same time as AuxPow.
-    if ((block.nVersion & 0xFF) < VERSIONBITS_TOP_BITS
-        && (block.nVersion & 0xFF) >= 3
-        && pindex->nHeight >= chainparams.GetConsensus().nCLTVStartBlock)
-    {
-        flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
-    }
-
-    // Start enforcing the DERSIG (BIP66) rules, for block.nVersion=4 blocks, when 75% of the network has upgraded:
-    if ((block.nVersion & 0xFF) < VERSIONBITS_TOP_BITS
-        && (block.nVersion & 0xff) >= 4
-        && IsSuperMajority(4, pindex->pprev, chainparams.GetConsensus().nMajorityEnforceBlockUpgrade, chainparams.GetConsensus())
-        && pindex->nHeight >= chainparams.GetConsensus().nBIP66MinStartBlock)
-    {
-        flags |= SCRIPT_VERIFY_DERSIG;
-    }
+    unsigned int flags = GetBlockScriptFlags(pindex->pprev, block.nVersion, pindex->GetBlockTime(), chainparams.GetConsensus());
 
-    // Start enforcing BIP68 (sequence locks) and BIP112 (CHECKSEQUENCEVERIFY) using versionbits logic.
+    // Start enforcing BIP68 (sequence locks) along with BIP112 (CHECKSEQUENCEVERIFY).
     int nLockTimeFlags = 0;
-    if (VersionBitsState(pindex->pprev, chainparams.GetConsensus(), Consensus::DEPLOYMENT_CSV, versionbitscache) == THRESHOLD_ACTIVE ||
-        pindex->nHeight >= chainparams.GetConsensus().nWitnessStartHeight) {
-        flags |= SCRIPT_VERIFY_CHECKSEQUENCEVERIFY;
+    if (flags & SCRIPT_VERIFY_CHECKSEQUENCEVERIFY)
         nLockTimeFlags |= LOCKTIME_VERIFY_SEQUENCE;
-    }
-
-    // Start enforcing WITNESS rules using versionbits logic.
-    if (IsWitnessEnabled(pindex->pprev, chainparams.GetConsensus())) {
-        flags |= SCRIPT_VERIFY_WITNESS;
-        flags |= SCRIPT_VERIFY_NULLDUMMY;
-    }
 
     int64_t nTime2 = GetTimeMicros(); nTimeForks += nTime2 - nTime1;
     LogPrint("bench", "    - Fork checks: %.2fms [%.2fs]\n", 0.001 * (nTime2 - nTime1), nTimeForks * 0.000001);
@@ -2660,6 +3049,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
     std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
     std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
+    std::vector<std::pair<CFlagIndexKey, CFlagIndexValue> > flagIndex;
 
     std::vector<PrecomputedTransactionData> txdata;
     txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
@@ -2681,7 +3071,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             // be in ConnectBlock because they require the UTXO set
             prevheights.resize(tx.vin.size());
             for (size_t j = 0; j < tx.vin.size(); j++) {
-                prevheights[j] = view.AccessCoins(tx.vin[j].prevout.hash)->nHeight;
+                prevheights[j] = view.AccessCoin(tx.vin[j].prevout).nHeight;
             }
 
             // Which orphan pool entries must we evict?
@@ -2754,7 +3144,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
             std::vector<CScriptCheck> vChecks;
             bool fCacheResults = fJustCheck; /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
-            if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults, txdata[i], nScriptCheckThreads ? &vChecks : NULL))
+            if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults, fCacheResults, txdata[i], nScriptCheckThreads ? &vChecks : NULL))
                 return error("ConnectBlock(): CheckInputs on %s failed with %s",
                     tx.GetHash().ToString(), FormatStateMessage(state));
             control.Add(vChecks);
@@ -2789,6 +3179,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             }
         }
 
+        if (fFlagIndex)
+            GetFlagIndexRecords(tx, pindex->nHeight, false, flagIndex);
 
         CTxUndo undoDummy;
         if (i > 0) {
@@ -2839,19 +3231,18 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if(!pblocktree->WriteTxIndex(vPos))
             return AbortNode(state, _("Failed to write transaction index"));
 
+    // The address, spent and timestamp index records are buffered until
+    // the next flush of the chain state
     if (fAddressIndex) {
-        if (!pblocktree->WriteAddressIndex(addressIndex)) {
-            return AbortNode(state, "Failed to write address index");
-        }
-
-        if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex)) {
-            return AbortNode(state, "Failed to write address unspent index");
-        }
+        pblocktree->CacheAddressIndex(addressIndex, false);
+        pblocktree->CacheAddressUnspentIndex(addressUnspentIndex);
     }
 
     if (fSpentIndex)
-        if (!pblocktree->UpdateSpentIndex(spentIndex))
-            return AbortNode(state, "Failed to write transaction index");
+        pblocktree->CacheSpentIndex(spentIndex);
+
+    if (fFlagIndex)
+        pblocktree->CacheFlagIndex(flagIndex);
 
     if (fTimestampIndex) {
         unsigned int logicalTS = pindex->nTime;
@@ -2867,11 +3258,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             LogPrintf("%s: Previous logical timestamp is newer Actual[%d] prevLogical[%d] Logical[%d]\n", __func__, pindex->nTime, prevLogicalTS, logicalTS);
         }
 
-        if (!pblocktree->WriteTimestampIndex(CTimestampIndexKey(logicalTS, pindex->GetBlockHash())))
-            return AbortNode(state, "Failed to write timestamp index");
-
-        if (!pblocktree->WriteTimestampBlockIndex(CTimestampBlockIndexKey(pindex->GetBlockHash()), CTimestampBlockIndexValue(logicalTS)))
-            return AbortNode(state, "Failed to write blockhash index");
+        pblocktree->CacheTimestampIndex(pindex->GetBlockHash(), logicalTS);
+        AddTimestampIndex(logicalTS, pindex);
     }
 
     // add this block to the view's block chain
@@ -2944,7 +3332,8 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     if (nLastSetChain == 0) {
         nLastSetChain = nNow;
     }
-    size_t cacheSize = pcoinsTip->DynamicMemoryUsage();
+    // Buffered index records count against the same -dbcache budget
+    size_t cacheSize = pcoinsTip->DynamicMemoryUsage() + pblocktree->IndexCacheUsage();
     // The cache is large and close to the limit, but we have time now (not in the middle of a block processing).
     bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && cacheSize * (10.0/9) > nCoinCacheUsage;
     // The cache is over the limit, we have to write now.
@@ -2976,30 +3365,53 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
                 vBlocks.push_back(*it);
                 setDirtyBlockIndex.erase(it++);
             }
-            if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks, mapDirtyAuxPow)) {
+            // Index records go out with full flushes only, together with the
+            // block they bring every index to. The chainstate is written
+            // after them, so a restart that finds it at another block builds
+            // the indexes over to it instead of replaying their updates.
+            if (fDoFullFlush && chainActive.Tip()) {
+                const uint256 hashTip = chainActive.Tip()->GetBlockHash();
+                if (fAddressIndex)
+                    pblocktree->CacheIndexBest("addressindex", hashTip);
+                if (fSpentIndex)
+                    pblocktree->CacheIndexBest("spentindex", hashTip);
+                if (fTimestampIndex)
+                    pblocktree->CacheIndexBest("timestampindex", hashTip);
+                if (fFlagIndex)
+                    pblocktree->CacheIndexBest("flagindex", hashTip);
+            }
+            if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks, mapDirtyAuxPow, fDoFullFlush)) {
                 return AbortNode(state, "Files to write to block index database");
             }
             for (std::vector<const CBlockIndex*>::const_iterator it = vBlocks.begin(); it != vBlocks.end(); it++) {
                 mapDirtyAuxPow.erase((*it)->GetBlockHash());
             }
         }
-        // Finally remove any pruned files
-        if (fFlushForPrune)
+        // Finally remove any pruned files, once a chainstate write still in
+        // flight no longer needs them for a replay after a crash
+        if (fFlushForPrune) {
+            if (!pcoinsflusher->Sync())
+                return AbortNode(state, "Failed to write to coin database");
             UnlinkPrunedFiles(setFilesToPrune);
+        }
         nLastWrite = nNow;
     }
     // Flush best chain related state. This can only be done if the blocks / block index write was also done.
     if (fDoFullFlush) {
-        // Typical CCoins structures on disk are around 128 bytes in size.
+        // Typical Coin structures on disk are around 48 bytes in size.
         // Pushing a new one to the database can cause it to be written
         // twice (once in the log, and once in the tables). This is already
         // an overestimation, as most will delete an existing entry or
         // overwrite one. Still, use a conservative safety factor of 2.
-        if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
+        if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
         // Flush the chainstate (which may refer to block index entries).
+        // The write itself may go on in the background, except for
+        // explicit flushes, which callers rely on being on disk.
         if (!pcoinsTip->Flush())
             return AbortNode(state, "Failed to write to coin database");
+        if (mode == FLUSH_STATE_ALWAYS && !pcoinsflusher->Sync())
+            return AbortNode(state, "Failed to write to coin database");
         nLastFlush = nNow;
     }
     if (fDoFullFlush || ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000)) {
@@ -3141,6 +3553,7 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
 }
 
 static int64_t nTimeReadFromDisk = 0;
+static int64_t nTimePrefetch = 0;
 static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
@@ -3165,6 +3578,10 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+    PrefetchBlockInputs(*pblock);
+    int64_t nTimePrefetched = GetTimeMicros(); nTimePrefetch += nTimePrefetched - nTime2;
+    LogPrint("bench", "  - Prefetch inputs: %.2fms [%.2fs]\n", (nTimePrefetched - nTime2) * 0.001, nTimePrefetch * 0.000001);
+    nTime2 = nTimePrefetched;
     {
         CCoinsViewCache view(pcoinsTip);
         bool rv = ConnectBlock(*pblock, state, pindexNew, view, chainparams);
@@ -3571,6 +3988,38 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
     return pindexNew;
 }
 
+/**
+ * Count the transactions up to pindexNew, whose parent has them counted, and
+ * up to any descendants that were waiting for it. All of them become
+ * candidates for the tip.
+ */
+static void LinkBlockTransactions(CBlockIndex *pindexNew)
+{
+    deque<CBlockIndex*> queue;
+    queue.push_back(pindexNew);
+
+    // Recursively process any descendant blocks that now may be eligible to be connected.
+    while (!queue.empty()) {
+        CBlockIndex *pindex = queue.front();
+        queue.pop_front();
+        pindex->nChainTx = (pindex->pprev ? pindex->pprev->nChainTx : 0) + pindex->nTx;
+        {
+            LOCK(cs_nBlockSequenceId);
+            pindex->nSequenceId = nBlockSequenceId++;
+        }
+        if (chainActive.Tip() == NULL || !setBlockIndexCandidates.value_comp()(pindex, chainActive.Tip())) {
+            setBlockIndexCandidates.insert(pindex);
+        }
+        std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindex);
+        while (range.first != range.second) {
+            std::multimap<CBlockIndex*, CBlockIndex*>::iterator it = range.first;
+            queue.push_back(it->second);
+            range.first++;
+            mapBlocksUnlinked.erase(it);
+        }
+    }
+}
+
 /** Mark a block as having its data received and checked (up to BLOCK_VALID_TRANSACTIONS). */
 bool ReceivedBlockTransactions(const CBlock &block, CValidationState& state, CBlockIndex *pindexNew, const CDiskBlockPos& pos)
 {
@@ -3589,29 +4038,7 @@ bool ReceivedBlockTransactions(const CBlock &block, CValidationState& state, CBl
 
     if (pindexNew->pprev == NULL || pindexNew->pprev->nChainTx) {
         // If pindexNew is the genesis block or all parents are BLOCK_VALID_TRANSACTIONS.
-        deque<CBlockIndex*> queue;
-        queue.push_back(pindexNew);
-
-        // Recursively process any descendant blocks that now may be eligible to be connected.
-        while (!queue.empty()) {
-            CBlockIndex *pindex = queue.front();
-            queue.pop_front();
-            pindex->nChainTx = (pindex->pprev ? pindex->pprev->nChainTx : 0) + pindex->nTx;
-            {
-                LOCK(cs_nBlockSequenceId);
-                pindex->nSequenceId = nBlockSequenceId++;
-            }
-            if (chainActive.Tip() == NULL || !setBlockIndexCandidates.value_comp()(pindex, chainActive.Tip())) {
-                setBlockIndexCandidates.insert(pindex);
-            }
-            std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindex);
-            while (range.first != range.second) {
-                std::multimap<CBlockIndex*, CBlockIndex*>::iterator it = range.first;
-                queue.push_back(it->second);
-                range.first++;
-                mapBlocksUnlinked.erase(it);
-            }
-        }
+        LinkBlockTransactions(pindexNew);
     } else {
         if (pindexNew->pprev && pindexNew->pprev->IsValid(BLOCK_VALID_TREE)) {
             mapBlocksUnlinked.insert(std::make_pair(pindexNew->pprev, pindexNew));
@@ -3621,6 +4048,52 @@ bool ReceivedBlockTransactions(const CBlock &block, CValidationState& state, CBl
     return true;
 }
 
+bool ActivateTxOutSnapshot(CBlockIndex *pindexSnapshot, uint64_t nChainTx)
+{
+    AssertLockHeld(cs_main);
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+
+    // The blocks up to the snapshot count as connected, like pruned ones.
+    // Those never received are given one transaction each, so that the
+    // snapshot block can make up the chain's total.
+    std::vector<CBlockIndex*> vPath;
+    for (CBlockIndex *pindex = pindexSnapshot; pindex; pindex = pindex->pprev)
+        vPath.push_back(pindex);
+    for (std::vector<CBlockIndex*>::reverse_iterator it = vPath.rbegin(); it != vPath.rend(); ++it) {
+        CBlockIndex *pindex = *it;
+        if (pindex->nTx == 0) {
+            uint64_t nPrevChainTx = pindex->pprev ? pindex->pprev->nChainTx : 0;
+            pindex->nTx = pindex == pindexSnapshot && nChainTx > nPrevChainTx ? nChainTx - nPrevChainTx : 1;
+        }
+        pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
+        if (IsWitnessEnabled(pindex->pprev, consensusParams))
+            pindex->nStatus |= BLOCK_OPT_WITNESS;
+        setDirtyBlockIndex.insert(pindex);
+        if (pindex->pprev) {
+            std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindex->pprev);
+            while (range.first != range.second) {
+                std::multimap<CBlockIndex*, CBlockIndex*>::iterator itUnlinked = range.first++;
+                if (itUnlinked->second == pindex)
+                    mapBlocksUnlinked.erase(itUnlinked);
+            }
+        }
+        LinkBlockTransactions(pindex);
+    }
+
+    // The flags go first: the synced block index write of the flush below
+    // makes them durable too, and a crash before it never leaves a block
+    // index that has the missing blocks connected without them
+    if (!pblocktree->WriteFlag("prunedblockfiles", true) || !pblocktree->WriteFlag("txoutsnapshot", true))
+        return false;
+    fHavePruned = true;
+    fHaveTxOutSnapshot = true;
+
+    chainActive.SetTip(pindexSnapshot);
+    PruneBlockIndexCandidates();
+    CValidationState state;
+    return FlushStateToDisk(state, FLUSH_STATE_ALWAYS);
+}
+
 bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAddSize, unsigned int nHeight, uint64_t nTime, bool fKnown = false)
 {
     LOCK(cs_LastBlockFile);
@@ -4050,7 +4523,7 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     return true;
 }
 
-static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL)
+static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL, bool fCheckPOW=true)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
@@ -4069,7 +4542,7 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             return true;
         }
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus()))
+        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), fCheckPOW))
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
 
         // Get prev block index
@@ -4407,6 +4880,8 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
 bool static LoadBlockIndexDB()
 {
     const CChainParams& chainparams = Params();
+    if (!pblocktree->UpgradeBlockIndexAuxPow())
+        return error("%s: failed to move auxpows out of the block index", __func__);
     if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex))
         return false;
 
@@ -4488,6 +4963,9 @@ bool static LoadBlockIndexDB()
     pblocktree->ReadFlag("prunedblockfiles", fHavePruned);
     if (fHavePruned)
         LogPrintf("LoadBlockIndexDB(): Block files have previously been pruned\n");
+    pblocktree->ReadFlag("txoutsnapshot", fHaveTxOutSnapshot);
+    if (fHaveTxOutSnapshot)
+        LogPrintf("LoadBlockIndexDB(): The chain state was loaded from a UTXO set snapshot\n");
 
     // Check whether we need to continue reindexing
     bool fReindexing = false;
@@ -4500,17 +4978,35 @@ bool static LoadBlockIndexDB()
 
 
     // Check whether we have an address index
-    pblocktree->ReadFlag("addressindex", fAddressIndex);
+    bool fIndexFlag = false;
+    pblocktree->ReadFlag("addressindex", fIndexFlag);
+    fAddressIndex = fIndexFlag;
     LogPrintf("%s: address index %s\n", __func__, fAddressIndex ? "enabled" : "disabled");
+    if (!pblocktree->UpgradeAddressIndexFormat())
+        return error("%s: failed to upgrade the address index", __func__);
+    if (fAddressIndex && !pblocktree->UpgradeAddressBalances())
+        return error("%s: failed to build the address balance index", __func__);
 
     // Check whether we have a timestamp index
-    pblocktree->ReadFlag("timestampindex", fTimestampIndex);
+    fIndexFlag = false;
+    pblocktree->ReadFlag("timestampindex", fIndexFlag);
+    fTimestampIndex = fIndexFlag;
     LogPrintf("%s: timestamp index %s\n", __func__, fTimestampIndex ? "enabled" : "disabled");
+    if (fTimestampIndex && !LoadTimestampIndex())
+        return error("%s: failed to load the timestamp index", __func__);
 
     // Check whether we have a spent index
-    pblocktree->ReadFlag("spentindex", fSpentIndex);
+    fIndexFlag = false;
+    pblocktree->ReadFlag("spentindex", fIndexFlag);
+    fSpentIndex = fIndexFlag;
     LogPrintf("%s: spent index %s\n", __func__, fSpentIndex ? "enabled" : "disabled");
 
+    // Check whether we have a flag index
+    fIndexFlag = false;
+    pblocktree->ReadFlag("flagindex", fIndexFlag);
+    fFlagIndex = fIndexFlag;
+    LogPrintf("%s: flag index %s\n", __func__, fFlagIndex ? "enabled" : "disabled");
+
     // Load pointer to end of best chain
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     if (it == mapBlockIndex.end())
@@ -4570,8 +5066,8 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         uiInterface.ShowProgress(_("Verifying blocks..."), percentageDone);
         if (pindex->nHeight < chainActive.Height()-nCheckDepth)
             break;
-        if (fPruneMode && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
-            // If pruning, only go back as far as we have data.
+        if ((fPruneMode || fHavePruned) && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
+            // If pruning, or below a UTXO set snapshot, only go back as far as we have data.
             LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
             break;
         }
@@ -4746,7 +5242,10 @@ void UnloadBlockIndex()
         delete entry.second;
     }
     mapBlockIndex.clear();
+    vTimestampIndex.clear();
+    fTimestampIndexLoaded = false;
     fHavePruned = false;
+    fHaveTxOutSnapshot = false;
 }
 
 bool LoadBlockIndex()
@@ -4774,10 +5273,15 @@ bool InitBlockIndex(const CChainParams& chainparams)
     LogPrintf("%s: transaction index %s\n", __func__, fTxIndex ? "enabled" : "disabled");
 
     pblocktree->WriteFlag("auxpow", true);
+    pblocktree->WriteFlag("splitauxpow", true);
     // Use the provided setting for -addressindex in the new database
     fAddressIndex = GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX);
     pblocktree->WriteFlag("addressindex", fAddressIndex);
     LogPrintf("%s: address index %s\n", __func__, fAddressIndex ? "enabled" : "disabled");
+    // The chain state is rebuilt from the genesis block, so the running
+    // balances have to start from zero as well
+    if (!pblocktree->EraseAddressBalances())
+        return error("%s: failed to reset the address balance index", __func__);
 
     // Use the provided setting for -timestampindex in the new database
     fTimestampIndex = GetBoolArg("-timestampindex", DEFAULT_TIMESTAMPINDEX);
@@ -4788,6 +5292,17 @@ bool InitBlockIndex(const CChainParams& chainparams)
     pblocktree->WriteFlag("spentindex", fSpentIndex);
     LogPrintf("%s: spent index %s\n", __func__, fSpentIndex ? "enabled" : "disabled");
 
+    fFlagIndex = GetBoolArg("-flagindex", DEFAULT_FLAGINDEX);
+    pblocktree->WriteFlag("flagindex", fFlagIndex);
+    LogPrintf("%s: flag index %s\n", __func__, fFlagIndex ? "enabled" : "disabled");
+
+    // ConnectBlock builds the indexes along with the chain state, so an
+    // unfinished background build of them is abandoned
+    pblocktree->EraseIndexBuild("addressindex");
+    pblocktree->EraseIndexBuild("timestampindex");
+    pblocktree->EraseIndexBuild("spentindex");
+    pblocktree->EraseIndexBuild("flagindex");
+
     LogPrintf("Initializing databases...\n");
 
     // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
@@ -5187,12 +5702,18 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
                 recentRejects->reset();
             }
 
-            // Use pcoinsTip->HaveCoinsInCache as a quick approximation to exclude
+            if (recentRejects->contains(inv.hash) ||
+                mempool.exists(inv.hash) ||
+                mapOrphanTransactions.count(inv.hash))
+                return true;
+
+            // Use pcoinsTip->HaveCoinInCache as a quick approximation to exclude
             // requesting or processing some txs which have already been included in a block
-            return recentRejects->contains(inv.hash) ||
-                   mempool.exists(inv.hash) ||
-                   mapOrphanTransactions.count(inv.hash) ||
-                   pcoinsTip->HaveCoinsInCache(inv.hash);
+            for (unsigned int i = 0; i < 2; i++) {
+                if (pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, i)))
+                    return true;
+            }
+            return false;
         }
     case MSG_BLOCK:
     case MSG_WITNESS_BLOCK:
@@ -6367,6 +6888,30 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        // Check the proof of work of bulk header batches up front, in
+        // parallel and without holding cs_main. Announcements are left to the
+        // sequential checks below. Only a batch that connects to a known
+        // header and links up is checked, and headers we already have are
+        // skipped, so scrypt is not run for junk or for a resent batch. If
+        // anything fails here, the headers are simply checked again one by
+        // one so the offending one is reported.
+        bool fPoWChecked = false;
+        if (nCount >= MAX_BLOCKS_TO_ANNOUNCE) {
+            bool fContinuous = true;
+            for (unsigned int n = 1; n < nCount && fContinuous; n++)
+                fContinuous = headers[n].hashPrevBlock == headers[n - 1].GetHash();
+            bool fConnects = false;
+            unsigned int nFirstUnknown = 0;
+            if (fContinuous) {
+                LOCK(cs_main);
+                fConnects = mapBlockIndex.count(headers[0].hashPrevBlock) > 0;
+                while (fConnects && nFirstUnknown < nCount && mapBlockIndex.count(headers[nFirstUnknown].GetHash()))
+                    nFirstUnknown++;
+            }
+            if (fConnects)
+                fPoWChecked = CheckHeadersProofOfWork(headers, nFirstUnknown, chainparams.GetConsensus());
+        }
+
         {
         LOCK(cs_main);
 
@@ -6411,7 +6956,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 Misbehaving(pfrom->GetId(), 20);
                 return error("non-continuous headers sequence");
             }
-            if (!AcceptBlockHeader(header, state, chainparams, &pindexLast)) {
+            if (!AcceptBlockHeader(header, state, chainparams, &pindexLast, !fPoWChecked)) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
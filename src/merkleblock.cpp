@@ -52,12 +52,8 @@ CMerkleBlock::CMerkleBlock(const CBlock& block, CBloomFilter& filter, const std:
         if (it != mapDirtyAuxPow.end()) {
             header.auxpow = it->second;
         } else {
-            CDiskBlockIndex diskblockindex;
-            // auxpow is not in memory, load CDiskBlockHeader
-            // from database to get it
-
-            assert(pblocktree->ReadDiskBlockIndex(block.GetHash(), diskblockindex));
-            header.auxpow = diskblockindex.auxpow;
+            // auxpow is not in memory, load it from the database
+            assert(pblocktree->ReadAuxPow(block.GetHash(), header.auxpow));
         }
     }
 
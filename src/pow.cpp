@@ -9,9 +9,13 @@
 #include "chainparams.h"
 #include "primitives/block.h"
 #include "auxpow/auxpow.h"
+#include "limitedmap.h"
+#include "sync.h"
 #include "uint256.h"
 #include "util.h"
 
+#include <vector>
+
 unsigned int static CalculateNextWorkRequired_V1(const CBlockIndex* pindexLast, int64_t nFirstBlockTime, const Consensus::Params& params)
 {
     if (params.fPowNoRetargeting)
@@ -175,7 +179,19 @@ unsigned int GetNextWorkRequired_V2(const CBlockIndex* pindexLast, const CBlockH
 
     return CalculateNextWorkRequired_V2(pindexLast, pindexFirst->GetBlockTime(), params);
 }    
-unsigned int KimotoGravityWell(const CBlockIndex* pindexLast, const Consensus::Params& params) {
+/**
+ * EventHorizonDeviation of the KGW for every PastBlocksMass up to nMax,
+ * evaluated exactly as the walk below used to do it on every step.
+ */
+static std::vector<double> KGWEventHorizonTable(uint64_t nMax)
+{
+    std::vector<double> vDeviation(nMax + 1, 0);
+    for (uint64_t nMass = 1; nMass <= nMax; nMass++)
+        vDeviation[nMass] = 1 + (0.7084 * pow((double(nMass)/double(144)), -1.228));
+    return vDeviation;
+}
+
+static unsigned int KimotoGravityWellUncached(const CBlockIndex* pindexLast, const Consensus::Params& params) {
 
     const CBlockIndex   *BlockLastSolved                 = pindexLast;
     const CBlockIndex   *BlockReading                    = pindexLast;
@@ -201,6 +217,8 @@ unsigned int KimotoGravityWell(const CBlockIndex* pindexLast, const Consensus::P
     
     int64_t              TimeWarpFixHeight               = params.Fork3Height;
 
+    static const std::vector<double> vEventHorizonDeviation = KGWEventHorizonTable(PastBlocksMax);
+
     
     //LogPrint(1, "KimotoGravityWell()[in function]: block: %s\n", BlockLastSolved->ToString());  // LEDTMP
     //LogPrint(1, "PastBlocksMin = %d, PastBlocksMax=%d\n", PastBlocksMin, PastBlocksMax);
@@ -243,7 +261,7 @@ unsigned int KimotoGravityWell(const CBlockIndex* pindexLast, const Consensus::P
         if (PastRateActualSeconds != 0 && PastRateTargetSeconds != 0) {
             PastRateAdjustmentRatio = double(PastRateTargetSeconds) / double(PastRateActualSeconds);
         }
-        EventHorizonDeviation                   = 1 + (0.7084 * pow((double(PastBlocksMass)/double(144)), -1.228));
+        EventHorizonDeviation                   = vEventHorizonDeviation[PastBlocksMass];
         EventHorizonDeviationFast               = EventHorizonDeviation;
         EventHorizonDeviationSlow               = 1 / EventHorizonDeviation;
 
@@ -278,6 +296,53 @@ unsigned int KimotoGravityWell(const CBlockIndex* pindexLast, const Consensus::P
     */
     return bnNew.GetCompact();
 }
+
+/** Number of recent KimotoGravityWell results kept, by highest height. */
+static const unsigned int KGW_CACHE_SIZE = 512;
+
+static CCriticalSection cs_kgwcache;
+static limitedmap<uint256, std::pair<int, unsigned int> > mapKGWCache(KGW_CACHE_SIZE);
+/** The consensus parameters KimotoGravityWell depends on, as of the cached results */
+static uint256 powLimitKGWCache;
+static int nFork3HeightKGWCache = 0;
+
+static bool IsKGWCacheFor(const Consensus::Params& params)
+{
+    AssertLockHeld(cs_kgwcache);
+    return powLimitKGWCache == params.powLimit && nFork3HeightKGWCache == params.Fork3Height;
+}
+
+unsigned int KimotoGravityWell(const CBlockIndex* pindexLast, const Consensus::Params& params)
+{
+    // The result only depends on the ancestry of pindexLast, which its hash
+    // commits to, so it can be shared by every header or template built on
+    // top of the same block. Index entries without a hash are never cached.
+    // The cache holds results for one set of parameters at a time, and is
+    // emptied when asked for others.
+    if (pindexLast == NULL || pindexLast->phashBlock == NULL)
+        return KimotoGravityWellUncached(pindexLast, params);
+
+    const uint256 hash = pindexLast->GetBlockHash();
+    {
+        LOCK(cs_kgwcache);
+        if (!IsKGWCacheFor(params)) {
+            mapKGWCache.clear();
+            powLimitKGWCache = params.powLimit;
+            nFork3HeightKGWCache = params.Fork3Height;
+        }
+        limitedmap<uint256, std::pair<int, unsigned int> >::const_iterator it = mapKGWCache.find(hash);
+        if (it != mapKGWCache.end())
+            return it->second.second;
+    }
+
+    unsigned int nBits = KimotoGravityWellUncached(pindexLast, params);
+
+    LOCK(cs_kgwcache);
+    if (IsKGWCacheFor(params))
+        mapKGWCache.insert(std::make_pair(hash, std::make_pair(pindexLast->nHeight, nBits)));
+    return nBits;
+}
+
 unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHeader *pblock, const Consensus::Params& params)
 {
     // -regtest mode
@@ -15,6 +15,8 @@ class CBlockIndex;
 class uint256;
 
 unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHeader *pblock, const Consensus::Params&);
+/** KimotoGravityWell retarget for the block after pindexLast; results are memoized by block hash */
+unsigned int KimotoGravityWell(const CBlockIndex* pindexLast, const Consensus::Params&);
 
 /** Check whether a block hash satisfies the proof-of-work requirement specified by nBits */
 bool CheckProofOfWork(uint256 hash, unsigned int nBits, const Consensus::Params&);
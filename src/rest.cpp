@@ -9,6 +9,7 @@
 #include "primitives/transaction.h"
 #include "main.h"
 #include "httpserver.h"
+#include "indexbuilder.h"
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
@@ -43,16 +44,20 @@ static const struct {
 };
 
 struct CCoin {
-    uint32_t nTxVer; // Don't call this nVersion, that name has a special meaning inside IMPLEMENT_SERIALIZE
     uint32_t nHeight;
     CTxOut out;
 
+    CCoin() : nHeight(0) {}
+    CCoin(const Coin& in) : nHeight(in.nHeight), out(in.out) {}
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
     {
-        READWRITE(nTxVer);
+        // The transaction version is no longer kept with the unspent outputs
+        uint32_t nTxVerDummy = 0;
+        READWRITE(nTxVerDummy);
         READWRITE(nHeight);
         READWRITE(out);
     }
@@ -351,6 +356,61 @@ static bool rest_mempool_contents(HTTPRequest* req, const std::string& strURIPar
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+static bool rest_flagindex(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    vector<string> path;
+    boost::split(path, param, boost::is_any_of("/"));
+
+    if (path.size() != 3)
+        return RESTERR(req, HTTP_BAD_REQUEST, "No height range specified. Use /rest/flagindex/<flag>/<start>/<end>.<ext>.");
+
+    uint16_t flag;
+    if (!ParseFlagIndexFlag(path[0], flag))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid flag: " + path[0]);
+
+    int32_t start, end;
+    if (!ParseInt32(path[1], &start) || !ParseInt32(path[2], &end) || start < 0 || end < start)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid height range: " + path[1] + "/" + path[2]);
+
+    if (!fFlagIndex)
+        return RESTERR(req, HTTP_NOT_FOUND, "Flag index not enabled");
+    int nHeight;
+    bool fFailed;
+    if (GetIndexBuildProgress("flagindex", nHeight, fFailed))
+        return RESTERR(req, HTTP_SERVICE_UNAVAILABLE, "The flag index is being built");
+
+    std::vector<std::pair<CFlagIndexKey, CFlagIndexValue> > flagIndex;
+    if (!GetFlagIndex(flag, start, end, flagIndex))
+        return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, "Unable to read the flag index");
+
+    switch (rf) {
+    case RF_JSON: {
+        UniValue result(UniValue::VARR);
+        for (std::vector<std::pair<CFlagIndexKey, CFlagIndexValue> >::const_iterator it = flagIndex.begin(); it != flagIndex.end(); it++) {
+            UniValue item(UniValue::VOBJ);
+            item.push_back(Pair("txid", it->first.txhash.GetHex()));
+            item.push_back(Pair("height", it->first.blockHeight));
+            item.push_back(Pair("flags", (int)it->second.flags));
+            result.push_back(item);
+        }
+        string strJSON = result.write() + "\n";
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, strJSON);
+        return true;
+    }
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: json)");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
 static bool rest_tx(HTTPRequest* req, const std::string& strURIPart)
 {
     if (!CheckWarmup(req))
@@ -515,21 +575,10 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
             view.SetBackend(viewMempool); // switch cache backend to db+mempool in case user likes to query mempool
 
         for (size_t i = 0; i < vOutPoints.size(); i++) {
-            CCoins coins;
-            uint256 hash = vOutPoints[i].hash;
-            if (view.GetCoins(hash, coins)) {
-                mempool.pruneSpent(hash, coins);
-                if (coins.IsAvailable(vOutPoints[i].n)) {
-                    hits[i] = true;
-                    // Safe to index into vout here because IsAvailable checked if it's off the end of the array, or if
-                    // n is valid but points to an already spent output (IsNull).
-                    CCoin coin;
-                    coin.nTxVer = coins.nVersion;
-                    coin.nHeight = coins.nHeight;
-                    coin.out = coins.vout.at(vOutPoints[i].n);
-                    assert(!coin.out.IsNull());
-                    outs.push_back(coin);
-                }
+            Coin coin;
+            if (view.GetCoin(vOutPoints[i], coin) && !mempool.isSpent(vOutPoints[i])) {
+                hits[i] = true;
+                outs.push_back(CCoin(coin));
             }
 
             bitmapStringRepresentation.append(hits[i] ? "1" : "0"); // form a binary string representation (human-readable for json output)
@@ -572,7 +621,6 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
         UniValue utxos(UniValue::VARR);
         BOOST_FOREACH (const CCoin& coin, outs) {
             UniValue utxo(UniValue::VOBJ);
-            utxo.push_back(Pair("txvers", (int32_t)coin.nTxVer));
             utxo.push_back(Pair("height", (int32_t)coin.nHeight));
             utxo.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
 
@@ -611,6 +659,7 @@ static const struct {
       {"/rest/mempool/contents", rest_mempool_contents},
       {"/rest/headers/", rest_headers},
       {"/rest/getutxos", rest_getutxos},
+      {"/rest/flagindex/", rest_flagindex},
 };
 
 bool StartREST()
@@ -4,23 +4,27 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "amount.h"
+#include "auxpow/auxpow.h"
 #include "base58.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "coins.h"
 #include "consensus/validation.h"
+#include "indexbuilder.h"
 #include "main.h"
 #include "policy/policy.h"
 #include "primitives/transaction.h"
 #include "rpc/server.h"
 #include "script/script.h"
 #include "script/script_error.h"
+#include "script/sigcache.h"
 #include "script/sign.h"
 #include "script/standard.h"
 #include "streams.h"
 #include "sync.h"
 #include "txmempool.h"
+#include "txoutsnapshot.h"
 #include "util.h"
 #include "utilstrencodings.h"
 #include "hash.h"
@@ -29,6 +33,7 @@
 
 #include <univalue.h>
 
+#include <boost/filesystem.hpp>
 #include <boost/thread/thread.hpp> // boost::thread::interrupt
 
 using namespace std;
@@ -67,6 +72,18 @@ double GetDifficulty(const CBlockIndex* blockindex)
     return dDiff;
 }
 
+void EnsureIndexBuilt(const std::string& strIndex)
+{
+    LOCK(cs_main);
+    int nHeight;
+    bool fFailed;
+    if (!GetIndexBuildProgress(strIndex, nHeight, fFailed))
+        return;
+    if (fFailed)
+        throw JSONRPCError(RPC_MISC_ERROR, strprintf("Building the %s stopped at block %d, see debug.log", strIndex, nHeight));
+    throw JSONRPCError(RPC_IN_WARMUP, strprintf("The %s is being built, at block %d of %d", strIndex, nHeight, chainActive.Height()));
+}
+
 UniValue blockheaderToJSON(const CBlockIndex* blockindex)
 {
     UniValue result(UniValue::VOBJ);
@@ -676,10 +693,9 @@ UniValue getblockhashes(const UniValue& params, bool fHelp)
         }
     }
 
-    std::vector<std::pair<uint256, unsigned int> > blockHashes;
+    EnsureIndexBuilt("timestampindex");
 
-    if (fActiveOnly)
-        LOCK(cs_main);
+    std::vector<std::pair<uint256, unsigned int> > blockHashes;
 
     if (!GetTimestampIndex(high, low, fActiveOnly, blockHashes)) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for block hashes");
@@ -877,38 +893,33 @@ static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
 {
     boost::scoped_ptr<CCoinsViewCursor> pcursor(view->Cursor());
 
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
     stats.hashBlock = pcursor->GetBestBlock();
     {
         LOCK(cs_main);
         stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
     }
-    ss << stats.hashBlock;
+    CTxOutSetHasher hasher(stats.hashBlock);
     CAmount nTotalAmount = 0;
+    uint256 prevkey;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
-        uint256 key;
-        CCoins coins;
-        if (pcursor->GetKey(key) && pcursor->GetValue(coins)) {
-            stats.nTransactions++;
-            ss << key;
-            for (unsigned int i=0; i<coins.vout.size(); i++) {
-                const CTxOut &out = coins.vout[i];
-                if (!out.IsNull()) {
-                    stats.nTransactionOutputs++;
-                    ss << VARINT(i+1);
-                    ss << out;
-                    nTotalAmount += out.nValue;
-                }
-            }
+        COutPoint key;
+        Coin coin;
+        if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
+            if (stats.nTransactionOutputs == 0 || key.hash != prevkey)
+                stats.nTransactions++;
+            prevkey = key.hash;
+            if (!hasher.Add(key, coin))
+                return error("%s: unspent outputs out of order", __func__);
+            stats.nTransactionOutputs++;
+            nTotalAmount += coin.out.nValue;
             stats.nSerializedSize += 32 + pcursor->GetValueSize();
-            ss << VARINT(0);
         } else {
             return error("%s: unable to read value", __func__);
         }
         pcursor->Next();
     }
-    stats.hashSerialized = ss.GetHash();
+    stats.hashSerialized = hasher.GetHash();
     stats.nTotalAmount = nTotalAmount;
     return true;
 }
@@ -927,7 +938,7 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
             "  \"transactions\": n,      (numeric) The number of transactions\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
             "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
+            "  \"hash_serialized\": \"hash\",   (string) The hash of the unspent outputs, heights and coinbase flags, as loadtxoutset expects it\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
@@ -953,6 +964,84 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
     return ret;
 }
 
+static UniValue TxOutSnapshotToJSON(const CTxOutSnapshotInfo& info, const boost::filesystem::path& path)
+{
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("bestblock", info.hashBlock.GetHex()));
+    ret.push_back(Pair("height", (int64_t)info.nHeight));
+    ret.push_back(Pair("txouts", (int64_t)info.nCoins));
+    ret.push_back(Pair("hash_serialized", info.hashSerialized.GetHex()));
+    ret.push_back(Pair("path", path.string()));
+    return ret;
+}
+
+UniValue dumptxoutset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrites the unspent transaction output set as of the current tip to a snapshot file,\n"
+            "which loadtxoutset or -loadtxoutset can load on another node.\n"
+            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"path\"        (string, required) The file to write, which must not exist yet. Relative paths are in the data directory\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"bestblock\": \"hex\",       (string) the hash of the block the snapshot is of\n"
+            "  \"height\": n,              (numeric) the height of that block\n"
+            "  \"txouts\": n,              (numeric) The number of unspent outputs\n"
+            "  \"hash_serialized\": \"hash\", (string) The hash of the outputs, as gettxoutsetinfo reports it\n"
+            "  \"path\": \"path\"            (string) the file written\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+
+    boost::filesystem::path path = boost::filesystem::absolute(params[0].get_str(), GetDataDir());
+    CTxOutSnapshotInfo info;
+    std::string strError;
+    if (!DumpTxOutSet(path, info, strError))
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+    return TxOutSnapshotToJSON(info, path);
+}
+
+UniValue loadtxoutset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 2)
+        throw runtime_error(
+            "loadtxoutset \"path\" \"hash\"\n"
+            "\nReplaces the chain state by a snapshot file written by dumptxoutset, and syncs on from its block.\n"
+            "The header of the block must be known and on the best header chain, and the active chain must\n"
+            "not have reached it yet. Blocks below it are never downloaded, as if pruned, so -txindex and the\n"
+            "other indexes have to be off. The file is checked before anything is changed, and only loaded if\n"
+            "it has the expected hash.\n"
+            "Note this call may take some time, and block validation waits while the coins are written.\n"
+            "\nArguments:\n"
+            "1. \"path\"        (string, required) The snapshot file. Relative paths are in the data directory\n"
+            "2. \"hash\"        (string, required) The expected hash_serialized of gettxoutsetinfo at the snapshot block\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"bestblock\": \"hex\",       (string) the hash of the block the snapshot is of, now the tip\n"
+            "  \"height\": n,              (numeric) the height of that block\n"
+            "  \"txouts\": n,              (numeric) The number of unspent outputs\n"
+            "  \"hash_serialized\": \"hash\", (string) The hash of the outputs, as gettxoutsetinfo reports it\n"
+            "  \"path\": \"path\"            (string) the file loaded\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("loadtxoutset", "\"utxo.dat\" \"1075db55d416d3ca199f55b6084e2115b9345e16c5cf302fc80e9d5fbf5d48d2\"")
+            + HelpExampleRpc("loadtxoutset", "\"utxo.dat\", \"1075db55d416d3ca199f55b6084e2115b9345e16c5cf302fc80e9d5fbf5d48d2\"")
+        );
+
+    boost::filesystem::path path = boost::filesystem::absolute(params[0].get_str(), GetDataDir());
+    uint256 hashExpected = ParseHashV(params[1], "hash");
+    CTxOutSnapshotInfo info;
+    std::string strError;
+    if (!LoadTxOutSet(path, hashExpected, info, strError))
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+    return TxOutSnapshotToJSON(info, path);
+}
+
 UniValue gettxout(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -978,7 +1067,6 @@ UniValue gettxout(const UniValue& params, bool fHelp)
             "        ,...\n"
             "     ]\n"
             "  },\n"
-            "  \"version\" : n,            (numeric) The version\n"
             "  \"coinbase\" : true|false   (boolean) Coinbase or not\n"
             "}\n"
 
@@ -1002,33 +1090,33 @@ UniValue gettxout(const UniValue& params, bool fHelp)
     if (params.size() > 2)
         fMempool = params[2].get_bool();
 
-    CCoins coins;
+    if (n < 0)
+        return NullUniValue;
+    COutPoint out(hash, n);
+
+    Coin coin;
     if (fMempool) {
         LOCK(mempool.cs);
         CCoinsViewMemPool view(pcoinsTip, mempool);
-        if (!view.GetCoins(hash, coins))
+        if (!view.GetCoin(out, coin) || mempool.isSpent(out)) // TODO: filtering spent coins should be done by the CCoinsViewMemPool
             return NullUniValue;
-        mempool.pruneSpent(hash, coins); // TODO: this should be done by the CCoinsViewMemPool
     } else {
-        if (!pcoinsTip->GetCoins(hash, coins))
+        if (!pcoinsTip->GetCoin(out, coin))
             return NullUniValue;
     }
-    if (n<0 || (unsigned int)n>=coins.vout.size() || coins.vout[n].IsNull())
-        return NullUniValue;
 
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     CBlockIndex *pindex = it->second;
     ret.push_back(Pair("bestblock", pindex->GetBlockHash().GetHex()));
-    if ((unsigned int)coins.nHeight == MEMPOOL_HEIGHT)
+    if (coin.nHeight == MEMPOOL_HEIGHT)
         ret.push_back(Pair("confirmations", 0));
     else
-        ret.push_back(Pair("confirmations", pindex->nHeight - coins.nHeight + 1));
-    ret.push_back(Pair("value", ValueFromAmount(coins.vout[n].nValue)));
+        ret.push_back(Pair("confirmations", (int64_t)(pindex->nHeight - coin.nHeight + 1)));
+    ret.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
     UniValue o(UniValue::VOBJ);
-    ScriptPubKeyToJSON(coins.vout[n].scriptPubKey, o, true);
+    ScriptPubKeyToJSON(coin.out.scriptPubKey, o, true);
     ret.push_back(Pair("scriptPubKey", o));
-    ret.push_back(Pair("version", coins.nVersion));
-    ret.push_back(Pair("coinbase", coins.fCoinBase));
+    ret.push_back(Pair("coinbase", (bool)coin.fCoinBase));
 
     return ret;
 }
@@ -1138,6 +1226,26 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
             "  \"chainwork\": \"xxxx\"     (string) total amount of work in active chain, in hexadecimal\n"
             "  \"pruned\": xx,             (boolean) if the blocks are subject to pruning\n"
             "  \"pruneheight\": xxxxxx,    (numeric) lowest-height complete block stored\n"
+            "  \"auxpowcache\": {          (object) cache of merge-mined block auxpows used when serving headers\n"
+            "     \"entries\": xxxxx,       (numeric) number of cached auxpows\n"
+            "     \"usage\": xxxxx,         (numeric) estimated memory usage in bytes\n"
+            "     \"maxusage\": xxxxx,      (numeric) configured limit in bytes (-auxpowcache)\n"
+            "     \"hits\": xxxxx,          (numeric) lookups served from the cache\n"
+            "     \"misses\": xxxxx         (numeric) lookups that went to the block index database\n"
+            "  },\n"
+            "  \"scriptcache\": {          (object) cache of transactions whose scripts were verified on mempool acceptance\n"
+            "     \"entries\": xxxxx,       (numeric) number of cached transactions\n"
+            "     \"usage\": xxxxx,         (numeric) estimated memory usage in bytes\n"
+            "     \"maxusage\": xxxxx,      (numeric) configured limit in bytes (-maxscriptcachesize)\n"
+            "     \"hits\": xxxxx,          (numeric) transactions of connected blocks whose scripts were skipped\n"
+            "     \"misses\": xxxxx         (numeric) transactions of connected blocks whose scripts were run\n"
+            "  },\n"
+            "  \"indexes\": {              (object) indexes being built in the background, by name\n"
+            "     \"xxxx\": {\n"
+            "        \"height\": xxxxxx,    (numeric) last block covered by the index\n"
+            "        \"failed\": xx         (boolean) if building stopped on an error, see debug.log\n"
+            "     }\n"
+            "  },\n"
             "  \"softforks\": [            (array) status of softforks in progress\n"
             "     {\n"
             "        \"id\": \"xxxx\",        (string) name of softfork\n"
@@ -1190,6 +1298,36 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
     obj.push_back(Pair("softforks",             softforks));
     obj.push_back(Pair("bip9_softforks", bip9_softforks));
 
+    UniValue auxpowcache(UniValue::VOBJ);
+    auxpowcache.push_back(Pair("entries",     (uint64_t)auxpowCache.Size()));
+    auxpowcache.push_back(Pair("usage",       (uint64_t)auxpowCache.DynamicMemoryUsage()));
+    auxpowcache.push_back(Pair("maxusage",    (uint64_t)auxpowCache.MaxUsage()));
+    auxpowcache.push_back(Pair("hits",        auxpowCache.Hits()));
+    auxpowcache.push_back(Pair("misses",      auxpowCache.Misses()));
+    obj.push_back(Pair("auxpowcache", auxpowcache));
+
+    UniValue scriptcache(UniValue::VOBJ);
+    scriptcache.push_back(Pair("entries",     (uint64_t)scriptExecutionCache.Size()));
+    scriptcache.push_back(Pair("usage",       (uint64_t)scriptExecutionCache.DynamicMemoryUsage()));
+    scriptcache.push_back(Pair("maxusage",    (uint64_t)scriptExecutionCache.MaxSize()));
+    scriptcache.push_back(Pair("hits",        scriptExecutionCache.Hits()));
+    scriptcache.push_back(Pair("misses",      scriptExecutionCache.Misses()));
+    obj.push_back(Pair("scriptcache", scriptcache));
+
+    UniValue indexes(UniValue::VOBJ);
+    const char* indexNames[] = { "addressindex", "spentindex", "timestampindex", "flagindex" };
+    for (unsigned int i = 0; i < ARRAYLEN(indexNames); i++) {
+        int nHeight;
+        bool fFailed;
+        if (GetIndexBuildProgress(indexNames[i], nHeight, fFailed)) {
+            UniValue index(UniValue::VOBJ);
+            index.push_back(Pair("height", nHeight));
+            index.push_back(Pair("failed", fFailed));
+            indexes.push_back(Pair(indexNames[i], index));
+        }
+    }
+    obj.push_back(Pair("indexes", indexes));
+
     if (fPruneMode)
     {
         CBlockIndex *block = chainActive.Tip();
@@ -1450,6 +1588,8 @@ static const CRPCCommand commands[] =
     { "blockchain",         "gettxout",               &gettxout,               true  },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true  },
     { "blockchain",         "verifychain",            &verifychain,            true  },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           true  },
+    { "blockchain",         "loadtxoutset",           &loadtxoutset,           false },
 
     /* Not shown in help */
     { "hidden",             "invalidateblock",        &invalidateblock,        true  },
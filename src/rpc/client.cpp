@@ -109,6 +109,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "getblockhashes", 2 },
     { "getspentinfo", 0},
     { "getaddresstxids", 0},
+    { "getflaggedtxids", 0},
     { "getaddressbalance", 0},
     { "getaddressdeltas", 0},
     { "getaddressutxos", 0},
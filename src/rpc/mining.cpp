@@ -11,6 +11,7 @@
 #include "consensus/params.h"
 #include "consensus/validation.h"
 #include "core_io.h"
+#include "crypto/scrypt.h"
 #include "init.h"
 #include "main.h"
 #include "miner.h"
@@ -121,9 +122,24 @@ UniValue generateBlocks(boost::shared_ptr<CReserveScript> coinbaseScript, int nG
             LOCK(cs_main);
             IncrementExtraNonce(pblock, chainActive.Tip(), nExtraNonce);
         }
-        while (nMaxTries > 0 && pblock->nNonce < nInnerLoopCount && !CheckProofOfWork(pblock->GetPoWHash(), pblock->nBits, Params().GetConsensus())) {
-            ++pblock->nNonce;
-            --nMaxTries;
+        // Hash runs of consecutive nonces at once to keep the multi-lane scrypt kernels busy
+        char vchHeaders[80 * SCRYPT_MAX_LANES];
+        uint256 vPoWHash[SCRYPT_MAX_LANES];
+        bool fFound = false;
+        while (!fFound && nMaxTries > 0 && pblock->nNonce < nInnerLoopCount) {
+            const uint32_t nStartNonce = pblock->nNonce;
+            unsigned int nBatch = std::min<uint64_t>(std::min<uint64_t>(SCRYPT_MAX_LANES, nMaxTries), nInnerLoopCount - nStartNonce);
+            for (unsigned int i = 0; i < nBatch; i++) {
+                pblock->nNonce = nStartNonce + i;
+                memcpy(&vchHeaders[i * 80], BEGIN(pblock->nVersion), 80);
+            }
+            scrypt_1024_1_1_256_batch(vchHeaders, BEGIN(vPoWHash[0]), nBatch);
+            unsigned int i = 0;
+            while (i < nBatch && !CheckProofOfWork(vPoWHash[i], pblock->nBits, Params().GetConsensus()))
+                i++;
+            fFound = (i < nBatch);
+            pblock->nNonce = nStartNonce + i;
+            nMaxTries -= i;
         }
         if (nMaxTries == 0) {
             break;
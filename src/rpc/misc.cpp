@@ -506,6 +506,147 @@ bool timestampSort(std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> a,
     return a.second.time < b.second.time;
 }
 
+bool getPageFromParams(const UniValue& params, size_t &limit, std::string &cursor)
+{
+    if (!params[0].isObject()) {
+        return false;
+    }
+
+    UniValue limitValue = find_value(params[0].get_obj(), "limit");
+    UniValue cursorValue = find_value(params[0].get_obj(), "cursor");
+    if (limitValue.isNull()) {
+        if (!cursorValue.isNull()) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "A cursor is only valid together with a limit");
+        }
+        return false;
+    }
+    if (limitValue.get_int() <= 0) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Limit is expected to be greater than zero");
+    }
+    limit = limitValue.get_int();
+    if (!cursorValue.isNull()) {
+        cursor = cursorValue.get_str();
+    }
+
+    return true;
+}
+
+/** A cursor is the position of the address in the request and the index key of the last result returned */
+template <typename Key>
+std::string encodeAddressCursor(uint32_t addressPos, const Key &key)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << addressPos << key;
+    return HexStr(ss.begin(), ss.end());
+}
+
+template <typename Key>
+void decodeAddressCursor(const std::string &cursor, const std::vector<std::pair<uint160, int> > &addresses,
+                         uint32_t &addressPos, Key &key)
+{
+    if (!IsHex(cursor)) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+    }
+    CDataStream ss(ParseHex(cursor), SER_DISK, CLIENT_VERSION);
+    try {
+        ss >> addressPos >> key;
+    } catch (const std::exception&) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+    }
+    if (!ss.empty() || addressPos >= addresses.size() ||
+        key.hashBytes != addresses[addressPos].first || (int)key.type != addresses[addressPos].second) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Cursor does not match the requested addresses");
+    }
+}
+
+/** Collects merged address index entries, up to a maximum if one is given */
+struct CAddressIndexCollector
+{
+    std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex;
+    size_t maxEntries;
+
+    CAddressIndexCollector(std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndexIn, size_t maxEntriesIn) :
+        addressIndex(addressIndexIn), maxEntries(maxEntriesIn) {}
+
+    bool operator()(const CAddressIndexKey &key, CAmount value) {
+        addressIndex.push_back(std::make_pair(key, value));
+        return maxEntries == 0 || addressIndex.size() < maxEntries;
+    }
+};
+
+/** Read the address index of all addresses, merged in chain order */
+void getAddressIndexMerged(const std::vector<std::pair<uint160, int> > &addresses, int start, int end,
+                           std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex)
+{
+    if (!GetAddressIndexMerged(addresses, start, end, NULL, CAddressIndexCollector(addressIndex, 0))) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+    }
+}
+
+/**
+ * Read one page of the address index of all addresses, merged in chain order.
+ * Returns the cursor to continue with, or an empty string after the last page.
+ */
+std::string getAddressIndexPage(const std::vector<std::pair<uint160, int> > &addresses, int start, int end,
+                                size_t limit, const std::string &cursor,
+                                std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex)
+{
+    uint32_t addressPos = 0;
+    CAddressIndexKey after;
+    if (!cursor.empty()) {
+        decodeAddressCursor(cursor, addresses, addressPos, after);
+    }
+
+    // Read one entry more than requested to find out whether there is another page
+    if (!GetAddressIndexMerged(addresses, start, end, cursor.empty() ? NULL : &after,
+                               CAddressIndexCollector(addressIndex, limit + 1))) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+    }
+
+    if (addressIndex.size() <= limit) {
+        return "";
+    }
+    addressIndex.resize(limit);
+
+    const CAddressIndexKey &last = addressIndex.back().first;
+    for (addressPos = 0; addressPos < addresses.size(); addressPos++) {
+        if (addresses[addressPos].first == last.hashBytes && addresses[addressPos].second == (int)last.type) {
+            break;
+        }
+    }
+    return encodeAddressCursor(addressPos, last);
+}
+
+std::string getAddressUnspentPage(const std::vector<std::pair<uint160, int> > &addresses,
+                                  size_t limit, const std::string &cursor,
+                                  std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs)
+{
+    uint32_t addressPos = 0;
+    CAddressUnspentKey after;
+    if (!cursor.empty()) {
+        decodeAddressCursor(cursor, addresses, addressPos, after);
+    }
+
+    uint32_t lastPos = addressPos;
+    for (uint32_t pos = addressPos; pos < addresses.size() && unspentOutputs.size() <= limit; pos++) {
+        size_t before = unspentOutputs.size();
+        const CAddressUnspentKey *pAfter = (pos == addressPos && !cursor.empty()) ? &after : NULL;
+        if (!GetAddressUnspent(addresses[pos].first, addresses[pos].second, unspentOutputs,
+                               pAfter, limit + 1 - before)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+        }
+        if (unspentOutputs.size() > before && before < limit) {
+            lastPos = pos;
+        }
+    }
+
+    if (unspentOutputs.size() <= limit) {
+        return "";
+    }
+    unspentOutputs.resize(limit);
+    return encodeAddressCursor(lastPos, unspentOutputs.back().first);
+}
+
 UniValue getaddressmempool(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -591,8 +732,10 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp)
             "      ,...\n"
             "    ],\n"
             "  \"chainInfo\"  (boolean) Include chain info with results\n"
+            "  \"limit\"  (number, optional) Return at most this many outputs, ordered by address and txid instead of height\n"
+            "  \"cursor\"  (string, optional) The cursor returned with the previous page\n"
             "}\n"
-            "\nResult\n"
+            "\nResult (with \"limit\", the outputs are returned in \"utxos\" together with the \"cursor\" of the next page, if any)\n"
             "[\n"
             "  {\n"
             "    \"address\"  (string) The address base58check encoded\n"
@@ -616,21 +759,31 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp)
         }
     }
 
+    EnsureIndexBuilt("addressindex");
+
     std::vector<std::pair<uint160, int> > addresses;
 
     if (!getAddressesFromParams(params, addresses)) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
+    size_t limit = 0;
+    std::string cursor;
+    bool paged = getPageFromParams(params, limit, cursor);
+
     std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
 
-    for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (!GetAddressUnspent((*it).first, (*it).second, unspentOutputs)) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+    if (paged) {
+        cursor = getAddressUnspentPage(addresses, limit, cursor, unspentOutputs);
+    } else {
+        for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
+            if (!GetAddressUnspent((*it).first, (*it).second, unspentOutputs)) {
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+            }
         }
-    }
 
-    std::sort(unspentOutputs.begin(), unspentOutputs.end(), heightSort);
+        std::sort(unspentOutputs.begin(), unspentOutputs.end(), heightSort);
+    }
 
     UniValue utxos(UniValue::VARR);
 
@@ -650,13 +803,18 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp)
         utxos.push_back(output);
     }
 
-    if (includeChainInfo) {
+    if (includeChainInfo || paged) {
         UniValue result(UniValue::VOBJ);
         result.push_back(Pair("utxos", utxos));
+        if (!cursor.empty()) {
+            result.push_back(Pair("cursor", cursor));
+        }
 
-        LOCK(cs_main);
-        result.push_back(Pair("hash", chainActive.Tip()->GetBlockHash().GetHex()));
-        result.push_back(Pair("height", (int)chainActive.Height()));
+        if (includeChainInfo) {
+            LOCK(cs_main);
+            result.push_back(Pair("hash", chainActive.Tip()->GetBlockHash().GetHex()));
+            result.push_back(Pair("height", (int)chainActive.Height()));
+        }
         return result;
     } else {
         return utxos;
@@ -679,8 +837,10 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
             "  \"start\" (number) The start block height\n"
             "  \"end\" (number) The end block height\n"
             "  \"chainInfo\" (boolean) Include chain info in results, only applies if start and end specified\n"
+            "  \"limit\" (number, optional) Return at most this many deltas\n"
+            "  \"cursor\" (string, optional) The cursor returned with the previous page\n"
             "}\n"
-            "\nResult:\n"
+            "\nResult (with \"limit\", the deltas are returned in \"deltas\" together with the \"cursor\" of the next page, if any):\n"
             "[\n"
             "  {\n"
             "    \"satoshis\"  (number) The difference of satoshis\n"
@@ -705,6 +865,8 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
         includeChainInfo = chainInfo.get_bool();
     }
 
+    EnsureIndexBuilt("addressindex");
+
     int start = 0;
     int end = 0;
 
@@ -725,18 +887,16 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
+    size_t limit = 0;
+    std::string cursor;
+    bool paged = getPageFromParams(params, limit, cursor);
+
     std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
 
-    for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (start > 0 && end > 0) {
-            if (!GetAddressIndex((*it).first, (*it).second, addressIndex, start, end)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-            }
-        } else {
-            if (!GetAddressIndex((*it).first, (*it).second, addressIndex)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-            }
-        }
+    if (paged) {
+        cursor = getAddressIndexPage(addresses, start, end, limit, cursor, addressIndex);
+    } else {
+        getAddressIndexMerged(addresses, start, end, addressIndex);
     }
 
     UniValue deltas(UniValue::VARR);
@@ -779,9 +939,18 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
         endInfo.push_back(Pair("height", end));
 
         result.push_back(Pair("deltas", deltas));
+        if (!cursor.empty()) {
+            result.push_back(Pair("cursor", cursor));
+        }
         result.push_back(Pair("start", startInfo));
         result.push_back(Pair("end", endInfo));
 
+        return result;
+    } else if (paged) {
+        result.push_back(Pair("deltas", deltas));
+        if (!cursor.empty()) {
+            result.push_back(Pair("cursor", cursor));
+        }
         return result;
     } else {
         return deltas;
@@ -806,6 +975,7 @@ UniValue getaddressbalance(const UniValue& params, bool fHelp)
             "{\n"
             "  \"balance\"  (string) The current balance in satoshis\n"
             "  \"received\"  (string) The total number of satoshis received (including change)\n"
+            "  \"txcount\"  (numeric) The number of transactions involving the address, summed over all addresses\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getaddressbalance", "'{\"addresses\": [\"12c6DSiU4Rq3P4ZxziKxzrL5LmMBrzjrJX\"]}'")
@@ -818,27 +988,26 @@ UniValue getaddressbalance(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
-    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
-
-    for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (!GetAddressIndex((*it).first, (*it).second, addressIndex)) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-        }
-    }
+    EnsureIndexBuilt("addressindex");
 
     CAmount balance = 0;
     CAmount received = 0;
+    int64_t txCount = 0;
 
-    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=addressIndex.begin(); it!=addressIndex.end(); it++) {
-        if (it->second > 0) {
-            received += it->second;
+    for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
+        CAddressBalanceValue value;
+        if (!GetAddressBalance((*it).first, (*it).second, value)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
         }
-        balance += it->second;
+        balance += value.balance;
+        received += value.received;
+        txCount += value.txCount;
     }
 
     UniValue result(UniValue::VOBJ);
     result.push_back(Pair("balance", balance));
     result.push_back(Pair("received", received));
+    result.push_back(Pair("txcount", txCount));
 
     return result;
 
@@ -859,8 +1028,10 @@ UniValue getaddresstxids(const UniValue& params, bool fHelp)
             "    ]\n"
             "  \"start\" (number) The start block height\n"
             "  \"end\" (number) The end block height\n"
+            "  \"limit\" (number, optional) Read at most this many index entries; a page may hold fewer txids\n"
+            "  \"cursor\" (string, optional) The cursor returned with the previous page\n"
             "}\n"
-            "\nResult:\n"
+            "\nResult (with \"limit\", the ids are returned in \"txids\" together with the \"cursor\" of the next page, if any):\n"
             "[\n"
             "  \"transactionid\"  (string) The transaction id\n"
             "  ,...\n"
@@ -876,6 +1047,8 @@ UniValue getaddresstxids(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
+    EnsureIndexBuilt("addressindex");
+
     int start = 0;
     int end = 0;
     if (params[0].isObject()) {
@@ -887,50 +1060,77 @@ UniValue getaddresstxids(const UniValue& params, bool fHelp)
         }
     }
 
-    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
-
-    for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (start > 0 && end > 0) {
-            if (!GetAddressIndex((*it).first, (*it).second, addressIndex, start, end)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-            }
-        } else {
-            if (!GetAddressIndex((*it).first, (*it).second, addressIndex)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-            }
-        }
+    size_t limit = 0;
+    std::string cursor;
+    bool paged = getPageFromParams(params, limit, cursor);
+
+    // Entries of one transaction are adjacent in the merged order. When
+    // continuing a page, skip the rest of the one the previous page ended with.
+    uint256 lastTxid;
+    if (paged && !cursor.empty()) {
+        uint32_t addressPos;
+        CAddressIndexKey after;
+        decodeAddressCursor(cursor, addresses, addressPos, after);
+        lastTxid = after.txhash;
     }
 
-    std::set<std::pair<int, std::string> > txids;
-    UniValue result(UniValue::VARR);
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    if (paged) {
+        cursor = getAddressIndexPage(addresses, start, end, limit, cursor, addressIndex);
+    } else {
+        getAddressIndexMerged(addresses, start, end, addressIndex);
+    }
 
+    UniValue txids(UniValue::VARR);
     for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=addressIndex.begin(); it!=addressIndex.end(); it++) {
-        int height = it->first.blockHeight;
-        std::string txid = it->first.txhash.GetHex();
-
-        if (addresses.size() > 1) {
-            txids.insert(std::make_pair(height, txid));
-        } else {
-            if (txids.insert(std::make_pair(height, txid)).second) {
-                result.push_back(txid);
-            }
+        if (it->first.txhash == lastTxid) {
+            continue;
         }
+        lastTxid = it->first.txhash;
+        txids.push_back(lastTxid.GetHex());
     }
 
-    if (addresses.size() > 1) {
-        for (std::set<std::pair<int, std::string> >::const_iterator it=txids.begin(); it!=txids.end(); it++) {
-            result.push_back(it->second);
-        }
+    if (!paged) {
+        return txids;
     }
 
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("txids", txids));
+    if (!cursor.empty()) {
+        result.push_back(Pair("cursor", cursor));
+    }
     return result;
 
 }
 
+static CSpentIndexKey getSpentIndexKey(const UniValue& request)
+{
+    if (!request.isObject())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Expected an object with txid and index");
+
+    UniValue txidValue = find_value(request.get_obj(), "txid");
+    UniValue indexValue = find_value(request.get_obj(), "index");
+
+    if (!txidValue.isStr() || !indexValue.isNum()) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid txid or index");
+    }
+
+    return CSpentIndexKey(ParseHashV(txidValue, "txid"), indexValue.get_int());
+}
+
+static UniValue spentInfoToJSON(const CSpentIndexValue& value)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("txid", value.txid.GetHex()));
+    obj.push_back(Pair("index", (int)value.inputIndex));
+    obj.push_back(Pair("height", value.blockHeight));
+    return obj;
+}
+
 UniValue getspentinfo(const UniValue& params, bool fHelp)
 {
 
-    if (fHelp || params.size() != 1 || !params[0].isObject())
+    if (fHelp || params.size() != 1 || !(params[0].isObject() || params[0].isArray()))
         throw runtime_error(
             "getspentinfo\n"
             "\nReturns the txid and index where an output is spent.\n"
@@ -939,44 +1139,173 @@ UniValue getspentinfo(const UniValue& params, bool fHelp)
             "  \"txid\" (string) The hex string of the txid\n"
             "  \"index\" (number) The start block height\n"
             "}\n"
+            "or an array of such objects to look up many outputs at once.\n"
             "\nResult:\n"
             "{\n"
             "  \"txid\"  (string) The transaction id\n"
             "  \"index\"  (number) The spending input index\n"
             "  ,...\n"
             "}\n"
+            "For an array, an array with one such object per output, or null for\n"
+            "outputs that are not spent.\n"
             "\nExamples:\n"
             + HelpExampleCli("getspentinfo", "'{\"txid\": \"0437cd7f8525ceed2324359c2d0ba26006d92d856a9c20fa0241106ee5a597c9\", \"index\": 0}'")
             + HelpExampleRpc("getspentinfo", "{\"txid\": \"0437cd7f8525ceed2324359c2d0ba26006d92d856a9c20fa0241106ee5a597c9\", \"index\": 0}")
+            + HelpExampleCli("getspentinfo", "'[{\"txid\": \"0437cd7f8525ceed2324359c2d0ba26006d92d856a9c20fa0241106ee5a597c9\", \"index\": 0}, {\"txid\": \"0437cd7f8525ceed2324359c2d0ba26006d92d856a9c20fa0241106ee5a597c9\", \"index\": 1}]'")
         );
 
-    UniValue txidValue = find_value(params[0].get_obj(), "txid");
-    UniValue indexValue = find_value(params[0].get_obj(), "index");
+    EnsureIndexBuilt("spentindex");
 
-    if (!txidValue.isStr() || !indexValue.isNum()) {
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid txid or index");
-    }
+    if (params[0].isObject()) {
+        CSpentIndexKey key = getSpentIndexKey(params[0]);
+        CSpentIndexValue value;
 
-    uint256 txid = ParseHashV(txidValue, "txid");
-    int outputIndex = indexValue.get_int();
+        if (!GetSpentIndex(key, value)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unable to get spent info");
+        }
 
-    CSpentIndexKey key(txid, outputIndex);
-    CSpentIndexValue value;
+        return spentInfoToJSON(value);
+    }
 
-    if (!GetSpentIndex(key, value)) {
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unable to get spent info");
+    const std::vector<UniValue>& requests = params[0].getValues();
+    std::vector<CSpentIndexKey> keys;
+    keys.reserve(requests.size());
+    for (std::vector<UniValue>::const_iterator it = requests.begin(); it != requests.end(); it++) {
+        keys.push_back(getSpentIndexKey(*it));
     }
 
-    UniValue obj(UniValue::VOBJ);
-    obj.push_back(Pair("txid", value.txid.GetHex()));
-    obj.push_back(Pair("index", (int)value.inputIndex));
-    obj.push_back(Pair("height", value.blockHeight));
+    UniValue result(UniValue::VARR);
+    for (std::vector<CSpentIndexKey>::iterator it = keys.begin(); it != keys.end(); it++) {
+        CSpentIndexValue value;
+        if (GetSpentIndex(*it, value)) {
+            result.push_back(spentInfoToJSON(value));
+        } else {
+            result.push_back(NullUniValue);
+        }
+    }
 
-    return obj;
+    return result;
 }
 
 
 
+UniValue getflaggedtxids(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1 || !params[0].isObject())
+        throw runtime_error(
+            "getflaggedtxids\n"
+            "\nReturns the transactions with an age-verification flag set (requires flagindex to be enabled).\n"
+            "\nArguments:\n"
+            "{\n"
+            "  \"flag\" (string or number) consent, over18, over21, a TX_F_ flag name or the value of one flag\n"
+            "  \"start\" (number, optional) The start block height\n"
+            "  \"end\" (number, optional) The end block height\n"
+            "  \"addresses\" (array, optional) Only transactions of these addresses (requires addressindex)\n"
+            "    [\n"
+            "      \"address\"  (string) The base58check encoded address\n"
+            "      ,...\n"
+            "    ]\n"
+            "  \"mempool\" (boolean, optional, default=false) Also return transactions in the mempool\n"
+            "}\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"txid\"  (string) The transaction id\n"
+            "    \"height\"  (number) The block height, for transactions in a block\n"
+            "    \"timestamp\"  (number) The time it entered the mempool, for transactions in the mempool\n"
+            "    \"flags\"  (number) All age-verification flags of the transaction\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getflaggedtxids", "'{\"flag\": \"over18\", \"start\": 1000, \"end\": 2000}'")
+            + HelpExampleRpc("getflaggedtxids", "{\"flag\": \"over18\", \"start\": 1000, \"end\": 2000}")
+        );
+
+    const UniValue& request = params[0].get_obj();
+
+    uint16_t flag = 0;
+    const UniValue& flagValue = find_value(request, "flag");
+    if (!(flagValue.isStr() && ParseFlagIndexFlag(flagValue.get_str(), flag)) &&
+        !(flagValue.isNum() && ParseFlagIndexFlag(flagValue.getValStr(), flag))) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid flag (valid values are: consent, over18, over21, a TX_F_ flag name or the value of one flag)");
+    }
+
+    EnsureIndexBuilt("flagindex");
+
+    int start = 0;
+    int end = 0;
+    UniValue startValue = find_value(request, "start");
+    UniValue endValue = find_value(request, "end");
+    if (startValue.isNum()) {
+        start = startValue.get_int();
+    }
+    if (endValue.isNum()) {
+        end = endValue.get_int();
+    }
+    const bool fMempool = find_value(request, "mempool").isTrue();
+
+    // With addresses, only the flagged transactions found in their address index
+    const bool fAddresses = !find_value(request, "addresses").isNull();
+    std::set<uint256> addressTxids;
+    if (fAddresses) {
+        std::vector<std::pair<uint160, int> > addresses;
+        if (!getAddressesFromParams(params, addresses)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
+        }
+
+        EnsureIndexBuilt("addressindex");
+
+        std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+        getAddressIndexMerged(addresses, start, end, addressIndex);
+        for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=addressIndex.begin(); it!=addressIndex.end(); it++) {
+            addressTxids.insert(it->first.txhash);
+        }
+
+        if (fMempool) {
+            std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> > indexes;
+            mempool.getAddressIndex(addresses, indexes);
+            for (std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> >::const_iterator it=indexes.begin(); it!=indexes.end(); it++) {
+                addressTxids.insert(it->first.txhash);
+            }
+        }
+    }
+
+    std::vector<std::pair<CFlagIndexKey, CFlagIndexValue> > flagIndex;
+    if (!GetFlagIndex(flag, start, end, flagIndex)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for flag");
+    }
+
+    UniValue result(UniValue::VARR);
+    for (std::vector<std::pair<CFlagIndexKey, CFlagIndexValue> >::const_iterator it=flagIndex.begin(); it!=flagIndex.end(); it++) {
+        if (fAddresses && !addressTxids.count(it->first.txhash)) {
+            continue;
+        }
+        UniValue item(UniValue::VOBJ);
+        item.push_back(Pair("txid", it->first.txhash.GetHex()));
+        item.push_back(Pair("height", it->first.blockHeight));
+        item.push_back(Pair("flags", (int)it->second.flags));
+        result.push_back(item);
+    }
+
+    if (fMempool) {
+        std::vector<CMempoolFlagEntry> entries;
+        mempool.getFlagIndex(flag, entries);
+        for (std::vector<CMempoolFlagEntry>::const_iterator it=entries.begin(); it!=entries.end(); it++) {
+            if (fAddresses && !addressTxids.count(it->txhash)) {
+                continue;
+            }
+            UniValue item(UniValue::VOBJ);
+            item.push_back(Pair("txid", it->txhash.GetHex()));
+            item.push_back(Pair("timestamp", it->time));
+            item.push_back(Pair("flags", (int)it->flags));
+            result.push_back(item);
+        }
+    }
+
+    return result;
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         okSafeMode
   //  --------------------- ------------------------  -----------------------  ----------
@@ -996,6 +1325,9 @@ static const CRPCCommand commands[] =
     /* Blockchain */
     { "blockchain",         "getspentinfo",           &getspentinfo,           false },
 
+    /* Flag index */
+    { "flagindex",          "getflaggedtxids",        &getflaggedtxids,        false },
+
     /* Not shown in help */
     { "hidden",             "setmocktime",            &setmocktime,            true  },
 };
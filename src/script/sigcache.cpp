@@ -5,7 +5,10 @@
 
 #include "sigcache.h"
 
+#include "crypto/common.h"
+#include "cuckoocache.h"
 #include "memusage.h"
+#include "primitives/transaction.h"
 #include "pubkey.h"
 #include "random.h"
 #include "uint256.h"
@@ -16,18 +19,6 @@
 
 namespace {
 
-/**
- * We're hashing a nonce into the entries themselves, so we don't need extra
- * blinding in the set hash computation.
- */
-class CSignatureCacheHasher
-{
-public:
-    size_t operator()(const uint256& key) const {
-        return key.GetCheapHash();
-    }
-};
-
 /**
  * Valid signature cache, to avoid doing expensive ECDSA signature checking
  * twice for every transaction (once when accepted into memory pool, and
@@ -38,10 +29,7 @@ class CSignatureCache
 private:
      //! Entries are SHA256(nonce || signature hash || public key || signature):
     uint256 nonce;
-    typedef boost::unordered_set<uint256, CSignatureCacheHasher> map_type;
-    map_type setValid;
-    boost::shared_mutex cs_sigcache;
-
+    CCuckooCache setValid;
 
 public:
     CSignatureCache()
@@ -56,52 +44,47 @@ public:
     }
 
     bool
-    Get(const uint256& entry)
+    Get(const uint256& entry, bool fErase)
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
-        return setValid.count(entry);
+        return setValid.Contains(entry, fErase);
     }
 
-    void Erase(const uint256& entry)
+    void Set(const uint256& entry)
     {
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        setValid.erase(entry);
+        setValid.Insert(entry);
     }
 
-    void Set(const uint256& entry)
+    size_t Setup(size_t nBytes)
     {
-        size_t nMaxCacheSize = GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
-        if (nMaxCacheSize <= 0) return;
-
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        while (memusage::DynamicUsage(setValid) > nMaxCacheSize)
-        {
-            map_type::size_type s = GetRand(setValid.bucket_count());
-            map_type::local_iterator it = setValid.begin(s);
-            if (it != setValid.end(s)) {
-                setValid.erase(*it);
-            }
-        }
+        return setValid.Setup(nBytes);
+    }
 
-        setValid.insert(entry);
+    size_t DynamicMemoryUsage() const
+    {
+        return setValid.DynamicMemoryUsage();
     }
 };
 
+//! Sized by InitSignatureCache(), it caches nothing before that
+CSignatureCache signatureCache;
+
 }
 
-bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+void InitSignatureCache()
 {
-    static CSignatureCache signatureCache;
+    size_t nMaxCacheSize = std::max(GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE), (int64_t)0) * ((size_t) 1 << 20);
+    size_t nEntries = signatureCache.Setup(nMaxCacheSize);
+    LogPrintf("* Using %.1fMiB for signature cache, able to store %u entries\n",
+              signatureCache.DynamicMemoryUsage() * (1.0 / 1024 / 1024), nEntries);
+}
 
+bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+{
     uint256 entry;
     signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
 
-    if (signatureCache.Get(entry)) {
-        if (!store) {
-            signatureCache.Erase(entry);
-        }
+    if (signatureCache.Get(entry, !store))
         return true;
-    }
 
     if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
         return false;
@@ -111,3 +94,88 @@ bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsig
     }
     return true;
 }
+
+CScriptExecutionCache scriptExecutionCache;
+
+CScriptExecutionCache::CScriptExecutionCache() : nMaxSize((size_t)DEFAULT_MAX_SCRIPT_CACHE_SIZE << 20), nHits(0), nMisses(0)
+{
+    GetRandBytes(nonce.begin(), 32);
+}
+
+void CScriptExecutionCache::ComputeEntry(uint256& entry, const CTransaction& tx, unsigned int flags) const
+{
+    uint256 wtxid = tx.GetWitnessHash();
+    unsigned char vchFlags[4];
+    WriteLE32(vchFlags, flags);
+    CSHA256().Write(nonce.begin(), 32).Write(wtxid.begin(), 32).Write(vchFlags, sizeof(vchFlags)).Finalize(entry.begin());
+}
+
+bool CScriptExecutionCache::Get(const uint256& entry, bool fErase)
+{
+    if (!fErase) {
+        boost::shared_lock<boost::shared_mutex> lock(cs);
+        return setValid.count(entry);
+    }
+
+    boost::unique_lock<boost::shared_mutex> lock(cs);
+    if (setValid.erase(entry)) {
+        nHits++;
+        return true;
+    }
+    nMisses++;
+    return false;
+}
+
+void CScriptExecutionCache::Set(const uint256& entry)
+{
+    size_t nMax = nMaxSize;
+    if (nMax == 0)
+        return;
+
+    boost::unique_lock<boost::shared_mutex> lock(cs);
+    while (memusage::DynamicUsage(setValid) > nMax && !setValid.empty())
+    {
+        map_type::size_type s = GetRand(setValid.bucket_count());
+        map_type::local_iterator it = setValid.begin(s);
+        if (it != setValid.end(s)) {
+            setValid.erase(*it);
+        }
+    }
+
+    setValid.insert(entry);
+}
+
+void CScriptExecutionCache::SetMaxSize(size_t nMaxSizeIn)
+{
+    boost::unique_lock<boost::shared_mutex> lock(cs);
+    nMaxSize = nMaxSizeIn;
+    if (nMaxSize == 0)
+        setValid.clear();
+}
+
+size_t CScriptExecutionCache::Size() const
+{
+    boost::shared_lock<boost::shared_mutex> lock(cs);
+    return setValid.size();
+}
+
+size_t CScriptExecutionCache::DynamicMemoryUsage() const
+{
+    boost::shared_lock<boost::shared_mutex> lock(cs);
+    return memusage::DynamicUsage(setValid);
+}
+
+size_t CScriptExecutionCache::MaxSize() const
+{
+    return nMaxSize;
+}
+
+uint64_t CScriptExecutionCache::Hits() const
+{
+    return nHits;
+}
+
+uint64_t CScriptExecutionCache::Misses() const
+{
+    return nMisses;
+}
@@ -7,15 +7,27 @@
 #define BITCOIN_SCRIPT_SIGCACHE_H
 
 #include "script/interpreter.h"
+#include "uint256.h"
 
+#include <stdint.h>
+
+#include <atomic>
 #include <vector>
 
-// DoS prevention: limit cache size to less than 40MB (over 500000
-// entries on 64-bit systems).
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/unordered_set.hpp>
+
+// DoS prevention: limit cache size to 40MB (over a million entries of
+// 32 bytes plus their generation).
 static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 40;
+//! Default for -maxscriptcachesize, the script execution cache size in MiB
+static const unsigned int DEFAULT_MAX_SCRIPT_CACHE_SIZE = 8;
 
 class CPubKey;
 
+/** Size the signature cache from -maxsigcachesize, dropping its entries */
+void InitSignatureCache();
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
@@ -27,4 +39,52 @@ public:
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
 
+/**
+ * Cache of transactions whose inputs all passed script verification with a
+ * given set of flags, so that transactions already checked on their way into
+ * the memory pool skip script interpretation entirely when a block containing
+ * them is connected. Entries are SHA256(nonce || wtxid || flags).
+ */
+class CScriptExecutionCache
+{
+private:
+    class CEntryHasher
+    {
+    public:
+        size_t operator()(const uint256& key) const {
+            return key.GetCheapHash();
+        }
+    };
+    typedef boost::unordered_set<uint256, CEntryHasher> map_type;
+
+    uint256 nonce;
+    map_type setValid;
+    mutable boost::shared_mutex cs;
+    std::atomic<size_t> nMaxSize;
+    std::atomic<uint64_t> nHits;
+    std::atomic<uint64_t> nMisses;
+
+public:
+    CScriptExecutionCache();
+
+    void ComputeEntry(uint256& entry, const CTransaction& tx, unsigned int flags) const;
+
+    /**
+     * Look up an entry. Lookups that erase the entry are those of block
+     * connection, which consume it; only those count as hits or misses.
+     */
+    bool Get(const uint256& entry, bool fErase);
+    void Set(const uint256& entry);
+    void SetMaxSize(size_t nMaxSizeIn);
+
+    size_t Size() const;
+    size_t DynamicMemoryUsage() const;
+    size_t MaxSize() const;
+    uint64_t Hits() const;
+    uint64_t Misses() const;
+};
+
+/** Global cache of fully verified transactions. */
+extern CScriptExecutionCache scriptExecutionCache;
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
@@ -0,0 +1,186 @@
+// Copyright (c) 2016 The Sexcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include <assert.h>
+#include <stddef.h>
+
+#include <list>
+#include <new>
+#include <vector>
+
+/**
+ * Memory resource that hands out small blocks carved from large chunks.
+ *
+ * Blocks of up to MAX_BLOCK_SIZE_BYTES are rounded up to a multiple of
+ * ALIGN_BYTES. Freed blocks go onto a free list for their size and are
+ * handed out again before any new chunk memory is used; chunks themselves
+ * are only returned to the system when the resource is destroyed. Larger
+ * blocks, or blocks with a stricter alignment, fall back to operator new.
+ *
+ * This suits node based containers such as unordered maps: every node gets
+ * the same size, there is no per-node malloc overhead or fragmentation, and
+ * the memory used is exactly the number of chunks times the chunk size.
+ */
+template <size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES>
+class PoolResource
+{
+    static_assert(ALIGN_BYTES > 0 && (ALIGN_BYTES & (ALIGN_BYTES - 1)) == 0, "ALIGN_BYTES must be a power of two");
+    static_assert(MAX_BLOCK_SIZE_BYTES % ALIGN_BYTES == 0, "MAX_BLOCK_SIZE_BYTES must be a multiple of ALIGN_BYTES");
+
+    /** Free blocks are linked through their own first bytes */
+    struct ListNode
+    {
+        ListNode* m_next;
+
+        explicit ListNode(ListNode* next) : m_next(next) {}
+    };
+    static_assert(ALIGN_BYTES >= sizeof(ListNode) && ALIGN_BYTES % alignof(ListNode) == 0, "ALIGN_BYTES too small to link free blocks");
+
+    const size_t m_chunk_size_bytes;
+
+    /** All chunks, freed when the resource is destroyed */
+    std::list<char*> m_allocated_chunks;
+
+    /** Free lists by block size in units of ALIGN_BYTES */
+    std::vector<ListNode*> m_free_lists;
+
+    /** Unused memory at the end of the newest chunk */
+    char* m_available_memory_it;
+    char* m_available_memory_end;
+
+    static size_t NumElemAlignBytes(size_t bytes)
+    {
+        return (bytes + ALIGN_BYTES - 1) / ALIGN_BYTES + (bytes == 0);
+    }
+
+    static bool IsFreeListUsable(size_t bytes, size_t alignment)
+    {
+        return alignment <= ALIGN_BYTES && bytes <= MAX_BLOCK_SIZE_BYTES;
+    }
+
+    void PlacementAddToList(void* p, ListNode*& node)
+    {
+        node = new (p) ListNode(node);
+    }
+
+    void AllocateChunk()
+    {
+        // Keep the rest of the current chunk as a free block, it is
+        // always a multiple of ALIGN_BYTES below MAX_BLOCK_SIZE_BYTES.
+        const size_t remaining_available_bytes = m_available_memory_end - m_available_memory_it;
+        if (remaining_available_bytes)
+            PlacementAddToList(m_available_memory_it, m_free_lists[remaining_available_bytes / ALIGN_BYTES]);
+
+        m_available_memory_it = static_cast<char*>(::operator new(m_chunk_size_bytes));
+        m_available_memory_end = m_available_memory_it + m_chunk_size_bytes;
+        m_allocated_chunks.push_back(m_available_memory_it);
+    }
+
+    PoolResource(const PoolResource&);
+    PoolResource& operator=(const PoolResource&);
+
+public:
+    explicit PoolResource(size_t chunk_size_bytes) :
+        m_chunk_size_bytes(NumElemAlignBytes(chunk_size_bytes) * ALIGN_BYTES),
+        m_free_lists(MAX_BLOCK_SIZE_BYTES / ALIGN_BYTES + 1, NULL),
+        m_available_memory_it(NULL), m_available_memory_end(NULL)
+    {
+        assert(m_chunk_size_bytes >= MAX_BLOCK_SIZE_BYTES);
+        AllocateChunk();
+    }
+
+    /** 256 KiB chunks */
+    PoolResource() : PoolResource(1 << 18) {}
+
+    ~PoolResource()
+    {
+        for (std::list<char*>::iterator it = m_allocated_chunks.begin(); it != m_allocated_chunks.end(); ++it)
+            ::operator delete(*it);
+    }
+
+    void* Allocate(size_t bytes, size_t alignment)
+    {
+        if (!IsFreeListUsable(bytes, alignment))
+            return ::operator new(bytes);
+
+        const size_t num_alignments = NumElemAlignBytes(bytes);
+        if (m_free_lists[num_alignments] != NULL) {
+            ListNode* node = m_free_lists[num_alignments];
+            m_free_lists[num_alignments] = node->m_next;
+            return node;
+        }
+
+        const size_t round_bytes = num_alignments * ALIGN_BYTES;
+        if (round_bytes > size_t(m_available_memory_end - m_available_memory_it))
+            AllocateChunk();
+        void* p = m_available_memory_it;
+        m_available_memory_it += round_bytes;
+        return p;
+    }
+
+    void Deallocate(void* p, size_t bytes, size_t alignment)
+    {
+        if (IsFreeListUsable(bytes, alignment)) {
+            PlacementAddToList(p, m_free_lists[NumElemAlignBytes(bytes)]);
+        } else {
+            ::operator delete(p);
+        }
+    }
+
+    size_t NumAllocatedChunks() const { return m_allocated_chunks.size(); }
+    size_t ChunkSizeBytes() const { return m_chunk_size_bytes; }
+};
+
+/** Allocator that takes its memory from a PoolResource, which must outlive it */
+template <typename T, size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES = alignof(void*)>
+class PoolAllocator
+{
+public:
+    typedef T value_type;
+    typedef PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> ResourceType;
+
+    template <typename U>
+    struct rebind {
+        typedef PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> other;
+    };
+
+    PoolAllocator(ResourceType* resource) : m_resource(resource) {}
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& other) : m_resource(other.resource()) {}
+
+    T* allocate(size_t n)
+    {
+        if (n > size_t(-1) / sizeof(T))
+            throw std::bad_alloc();
+        return static_cast<T*>(m_resource->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        m_resource->Deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    ResourceType* resource() const { return m_resource; }
+
+private:
+    ResourceType* m_resource;
+};
+
+template <typename T, typename U, size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES>
+bool operator==(const PoolAllocator<T, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a, const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b)
+{
+    return a.resource() == b.resource();
+}
+
+template <typename T, typename U, size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES>
+bool operator!=(const PoolAllocator<T, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a, const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b)
+{
+    return !(a == b);
+}
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_POOL_H
@@ -0,0 +1,526 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addressindex.h"
+#include "flagindex.h"
+#include "random.h"
+#include "txdb.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(addressindex_tests, BasicTestingSetup)
+
+typedef std::vector<std::pair<CAddressIndexKey, CAmount> > AddressIndexEntries;
+typedef std::vector<std::pair<CFlagIndexKey, CFlagIndexValue> > FlagIndexEntries;
+
+/** Write the buffered index records, as a flush of the chain state does */
+static void FlushIndexCache(CBlockTreeDB& db)
+{
+    std::vector<std::pair<int, const CBlockFileInfo*> > files;
+    std::vector<const CBlockIndex*> blocks;
+    BOOST_CHECK(db.WriteBatchSync(files, 0, blocks, std::map<uint256, std::shared_ptr<CAuxPow> >(), true));
+}
+
+static void CheckBalance(CBlockTreeDB& db, const uint160& hash, CAmount balance, CAmount received, int64_t txCount)
+{
+    CAddressBalanceValue value;
+    if (txCount == 0) {
+        BOOST_CHECK(!db.ReadAddressBalance(hash, 1, value));
+        return;
+    }
+    BOOST_CHECK(db.ReadAddressBalance(hash, 1, value));
+    BOOST_CHECK_EQUAL(value.balance, balance);
+    BOOST_CHECK_EQUAL(value.received, received);
+    BOOST_CHECK_EQUAL(value.txCount, txCount);
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_balance_connect_disconnect)
+{
+    CBlockTreeDB db(1 << 20, true);
+    uint160 addrA = uint160(std::vector<unsigned char>(20, 0xaa));
+    uint160 addrB = uint160(std::vector<unsigned char>(20, 0xbb));
+    uint256 tx1 = GetRandHash(), tx2 = GetRandHash(), tx3 = GetRandHash();
+
+    // Block 1: tx1 pays A twice and B once
+    AddressIndexEntries block1;
+    block1.push_back(std::make_pair(CAddressIndexKey(1, addrA, 1, 0, tx1, 0, false), 50));
+    block1.push_back(std::make_pair(CAddressIndexKey(1, addrB, 1, 0, tx1, 1, false), 20));
+    block1.push_back(std::make_pair(CAddressIndexKey(1, addrA, 1, 0, tx1, 2, false), 30));
+    BOOST_CHECK(db.WriteAddressIndex(block1));
+    CheckBalance(db, addrA, 80, 80, 1);
+    CheckBalance(db, addrB, 20, 20, 1);
+
+    // Block 2: tx2 spends A's first output back to A and B, tx3 pays B
+    AddressIndexEntries block2;
+    block2.push_back(std::make_pair(CAddressIndexKey(1, addrA, 2, 1, tx2, 0, true), -50));
+    block2.push_back(std::make_pair(CAddressIndexKey(1, addrA, 2, 1, tx2, 0, false), 15));
+    block2.push_back(std::make_pair(CAddressIndexKey(1, addrB, 2, 1, tx2, 1, false), 35));
+    block2.push_back(std::make_pair(CAddressIndexKey(1, addrB, 2, 2, tx3, 0, false), 7));
+    BOOST_CHECK(db.WriteAddressIndex(block2));
+    CheckBalance(db, addrA, 45, 95, 2);
+    CheckBalance(db, addrB, 62, 62, 3);
+
+    // Disconnecting restores the totals, and removes records that drop to zero
+    BOOST_CHECK(db.EraseAddressIndex(block2));
+    CheckBalance(db, addrA, 80, 80, 1);
+    CheckBalance(db, addrB, 20, 20, 1);
+    BOOST_CHECK(db.EraseAddressIndex(block1));
+    CheckBalance(db, addrA, 0, 0, 0);
+    CheckBalance(db, addrB, 0, 0, 0);
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_balance_upgrade)
+{
+    CBlockTreeDB db(1 << 20, true);
+    uint160 addrA = uint160(std::vector<unsigned char>(20, 0xaa));
+    uint160 addrB = uint160(std::vector<unsigned char>(20, 0xbb));
+    uint256 tx1 = GetRandHash(), tx2 = GetRandHash();
+
+    AddressIndexEntries block1, block2;
+    block1.push_back(std::make_pair(CAddressIndexKey(1, addrA, 1, 0, tx1, 0, false), 50));
+    block1.push_back(std::make_pair(CAddressIndexKey(1, addrB, 1, 0, tx1, 1, false), 20));
+    block2.push_back(std::make_pair(CAddressIndexKey(1, addrA, 2, 0, tx2, 0, true), -50));
+    block2.push_back(std::make_pair(CAddressIndexKey(1, addrA, 2, 0, tx2, 0, false), 45));
+    BOOST_CHECK(db.WriteAddressIndex(block1));
+    BOOST_CHECK(db.WriteAddressIndex(block2));
+
+    // A database from before the balance records: the rebuild from the
+    // address index must give the same totals as the incremental updates
+    BOOST_CHECK(db.EraseAddressBalances());
+    CheckBalance(db, addrA, 0, 0, 0);
+    BOOST_CHECK(db.WriteFlag("addressbalance", false));
+    BOOST_CHECK(db.UpgradeAddressBalances());
+    CheckBalance(db, addrA, 45, 95, 2);
+    CheckBalance(db, addrB, 20, 20, 1);
+
+    bool fBalances = false;
+    BOOST_CHECK(db.ReadFlag("addressbalance", fBalances) && fBalances);
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_read_pages)
+{
+    CBlockTreeDB db(1 << 20, true);
+    uint160 addrA = uint160(std::vector<unsigned char>(20, 0xaa));
+    uint160 addrB = uint160(std::vector<unsigned char>(20, 0xbb));
+
+    AddressIndexEntries entries;
+    for (int i = 1; i <= 10; i++) {
+        entries.push_back(std::make_pair(CAddressIndexKey(1, addrA, i, 0, GetRandHash(), 0, false), i));
+        entries.push_back(std::make_pair(CAddressIndexKey(1, addrB, i, 0, GetRandHash(), 0, false), i));
+    }
+    BOOST_CHECK(db.WriteAddressIndex(entries));
+
+    // Walk through the history of A in pages of three
+    AddressIndexEntries all, page;
+    BOOST_CHECK(db.ReadAddressIndex(addrA, 1, page, 0, 0, NULL, 3));
+    while (!page.empty()) {
+        BOOST_CHECK(page.size() <= 3);
+        all.insert(all.end(), page.begin(), page.end());
+        CAddressIndexKey after = page.back().first;
+        page.clear();
+        BOOST_CHECK(db.ReadAddressIndex(addrA, 1, page, 0, 0, &after, 3));
+    }
+    BOOST_CHECK_EQUAL(all.size(), 10U);
+    for (int i = 0; i < 10; i++) {
+        BOOST_CHECK(all[i].first.hashBytes == addrA);
+        BOOST_CHECK_EQUAL(all[i].first.blockHeight, i + 1);
+    }
+
+    // A page continues behind the cursor and still stops at the end height
+    page.clear();
+    CAddressIndexKey afterB = CAddressIndexKey(1, addrB, 4, 0, uint256(), 0, false);
+    BOOST_CHECK(db.ReadAddressIndex(addrB, 1, page, 2, 6, &afterB, 0));
+    BOOST_CHECK_EQUAL(page.size(), 3U);
+    BOOST_CHECK_EQUAL(page.front().first.blockHeight, 4);
+    BOOST_CHECK_EQUAL(page.back().first.blockHeight, 6);
+}
+
+struct CAddressIndexCollect
+{
+    AddressIndexEntries &entries;
+    size_t nMax;
+    CAddressIndexCollect(AddressIndexEntries &entriesIn, size_t nMaxIn) : entries(entriesIn), nMax(nMaxIn) {}
+    bool operator()(const CAddressIndexKey &key, CAmount value) {
+        entries.push_back(std::make_pair(key, value));
+        return nMax == 0 || entries.size() < nMax;
+    }
+};
+
+BOOST_AUTO_TEST_CASE(addressindex_read_merged)
+{
+    CBlockTreeDB db(1 << 20, true);
+    std::vector<std::pair<uint160, int> > addresses;
+    for (int i = 0; i < 5; i++)
+        addresses.push_back(std::make_pair(uint160(std::vector<unsigned char>(20, 0x10 + i)), 1 + i % 2));
+
+    // Every address gets entries at random heights; some transactions touch several addresses
+    AddressIndexEntries entries;
+    for (int n = 0; n < 200; n++) {
+        int height = 1 + insecure_rand() % 50;
+        uint256 txid = GetRandHash();
+        unsigned int txindex = insecure_rand() % 4;
+        for (size_t i = 0; i < addresses.size(); i++) {
+            if (insecure_rand() % 3 == 0)
+                entries.push_back(std::make_pair(CAddressIndexKey(addresses[i].second, addresses[i].first, height, txindex, txid, n, false), n));
+        }
+    }
+    // An address that is not requested
+    entries.push_back(std::make_pair(CAddressIndexKey(1, uint160(std::vector<unsigned char>(20, 0x01)), 20, 0, GetRandHash(), 0, false), 1));
+    // Some are still buffered, which the reads merge in
+    AddressIndexEntries stored, buffered;
+    for (size_t i = 0; i < entries.size(); i++)
+        (i % 3 == 0 ? buffered : stored).push_back(entries[i]);
+    BOOST_CHECK(db.WriteAddressIndex(stored));
+    db.CacheAddressIndex(buffered, false);
+
+    AddressIndexEntries expected;
+    for (size_t i = 0; i < entries.size() - 1; i++) {
+        if (entries[i].first.blockHeight >= 10 && entries[i].first.blockHeight <= 40)
+            expected.push_back(entries[i]);
+    }
+    std::vector<CAddressIndexKey> expectedKeys;
+    for (size_t i = 0; i < expected.size(); i++)
+        expectedKeys.push_back(expected[i].first);
+    std::sort(expectedKeys.begin(), expectedKeys.end(), CAddressIndexKeyHeightCompare());
+
+    // Duplicate addresses are only read once
+    std::vector<std::pair<uint160, int> > request(addresses);
+    request.push_back(addresses[0]);
+
+    AddressIndexEntries merged;
+    BOOST_CHECK(db.ReadAddressIndexMerged(request, 10, 40, NULL, CAddressIndexCollect(merged, 0)));
+    BOOST_CHECK_EQUAL(merged.size(), expectedKeys.size());
+    for (size_t i = 0; i < merged.size() && i < expectedKeys.size(); i++) {
+        BOOST_CHECK(merged[i].first.txhash == expectedKeys[i].txhash);
+        BOOST_CHECK(merged[i].first.hashBytes == expectedKeys[i].hashBytes);
+    }
+
+    // Reading in pages gives the same sequence
+    AddressIndexEntries paged, page;
+    BOOST_CHECK(db.ReadAddressIndexMerged(request, 10, 40, NULL, CAddressIndexCollect(page, 7)));
+    while (!page.empty()) {
+        paged.insert(paged.end(), page.begin(), page.end());
+        CAddressIndexKey after = page.back().first;
+        page.clear();
+        BOOST_CHECK(db.ReadAddressIndexMerged(request, 10, 40, &after, CAddressIndexCollect(page, 7)));
+    }
+    BOOST_CHECK_EQUAL(paged.size(), merged.size());
+    for (size_t i = 0; i < merged.size() && i < paged.size(); i++)
+        BOOST_CHECK(paged[i].first.txhash == merged[i].first.txhash && paged[i].first.index == merged[i].first.index);
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_build_block)
+{
+    CBlockTreeDB db(1 << 20, true);
+    uint160 addrA = uint160(std::vector<unsigned char>(20, 0xaa));
+    uint256 tx1 = GetRandHash(), block1 = GetRandHash();
+
+    // A block written by the builder moves its position along with the records
+    CIndexBlockUpdate update;
+    update.addressIndex.push_back(std::make_pair(CAddressIndexKey(1, addrA, 1, 0, tx1, 0, false), 50));
+    update.addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(1, addrA, tx1, 0), CAddressUnspentValue(50, CScript(), 1)));
+    BOOST_CHECK(db.WriteIndexBuildBlock("addressindex", block1, update));
+    uint256 hashBest;
+    BOOST_CHECK(db.ReadIndexBuildBest("addressindex", hashBest) && hashBest == block1);
+    CheckBalance(db, addrA, 50, 50, 1);
+
+    // Undoing it in the same way removes them again
+    update.fDisconnect = true;
+    update.addressUnspentIndex[0].second.SetNull();
+    BOOST_CHECK(db.WriteIndexBuildBlock("addressindex", uint256(), update));
+    CheckBalance(db, addrA, 0, 0, 0);
+    AddressIndexEntries entries;
+    BOOST_CHECK(db.ReadAddressIndex(addrA, 1, entries) && entries.empty());
+
+    // Finishing turns the position into the index flag
+    BOOST_CHECK(db.FinishIndexBuild("addressindex", block1));
+    bool fIndex = false;
+    BOOST_CHECK(!db.ReadIndexBuildBest("addressindex", hashBest));
+    BOOST_CHECK(db.ReadFlag("addressindex", fIndex) && fIndex);
+    uint256 hashIndexBest;
+    BOOST_CHECK(db.ReadIndexBest("addressindex", hashIndexBest) && hashIndexBest == block1);
+
+    // Records found at another block than the chain state are built on from there
+    BOOST_CHECK(db.ResumeIndexBuild("addressindex", block1));
+    BOOST_CHECK(db.ReadIndexBuildBest("addressindex", hashBest) && hashBest == block1);
+    BOOST_CHECK(db.ReadFlag("addressindex", fIndex) && !fIndex);
+
+    // Flushes record the block the indexes kept by ConnectBlock are at
+    uint256 block2 = GetRandHash();
+    db.CacheIndexBest("addressindex", block2);
+    FlushIndexCache(db);
+    BOOST_CHECK(db.ReadIndexBest("addressindex", hashIndexBest) && hashIndexBest == block2);
+
+    // Records of an index that was switched off are wiped before a new build
+    update.fDisconnect = false;
+    update.addressUnspentIndex[0].second = CAddressUnspentValue(50, CScript(), 1);
+    BOOST_CHECK(db.WriteAddressIndex(update.addressIndex));
+    BOOST_CHECK(db.UpdateAddressUnspentIndex(update.addressUnspentIndex));
+    BOOST_CHECK(db.WipeAddressIndex());
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspent;
+    BOOST_CHECK(db.ReadAddressIndex(addrA, 1, entries) && entries.empty());
+    BOOST_CHECK(db.ReadAddressUnspentIndex(addrA, 1, unspent) && unspent.empty());
+    CheckBalance(db, addrA, 0, 0, 0);
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_cache)
+{
+    CBlockTreeDB db(1 << 20, true);
+    uint160 addrA = uint160(std::vector<unsigned char>(20, 0xaa));
+    uint256 tx1 = GetRandHash(), tx2 = GetRandHash();
+
+    AddressIndexEntries block1, block2;
+    block1.push_back(std::make_pair(CAddressIndexKey(1, addrA, 1, 0, tx1, 0, false), 50));
+    block2.push_back(std::make_pair(CAddressIndexKey(1, addrA, 2, 0, tx2, 0, true), -50));
+    block2.push_back(std::make_pair(CAddressIndexKey(1, addrA, 2, 0, tx2, 0, false), 45));
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spent;
+    spent.push_back(std::make_pair(CSpentIndexKey(tx1, 0), CSpentIndexValue(tx2, 0, 2, 50, 1, addrA)));
+
+    // Buffered records are visible to point lookups before they are written
+    db.CacheAddressIndex(block1, false);
+    db.CacheAddressIndex(block2, false);
+    db.CacheSpentIndex(spent);
+    CheckBalance(db, addrA, 45, 95, 2);
+    CSpentIndexValue spentValue;
+    BOOST_CHECK(db.ReadSpentIndex(spent[0].first, spentValue) && spentValue.txid == tx2);
+    BOOST_CHECK(db.IndexCacheUsage() > 0);
+
+    // Disconnecting an unwritten block only undoes the buffered changes
+    db.CacheAddressIndex(block2, true);
+    spent[0].second.SetNull();
+    db.CacheSpentIndex(spent);
+    CheckBalance(db, addrA, 50, 50, 1);
+    BOOST_CHECK(!db.ReadSpentIndex(spent[0].first, spentValue));
+
+    // The flush writes everything in one batch with the block index
+    FlushIndexCache(db);
+    BOOST_CHECK_EQUAL(db.IndexCacheUsage(), 0U);
+    CheckBalance(db, addrA, 50, 50, 1);
+    AddressIndexEntries entries;
+    BOOST_CHECK(db.ReadAddressIndex(addrA, 1, entries));
+    BOOST_CHECK_EQUAL(entries.size(), 1U);
+
+    // Range scans apply the buffered records on top of those on disk,
+    // without writing them
+    db.CacheAddressIndex(block2, false);
+    entries.clear();
+    BOOST_CHECK(db.ReadAddressIndex(addrA, 1, entries));
+    BOOST_CHECK_EQUAL(entries.size(), 3U);
+    BOOST_CHECK(db.IndexCacheUsage() > 0);
+    CheckBalance(db, addrA, 45, 95, 2);
+    entries.clear();
+    BOOST_CHECK(db.ReadAddressIndex(addrA, 1, entries, 0, 0, NULL, 2));
+    BOOST_CHECK(entries.size() == 2 && entries[0].first.txhash == tx1 && entries[1].first.txhash == tx2);
+
+    // A buffered erasure hides the record on disk, also within a page
+    db.CacheAddressIndex(block1, true);
+    entries.clear();
+    BOOST_CHECK(db.ReadAddressIndex(addrA, 1, entries, 0, 0, NULL, 2));
+    BOOST_CHECK(entries.size() == 2 && entries[0].first.txhash == tx2 && entries[1].first.txhash == tx2);
+    entries.clear();
+    std::vector<std::pair<uint160, int> > request(1, std::make_pair(addrA, 1));
+    BOOST_CHECK(db.ReadAddressIndexMerged(request, 0, 0, NULL, CAddressIndexCollect(entries, 0)));
+    BOOST_CHECK(entries.size() == 2 && entries[0].first.txhash == tx2 && entries[1].first.txhash == tx2);
+}
+
+BOOST_AUTO_TEST_CASE(spentindex_filter)
+{
+    CBlockTreeDB db(1 << 20, true);
+    uint160 addrA = uint160(std::vector<unsigned char>(20, 0xaa));
+    uint256 tx1 = GetRandHash(), tx2 = GetRandHash(), tx3 = GetRandHash();
+
+    // One record on disk, one still buffered, one added after the filter
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spent1, spent2, spent3;
+    spent1.push_back(std::make_pair(CSpentIndexKey(tx1, 0), CSpentIndexValue(tx2, 0, 2, 50, 1, addrA)));
+    spent2.push_back(std::make_pair(CSpentIndexKey(tx2, 0), CSpentIndexValue(tx3, 0, 3, 40, 1, addrA)));
+    spent3.push_back(std::make_pair(CSpentIndexKey(tx3, 1), CSpentIndexValue(tx1, 0, 4, 30, 1, addrA)));
+    BOOST_CHECK(db.UpdateSpentIndex(spent1));
+    db.CacheSpentIndex(spent2);
+    db.InitSpentFilter(1000);
+    db.CacheSpentIndex(spent3);
+    FlushIndexCache(db);
+    BOOST_CHECK(db.LoadSpentFilter());
+
+    CSpentIndexValue value;
+    BOOST_CHECK(db.ReadSpentIndex(spent1[0].first, value) && value.txid == tx2);
+    BOOST_CHECK(db.ReadSpentIndex(spent2[0].first, value) && value.txid == tx3);
+    BOOST_CHECK(db.ReadSpentIndex(spent3[0].first, value) && value.txid == tx1);
+    CSpentIndexKey unspent(tx1, 1);
+    BOOST_CHECK(!db.ReadSpentIndex(unspent, value));
+
+    // Disconnecting removes the record, the filter keeps the key
+    spent3[0].second.SetNull();
+    db.CacheSpentIndex(spent3);
+    BOOST_CHECK(!db.ReadSpentIndex(spent3[0].first, value));
+    FlushIndexCache(db);
+    BOOST_CHECK(!db.ReadSpentIndex(spent3[0].first, value));
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_ordered_compact)
+{
+    // The encoding round-trips and sorts bytewise in the order of the values
+    const uint32_t values[] = {0, 1, 63, 64, 255, 16383, 16384, 70000, 4194303, 4194304, MAX_ORDERED_COMPACT};
+    std::vector<unsigned char> vchPrev;
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ser_writeorderedcompact(ss, values[i]);
+        BOOST_CHECK_EQUAL(ss.size(), GetOrderedCompactSize(values[i]));
+        std::vector<unsigned char> vch(ss.begin(), ss.end());
+        if (i > 0)
+            BOOST_CHECK(vchPrev < vch);
+        vchPrev = vch;
+        BOOST_CHECK_EQUAL(ser_readorderedcompact(ss), values[i]);
+    }
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK_THROW(ser_writeorderedcompact(ss, MAX_ORDERED_COMPACT + 1), std::ios_base::failure);
+
+    // Amounts of either sign round-trip
+    const CAmount amounts[] = {0, 1, -1, 50 * COIN, -50 * COIN, 123456789, -MAX_MONEY};
+    for (size_t i = 0; i < sizeof(amounts) / sizeof(amounts[0]); i++) {
+        CAmount amount = amounts[i], amountRead = 0;
+        CDataStream ssAmount(SER_DISK, CLIENT_VERSION);
+        ssAmount << CAddressIndexAmount(amount);
+        CAddressIndexAmount amountWrapper(amountRead);
+        ssAmount >> amountWrapper;
+        BOOST_CHECK_EQUAL(amountRead, amount);
+    }
+}
+
+/** Raw record bytes, for writing keys in the fixed width format of version 0 */
+struct RawBytes
+{
+    std::vector<unsigned char> vch;
+
+    size_t GetSerializeSize(int nType, int nVersion) const { return vch.size(); }
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const { s.write((const char*)&vch[0], vch.size()); }
+};
+
+BOOST_AUTO_TEST_CASE(addressindex_format_upgrade)
+{
+    CBlockTreeDB db(1 << 20, true);
+    uint160 addrA = uint160(std::vector<unsigned char>(20, 0xaa));
+    uint256 tx1 = GetRandHash();
+
+    // Version 0 keys: type, hash, big-endian height and tx position, txid,
+    // little-endian output index and the spending flag
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ser_writedata8(ssKey, 1);
+    ssKey << addrA;
+    ser_writedata32be(ssKey, 300);
+    ser_writedata32be(ssKey, 2);
+    ssKey << tx1;
+    ser_writedata32(ssKey, 5);
+    ser_writedata8(ssKey, 0);
+    RawBytes key;
+    key.vch.assign(ssKey.begin(), ssKey.end());
+    BOOST_CHECK(db.Write(std::make_pair('a', key), (CAmount)50 * COIN));
+
+    CDataStream ssUnspentKey(SER_DISK, CLIENT_VERSION);
+    ser_writedata8(ssUnspentKey, 1);
+    ssUnspentKey << addrA << tx1;
+    ser_writedata32(ssUnspentKey, 5);
+    RawBytes unspentKey;
+    unspentKey.vch.assign(ssUnspentKey.begin(), ssUnspentKey.end());
+    CScript script = GetAddressScript(1, addrA);
+    CDataStream ssUnspentValue(SER_DISK, CLIENT_VERSION);
+    ssUnspentValue << (CAmount)50 * COIN << *(CScriptBase*)(&script) << 300;
+    RawBytes unspentValue;
+    unspentValue.vch.assign(ssUnspentValue.begin(), ssUnspentValue.end());
+    BOOST_CHECK(db.Write(std::make_pair('u', unspentKey), unspentValue));
+
+    BOOST_CHECK(db.UpgradeAddressIndexFormat());
+    AddressIndexEntries entries;
+    BOOST_CHECK(db.ReadAddressIndex(addrA, 1, entries));
+    BOOST_CHECK_EQUAL(entries.size(), 1U);
+    if (entries.size() == 1) {
+        BOOST_CHECK_EQUAL(entries[0].first.blockHeight, 300);
+        BOOST_CHECK_EQUAL(entries[0].first.txindex, 2U);
+        BOOST_CHECK(entries[0].first.txhash == tx1);
+        BOOST_CHECK_EQUAL(entries[0].first.index, 5U);
+        BOOST_CHECK(!entries[0].first.spending);
+        BOOST_CHECK_EQUAL(entries[0].second, 50 * COIN);
+    }
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspent;
+    BOOST_CHECK(db.ReadAddressUnspentIndex(addrA, 1, unspent));
+    BOOST_CHECK_EQUAL(unspent.size(), 1U);
+    if (unspent.size() == 1) {
+        BOOST_CHECK_EQUAL(unspent[0].first.index, 5U);
+        BOOST_CHECK_EQUAL(unspent[0].second.satoshis, 50 * COIN);
+        BOOST_CHECK_EQUAL(unspent[0].second.blockHeight, 300);
+        BOOST_CHECK(unspent[0].second.script == script);
+    }
+
+    // The legacy records are gone and the upgrade does not run twice
+    BOOST_CHECK(!db.Exists(std::make_pair('a', key)));
+    BOOST_CHECK(!db.Exists(std::make_pair('u', unspentKey)));
+    BOOST_CHECK(db.UpgradeAddressIndexFormat());
+}
+
+BOOST_AUTO_TEST_CASE(flagindex_records)
+{
+    CBlockTreeDB db(1 << 20, true);
+    CMutableTransaction mtx;
+    mtx.nVersion = ((TX_F_IS_OVER_18 | TX_F_IS_OVER_21) << 16) | 1;
+    CTransaction tx1(mtx);
+    mtx.nVersion = (TX_F_IS_OVER_18 << 16) | 1;
+    CTransaction tx2(mtx);
+    mtx.nVersion = 1;
+    mtx.nLockTime = 1;
+    CTransaction tx3(mtx);
+
+    // One record for every flag, none for transactions without flags
+    FlagIndexEntries block1, block2;
+    GetFlagIndexRecords(tx1, 1, false, block1);
+    GetFlagIndexRecords(tx3, 1, false, block1);
+    GetFlagIndexRecords(tx2, 2, false, block2);
+    BOOST_CHECK_EQUAL(block1.size(), 2U);
+    BOOST_CHECK_EQUAL(block2.size(), 1U);
+
+    // The records of one flag come back ordered by height
+    db.CacheFlagIndex(block2);
+    db.CacheFlagIndex(block1);
+    FlagIndexEntries entries;
+    BOOST_CHECK(db.ReadFlagIndex(TX_F_IS_OVER_18, 0, 0, entries));
+    BOOST_CHECK_EQUAL(entries.size(), 2U);
+    if (entries.size() == 2) {
+        BOOST_CHECK(entries[0].first.txhash == tx1.GetHash());
+        BOOST_CHECK_EQUAL(entries[0].second.flags, TX_F_IS_OVER_18 | TX_F_IS_OVER_21);
+        BOOST_CHECK(entries[1].first.txhash == tx2.GetHash());
+        BOOST_CHECK_EQUAL(entries[1].first.blockHeight, 2);
+    }
+    FlushIndexCache(db);
+
+    entries.clear();
+    BOOST_CHECK(db.ReadFlagIndex(TX_F_IS_OVER_21, 0, 0, entries));
+    BOOST_CHECK_EQUAL(entries.size(), 1U);
+    entries.clear();
+    BOOST_CHECK(db.ReadFlagIndex(TX_F_IS_OVER_18, 2, 0, entries));
+    BOOST_CHECK(entries.size() == 1 && entries[0].first.txhash == tx2.GetHash());
+    entries.clear();
+    BOOST_CHECK(db.ReadFlagIndex(TX_F_IS_OVER_18, 1, 1, entries));
+    BOOST_CHECK(entries.size() == 1 && entries[0].first.txhash == tx1.GetHash());
+    entries.clear();
+    BOOST_CHECK(db.ReadFlagIndex(TX_F_IS_OVER_CONSENT, 0, 0, entries) && entries.empty());
+
+    // Disconnecting a block erases its records, also those on disk
+    FlagIndexEntries undo2;
+    GetFlagIndexRecords(tx2, 2, true, undo2);
+    db.CacheFlagIndex(undo2);
+    entries.clear();
+    BOOST_CHECK(db.ReadFlagIndex(TX_F_IS_OVER_18, 0, 0, entries));
+    BOOST_CHECK(entries.size() == 1 && entries[0].first.txhash == tx1.GetHash());
+
+    uint16_t flag;
+    BOOST_CHECK(ParseFlagIndexFlag("over18", flag) && flag == TX_F_IS_OVER_18);
+    BOOST_CHECK(ParseFlagIndexFlag("TX_F_4", flag) && flag == TX_F_4);
+    BOOST_CHECK(ParseFlagIndexFlag("32768", flag) && flag == TX_F_INVALID_CODE);
+    BOOST_CHECK(!ParseFlagIndexFlag("3", flag));
+    BOOST_CHECK(!ParseFlagIndexFlag("0", flag));
+    BOOST_CHECK(!ParseFlagIndexFlag("over99", flag));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
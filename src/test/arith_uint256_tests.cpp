@@ -10,6 +10,7 @@
 #include <cmath>
 #include "uint256.h"
 #include "arith_uint256.h"
+#include "random.h"
 #include <string>
 #include "version.h"
 #include "test/test_bitcoin.h"
@@ -368,6 +369,50 @@ BOOST_AUTO_TEST_CASE( divide )
     BOOST_CHECK_THROW(R2L / ZeroL, uint_error);
 }
 
+/// Shift-and-subtract long division, as operator/= does for wide divisors
+static arith_uint256 LongDivide(const arith_uint256& num, const arith_uint256& div)
+{
+    arith_uint256 rem = num;
+    arith_uint256 quot = 0;
+    if (div.bits() > rem.bits())
+        return quot;
+    int shift = rem.bits() - div.bits();
+    arith_uint256 d = div << shift;
+    while (shift >= 0) {
+        if (rem >= d) {
+            rem -= d;
+            quot |= OneL << shift;
+        }
+        d >>= 1;
+        shift--;
+    }
+    return quot;
+}
+
+BOOST_AUTO_TEST_CASE( divide_single_word ) // divisors of at most 32 bits take the short division path
+{
+    const uint32_t divisors[] = {1, 2, 3, 7, 10, 600, 10080, 0x87654321UL, 0x7fffffffUL, 0xffffffffUL};
+    const arith_uint256 dividends[] = {R1L, R2L, MaxL, HalfL, OneL, ZeroL, arith_uint256(0xfffffffeUL), arith_uint256("100000000")};
+    for (unsigned int i = 0; i < sizeof(divisors) / sizeof(divisors[0]); i++) {
+        for (unsigned int j = 0; j < sizeof(dividends) / sizeof(dividends[0]); j++) {
+            arith_uint256 div(divisors[i]);
+            BOOST_CHECK(dividends[j] / div == LongDivide(dividends[j], div));
+        }
+        for (int k = 0; k < 100; k++) {
+            arith_uint256 num = (arith_uint256(insecure_rand()) << 224) | (arith_uint256(insecure_rand()) << 96) | insecure_rand();
+            num >>= insecure_rand() % 256;
+            BOOST_CHECK(num / divisors[i] == LongDivide(num, divisors[i]));
+        }
+    }
+    BOOST_CHECK(R1L / 1 == R1L);
+    BOOST_CHECK(MaxL / 0xffffffffUL == MaxL / arith_uint256(0xffffffffUL));
+    BOOST_CHECK((MaxL / 0xffffffffUL).ToString() == "0000000100000001000000010000000100000001000000010000000100000001");
+    BOOST_CHECK(arith_uint256(0xfffffffeUL) / 0xffffffffUL == ZeroL);
+    BOOST_CHECK(arith_uint256(7) / 600 == ZeroL);
+    BOOST_CHECK(arith_uint256(600) / 7 == 85);
+    BOOST_CHECK_THROW(R1L / 0, uint_error);
+}
+
 
 bool almostEqual(double d1, double d2)
 {
@@ -0,0 +1,67 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "auxpow/auxpow.h"
+#include "random.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(auxpowcache_tests, BasicTestingSetup)
+
+static std::shared_ptr<CAuxPow> MakeAuxPow(unsigned int nChainIndex)
+{
+    std::shared_ptr<CAuxPow> auxpow(new CAuxPow());
+    auxpow->nChainIndex = nChainIndex;
+    auxpow->vChainMerkleBranch.resize(4);
+    return auxpow;
+}
+
+BOOST_AUTO_TEST_CASE(auxpowcache_lru)
+{
+    CAuxPowCache cache(1 << 20);
+    std::vector<uint256> hashes;
+    for (int i = 0; i < 4; i++)
+        hashes.push_back(GetRandHash());
+
+    std::shared_ptr<CAuxPow> auxpow;
+    BOOST_CHECK(!cache.Get(hashes[0], auxpow));
+    BOOST_CHECK_EQUAL(cache.Misses(), 1U);
+
+    cache.Insert(hashes[0], MakeAuxPow(0));
+    BOOST_CHECK(cache.Get(hashes[0], auxpow));
+    BOOST_CHECK_EQUAL(auxpow->nChainIndex, 0U);
+    BOOST_CHECK_EQUAL(cache.Hits(), 1U);
+    BOOST_CHECK_EQUAL(cache.Size(), 1U);
+
+    // Room for exactly three entries of this size
+    size_t nEntryUsage = cache.DynamicMemoryUsage();
+    BOOST_CHECK(nEntryUsage > 0);
+    cache.SetMaxUsage(nEntryUsage * 3);
+
+    cache.Insert(hashes[1], MakeAuxPow(1));
+    cache.Insert(hashes[2], MakeAuxPow(2));
+    BOOST_CHECK_EQUAL(cache.Size(), 3U);
+
+    // Touch the oldest entry, so the next insert evicts hashes[1] instead
+    BOOST_CHECK(cache.Get(hashes[0], auxpow));
+    cache.Insert(hashes[3], MakeAuxPow(3));
+    BOOST_CHECK_EQUAL(cache.Size(), 3U);
+    BOOST_CHECK(cache.DynamicMemoryUsage() <= cache.MaxUsage());
+    BOOST_CHECK(!cache.Get(hashes[1], auxpow));
+    BOOST_CHECK(cache.Get(hashes[0], auxpow));
+    BOOST_CHECK(cache.Get(hashes[2], auxpow));
+    BOOST_CHECK(cache.Get(hashes[3], auxpow));
+    BOOST_CHECK_EQUAL(auxpow->nChainIndex, 3U);
+
+    // Shrinking to zero drops everything and disables caching
+    cache.SetMaxUsage(0);
+    BOOST_CHECK_EQUAL(cache.Size(), 0U);
+    BOOST_CHECK_EQUAL(cache.DynamicMemoryUsage(), 0U);
+    cache.Insert(hashes[0], MakeAuxPow(0));
+    BOOST_CHECK_EQUAL(cache.Size(), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
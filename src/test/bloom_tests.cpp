@@ -545,4 +545,37 @@ BOOST_AUTO_TEST_CASE(rolling_bloom)
     }
 }
 
+BOOST_AUTO_TEST_CASE(blocked_bloom)
+{
+    CBlockedBloomFilter bb(10000, 0.01);
+
+    static const int DATASIZE=10000;
+    std::vector<COutPoint> data;
+    for (int i = 0; i < DATASIZE; i++) {
+        data.push_back(COutPoint(GetRandHash(), i % 4));
+        bb.insert(data[i]);
+    }
+    // Inserted outpoints are never forgotten
+    for (int i = 0; i < DATASIZE; i++) {
+        BOOST_CHECK(bb.contains(data[i]));
+    }
+    // The output index is part of the key
+    BOOST_CHECK(bb.contains(data[0]));
+    unsigned int nIndexHits = 0;
+    for (int i = 0; i < 100; i++) {
+        if (bb.contains(COutPoint(data[i].hash, data[i].n + 4)))
+            ++nIndexHits;
+    }
+    BOOST_CHECK(nIndexHits < 10);
+
+    // Blocking costs a little over the 1% of a plain bloom filter when full
+    unsigned int nHits = 0;
+    for (int i = 0; i < 10000; i++) {
+        if (bb.contains(COutPoint(GetRandHash(), 0)))
+            ++nHits;
+    }
+    BOOST_TEST_MESSAGE("BlockedBloomFilter got " << nHits << " false positives (~100-150 expected)");
+    BOOST_CHECK(nHits < 300);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,93 @@
+// Copyright (c) 2016 The Sexcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "checkqueue.h"
+#include "random.h"
+
+#include "test/test_bitcoin.h"
+
+#include <atomic>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(checkqueue_tests, BasicTestingSetup)
+
+static std::atomic<size_t> nFakeChecks(0);
+
+struct FakeCheck
+{
+    bool fOk;
+
+    FakeCheck() : fOk(true) {}
+    explicit FakeCheck(bool fOkIn) : fOk(fOkIn) {}
+
+    bool operator()() {
+        nFakeChecks++;
+        return fOk;
+    }
+
+    void swap(FakeCheck& check) {
+        std::swap(fOk, check.fOk);
+    }
+};
+
+/** Add nChecks checks in batches of random size, like the inputs of the transactions of a block */
+static bool RunChecks(CCheckQueue<FakeCheck>& queue, size_t nChecks, size_t nFail)
+{
+    CCheckQueueControl<FakeCheck> control(&queue);
+    size_t nAdded = 0;
+    while (nAdded < nChecks) {
+        size_t nBatch = std::min(nChecks - nAdded, (size_t)(1 + insecure_rand() % 20));
+        std::vector<FakeCheck> vChecks;
+        for (size_t i = 0; i < nBatch; i++)
+            vChecks.push_back(FakeCheck(nAdded + i != nFail));
+        nAdded += nBatch;
+        control.Add(vChecks);
+    }
+    return control.Wait();
+}
+
+static void TestQueue(int nThreads)
+{
+    CCheckQueue<FakeCheck> queue(128);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nThreads; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<FakeCheck>::Thread, boost::ref(queue)));
+
+    size_t sizes[] = {0, 1, 2, 10, 127, 128, 129, 1000, 100000};
+    for (unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        nFakeChecks = 0;
+        BOOST_CHECK(RunChecks(queue, sizes[i], (size_t)-1));
+        BOOST_CHECK_EQUAL(nFakeChecks.load(), sizes[i]);
+        BOOST_CHECK(queue.IsIdle());
+    }
+
+    // A failure anywhere fails the run, and does not stick to the next one
+    for (int i = 0; i < 20; i++) {
+        size_t nChecks = 1 + insecure_rand() % 5000;
+        BOOST_CHECK(!RunChecks(queue, nChecks, insecure_rand() % nChecks));
+        BOOST_CHECK(queue.IsIdle());
+        BOOST_CHECK(RunChecks(queue, nChecks, (size_t)-1));
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_master_only)
+{
+    TestQueue(0);
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_workers)
+{
+    TestQueue(1);
+    TestQueue(3);
+    TestQueue(15);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
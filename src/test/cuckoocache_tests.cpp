@@ -0,0 +1,126 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "cuckoocache.h"
+#include "random.h"
+
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(cuckoocache_tests, BasicTestingSetup)
+
+static std::vector<uint256> RandomEntries(size_t n)
+{
+    std::vector<uint256> entries(n);
+    for (size_t i = 0; i < n; i++)
+        entries[i] = GetRandHash();
+    return entries;
+}
+
+static double HitRate(CCuckooCache& cache, const std::vector<uint256>& entries, size_t nBegin, size_t nEnd)
+{
+    size_t nHits = 0;
+    for (size_t i = nBegin; i < nEnd; i++)
+        nHits += cache.Contains(entries[i], false);
+    return (double)nHits / (nEnd - nBegin);
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_basics)
+{
+    CCuckooCache cache;
+    uint256 entry = GetRandHash();
+
+    // Without a table, nothing is cached
+    cache.Insert(entry);
+    BOOST_CHECK(!cache.Contains(entry, false));
+    BOOST_CHECK_EQUAL(cache.Slots(), 0U);
+
+    size_t nSlots = cache.Setup(1 << 20);
+    BOOST_CHECK(nSlots > 0);
+    BOOST_CHECK_EQUAL(nSlots, cache.Slots());
+    BOOST_CHECK(cache.DynamicMemoryUsage() <= (1 << 20) + 64);
+
+    cache.Insert(entry);
+    cache.Insert(entry);
+    BOOST_CHECK(cache.Contains(entry, false));
+    BOOST_CHECK(cache.Contains(entry, true));
+    BOOST_CHECK(!cache.Contains(entry, false));
+
+    // Setting up again drops everything
+    cache.Insert(entry);
+    cache.Setup(1 << 20);
+    BOOST_CHECK(!cache.Contains(entry, false));
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_fill)
+{
+    CCuckooCache cache;
+    size_t nSlots = cache.Setup(1 << 20);
+
+    // Up to about half full, displacing makes room for practically everything
+    std::vector<uint256> entries = RandomEntries(nSlots / 2);
+    for (size_t i = 0; i < entries.size(); i++)
+        cache.Insert(entries[i]);
+    BOOST_CHECK(HitRate(cache, entries, 0, entries.size()) > 0.99);
+
+    // Erased entries are gone
+    for (size_t i = 0; i < entries.size(); i += 2)
+        cache.Contains(entries[i], true);
+    for (size_t i = 0; i < entries.size(); i += 2)
+        BOOST_CHECK(!cache.Contains(entries[i], false));
+    BOOST_CHECK(HitRate(cache, entries, 0, entries.size()) > 0.49);
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_generations)
+{
+    CCuckooCache cache;
+    size_t nSlots = cache.Setup(1 << 20);
+
+    // Insert four tables' worth; the newest entries must win over the oldest
+    std::vector<uint256> entries = RandomEntries(nSlots * 4);
+    for (size_t i = 0; i < entries.size(); i++)
+        cache.Insert(entries[i]);
+
+    double nNewest = HitRate(cache, entries, entries.size() - nSlots / 4, entries.size());
+    double nOldest = HitRate(cache, entries, 0, nSlots);
+    BOOST_CHECK(nNewest > 0.95);
+    BOOST_CHECK(nOldest < 0.01);
+}
+
+static void InsertAndLookup(CCuckooCache* cache, const std::vector<uint256>* entries, size_t nBegin, size_t nEnd, size_t* nHits)
+{
+    for (size_t i = nBegin; i < nEnd; i++)
+        cache->Insert((*entries)[i]);
+    *nHits = 0;
+    for (size_t i = nBegin; i < nEnd; i++)
+        *nHits += cache->Contains((*entries)[i], false);
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_concurrent)
+{
+    CCuckooCache cache;
+    size_t nSlots = cache.Setup(1 << 20);
+
+    // Threads inserting into and reading from the same table at once
+    const int nThreads = 4;
+    size_t nPerThread = nSlots / 4 / nThreads;
+    std::vector<uint256> entries = RandomEntries(nPerThread * nThreads);
+    std::vector<size_t> vHits(nThreads);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nThreads; i++)
+        threadGroup.create_thread(boost::bind(&InsertAndLookup, &cache, &entries, i * nPerThread, (i + 1) * nPerThread, &vHits[i]));
+    threadGroup.join_all();
+
+    // A lost race may cost an entry now and then, but no more
+    for (int i = 0; i < nThreads; i++)
+        BOOST_CHECK(vHits[i] > nPerThread * 99 / 100);
+    BOOST_CHECK(HitRate(cache, entries, 0, entries.size()) > 0.99);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -126,6 +126,16 @@ BOOST_AUTO_TEST_CASE(siphash)
     CHashWriter ss(SER_DISK, CLIENT_VERSION);
     ss << CTransaction();
     BOOST_CHECK_EQUAL(SipHashUint256(1, 2, ss.GetHash()), 0x79751e980c2a0a35ULL);
+
+    // Check the outpoint variant against the generic implementation
+    const uint256 hash = ss.GetHash();
+    for (uint32_t n = 0; n < 300; n += 37) {
+        CSipHasher hasher4(1, 2);
+        hasher4.Write(hash.begin(), 32);
+        unsigned char extra[4] = { (unsigned char)n, (unsigned char)(n >> 8), (unsigned char)(n >> 16), (unsigned char)(n >> 24) };
+        hasher4.Write(extra, 4);
+        BOOST_CHECK_EQUAL(SipHashUint256Extra(1, 2, hash, n), hasher4.Finalize());
+    }
 }
 
 BOOST_AUTO_TEST_SUITE_END()
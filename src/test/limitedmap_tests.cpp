@@ -96,6 +96,20 @@ BOOST_AUTO_TEST_CASE(limitedmap_test)
 
     // check that the map is now empty
     BOOST_CHECK(map.empty());
+
+    // refill it, and clear it
+    for (int i = 0; i < 5; i++) {
+        map.insert(std::pair<int, int>(i, i));
+    }
+    map.clear();
+    BOOST_CHECK(map.empty());
+
+    // the cleared map still keeps the highest values only
+    for (int i = 0; i < 10; i++) {
+        map.insert(std::pair<int, int>(i, i));
+    }
+    BOOST_CHECK(map.size() == 5);
+    BOOST_CHECK(map.count(4) == 0 && map.count(5) == 1);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -96,4 +96,52 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     Test.disconnect(&ReturnTrue);
     BOOST_CHECK(Test());
 }
+
+static void BuildChain(std::vector<CBlockIndex>& blocks, CBlockIndex* pindexFork)
+{
+    for (size_t i = 0; i < blocks.size(); i++) {
+        blocks[i].pprev = i ? &blocks[i - 1] : pindexFork;
+        blocks[i].nHeight = blocks[i].pprev ? blocks[i].pprev->nHeight + 1 : 0;
+        blocks[i].nBits = 0x207fffff;
+        blocks[i].nChainWork = blocks[i].pprev ? blocks[i].pprev->nChainWork + GetBlockProof(*blocks[i].pprev) : arith_uint256(0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(assumevalid_test)
+{
+    Consensus::Params params = Params(CBaseChainParams::MAIN).GetConsensus();
+    const int nTwoWeeks = 60 * 60 * 24 * 7 * 2 / params.nPowTargetSpacing;
+
+    // A chain of two weeks of blocks and a bit more, and a fork off its tenth block
+    std::vector<CBlockIndex> blocks(nTwoWeeks + 100);
+    BuildChain(blocks, NULL);
+    std::vector<CBlockIndex> fork(nTwoWeeks + 100);
+    BuildChain(fork, &blocks[9]);
+    CBlockIndex* pindexTip = &blocks.back();
+    params.nMinimumChainWork = ArithToUint256(pindexTip->nChainWork);
+
+    BOOST_CHECK(IsAssumedValid(&blocks[10], pindexTip, pindexTip, params));
+    BOOST_CHECK(IsAssumedValid(&blocks[10], &blocks[10], pindexTip, params));
+    BOOST_CHECK(IsAssumedValid(&blocks[9], &fork.back(), pindexTip, params));
+
+    // Only ancestors of the assumed valid block
+    BOOST_CHECK(!IsAssumedValid(&blocks[10], &blocks[9], pindexTip, params));
+    BOOST_CHECK(!IsAssumedValid(&blocks[10], &fork.back(), pindexTip, params));
+
+    // only on the best header chain
+    BOOST_CHECK(!IsAssumedValid(&blocks[10], pindexTip, &fork.back(), params));
+    BOOST_CHECK(!IsAssumedValid(&fork[0], &fork.back(), pindexTip, params));
+    BOOST_CHECK(IsAssumedValid(&fork[0], &fork.back(), &fork.back(), params));
+
+    // only if the best header has the minimum chain work
+    params.nMinimumChainWork = ArithToUint256(pindexTip->nChainWork + 1);
+    BOOST_CHECK(!IsAssumedValid(&blocks[10], pindexTip, pindexTip, params));
+    params.nMinimumChainWork = ArithToUint256(pindexTip->nChainWork);
+
+    // and only more than two weeks of work below the best header
+    const int nHeight = pindexTip->nHeight - nTwoWeeks;
+    BOOST_CHECK(IsAssumedValid(&blocks[nHeight - 1], pindexTip, pindexTip, params));
+    BOOST_CHECK(!IsAssumedValid(&blocks[nHeight], pindexTip, pindexTip, params));
+    BOOST_CHECK(!IsAssumedValid(&blocks[nHeight], pindexTip, &blocks[nHeight + 10], params));
+}
 BOOST_AUTO_TEST_SUITE_END()
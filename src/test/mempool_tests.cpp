@@ -578,4 +578,111 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolAddressIndexTest)
+{
+    TestMemPoolEntryHelper entry;
+    uint160 addrA = uint160(std::vector<unsigned char>(20, 0xaa));
+    uint160 addrB = uint160(std::vector<unsigned char>(20, 0xbb));
+
+    CMutableTransaction txPrev;
+    txPrev.vin.resize(1);
+    txPrev.vout.resize(1);
+    txPrev.vout[0].scriptPubKey = GetAddressScript(1, addrA);
+    txPrev.vout[0].nValue = 100;
+    CCoinsView coinsDummy;
+    CCoinsViewCache view(&coinsDummy);
+    AddCoins(view, txPrev, 1);
+
+    // Spends A's output, pays B (P2SH) and A again
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(txPrev.GetHash(), 0);
+    tx.vout.resize(2);
+    tx.vout[0].scriptPubKey = GetAddressScript(2, addrB);
+    tx.vout[0].nValue = 60;
+    tx.vout[1].scriptPubKey = GetAddressScript(1, addrA);
+    tx.vout[1].nValue = 40;
+
+    CTxMemPool testPool(CFeeRate(0));
+    testPool.addAddressIndex(entry.Time(42).FromTx(tx), view);
+
+    std::vector<std::pair<uint160, int> > addresses;
+    std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> > results;
+    addresses.push_back(std::make_pair(addrA, 1));
+    BOOST_CHECK(testPool.getAddressIndex(addresses, results));
+    BOOST_CHECK_EQUAL(results.size(), 2U);
+    CAmount nSum = 0;
+    for (size_t i = 0; i < results.size(); i++) {
+        BOOST_CHECK(results[i].first.txhash == tx.GetHash());
+        BOOST_CHECK_EQUAL(results[i].first.spending, results[i].second.amount < 0);
+        BOOST_CHECK_EQUAL(results[i].second.time, 42);
+        nSum += results[i].second.amount;
+    }
+    BOOST_CHECK_EQUAL(nSum, -60);
+
+    // The address type is part of the key
+    results.clear();
+    addresses[0].second = 2;
+    BOOST_CHECK(testPool.getAddressIndex(addresses, results) && results.empty());
+    addresses[0].first = addrB;
+    BOOST_CHECK(testPool.getAddressIndex(addresses, results));
+    BOOST_CHECK_EQUAL(results.size(), 1U);
+
+    // Removing a transaction removes all its entries, and only those
+    CMutableTransaction tx2;
+    tx2.vin.resize(1);
+    tx2.vin[0].prevout = tx.vin[0].prevout;
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = GetAddressScript(1, addrA);
+    tx2.vout[0].nValue = 10;
+    testPool.addAddressIndex(entry.Time(43).FromTx(tx2), view);
+    testPool.removeAddressIndex(tx.GetHash());
+    results.clear();
+    addresses.push_back(std::make_pair(addrA, 1));
+    BOOST_CHECK(testPool.getAddressIndex(addresses, results));
+    BOOST_CHECK_EQUAL(results.size(), 2U);
+    for (size_t i = 0; i < results.size(); i++)
+        BOOST_CHECK(results[i].first.txhash == tx2.GetHash());
+    testPool.removeAddressIndex(tx2.GetHash());
+    results.clear();
+    BOOST_CHECK(testPool.getAddressIndex(addresses, results) && results.empty());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolFlagIndexTest)
+{
+    TestMemPoolEntryHelper entry;
+    CTxMemPool testPool(CFeeRate(0));
+
+    CMutableTransaction tx;
+    tx.nVersion = ((TX_F_IS_OVER_18 | TX_F_IS_OVER_21) << 16) | 1;
+    tx.vin.resize(1);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 10;
+    CMutableTransaction txPlain = tx;
+    txPlain.nVersion = 1;
+
+    testPool.addUnchecked(tx.GetHash(), entry.Time(42).FromTx(tx));
+    testPool.addFlagIndex(entry.Time(42).FromTx(tx));
+    testPool.addUnchecked(txPlain.GetHash(), entry.FromTx(txPlain));
+    testPool.addFlagIndex(entry.FromTx(txPlain));
+
+    std::vector<CMempoolFlagEntry> results;
+    testPool.getFlagIndex(TX_F_IS_OVER_18, results);
+    BOOST_CHECK_EQUAL(results.size(), 1U);
+    if (results.size() == 1) {
+        BOOST_CHECK(results[0].txhash == tx.GetHash());
+        BOOST_CHECK_EQUAL(results[0].time, 42);
+        BOOST_CHECK_EQUAL(results[0].flags, TX_F_IS_OVER_18 | TX_F_IS_OVER_21);
+    }
+    results.clear();
+    testPool.getFlagIndex(TX_F_IS_OVER_CONSENT, results);
+    BOOST_CHECK(results.empty());
+
+    // Leaving the mempool removes the transaction under every flag
+    std::list<CTransaction> removed;
+    testPool.removeRecursive(tx, removed);
+    testPool.getFlagIndex(TX_F_IS_OVER_21, results);
+    BOOST_CHECK(results.empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,115 @@
+// Copyright (c) 2016 The Sexcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coins.h"
+#include "memusage.h"
+#include "random.h"
+#include "support/allocators/pool.h"
+
+#include "test/test_bitcoin.h"
+
+#include <stdint.h>
+
+#include <map>
+
+#include <boost/test/unit_test.hpp>
+#include <boost/unordered_map.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(pool_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(basic_allocating)
+{
+    PoolResource<8, 8> resource(1024);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1);
+    BOOST_CHECK_EQUAL(resource.ChunkSizeBytes(), 1024);
+
+    // Freed blocks are reused
+    void* block = resource.Allocate(8, 8);
+    resource.Deallocate(block, 8, 8);
+    BOOST_CHECK(resource.Allocate(8, 8) == block);
+
+    // Zero sized blocks still get distinct addresses
+    void* a0 = resource.Allocate(0, 1);
+    void* a1 = resource.Allocate(0, 1);
+    BOOST_CHECK(a0 != a1);
+    resource.Deallocate(a0, 0, 1);
+    resource.Deallocate(a1, 0, 1);
+
+    // Too large or too strictly aligned blocks come from operator new
+    void* big = resource.Allocate(16, 8);
+    void* aligned = resource.Allocate(8, 16);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1);
+    resource.Deallocate(big, 16, 8);
+    resource.Deallocate(aligned, 8, 16);
+
+    // Filling the chunk allocates the next one
+    for (int i = 0; i < 1024 / 8; i++)
+        resource.Allocate(8, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(remaining_chunk_is_reused)
+{
+    PoolResource<16, 8> resource(24);
+
+    // 16 bytes leave 8 at the end of the chunk, which go onto the free list
+    void* a = resource.Allocate(16, 8);
+    void* b = resource.Allocate(16, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2);
+    BOOST_CHECK(static_cast<char*>(resource.Allocate(8, 8)) == static_cast<char*>(a) + 16);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2);
+    resource.Deallocate(a, 16, 8);
+    resource.Deallocate(b, 16, 8);
+}
+
+BOOST_AUTO_TEST_CASE(unordered_map_usage)
+{
+    typedef std::pair<const uint64_t, uint64_t> Value;
+    typedef PoolAllocator<Value, sizeof(Value) + 4 * sizeof(void*)> Allocator;
+    typedef boost::unordered_map<uint64_t, uint64_t, boost::hash<uint64_t>, std::equal_to<uint64_t>, Allocator> Map;
+
+    Allocator::ResourceType resource;
+    Map map(0, Map::hasher(), Map::key_equal(), &resource);
+    BOOST_CHECK(map.get_allocator().resource() == &resource);
+
+    std::map<uint64_t, uint64_t> expected;
+    for (int i = 0; i < 100000; i++) {
+        uint64_t key = insecure_rand() % 20000;
+        if (insecure_rand() % 3 == 0) {
+            map.erase(key);
+            expected.erase(key);
+        } else {
+            map[key] = i;
+            expected[key] = i;
+        }
+    }
+    BOOST_CHECK_EQUAL(map.size(), expected.size());
+    for (std::map<uint64_t, uint64_t>::iterator it = expected.begin(); it != expected.end(); ++it)
+        BOOST_CHECK(map[it->first] == it->second);
+
+    // The usage counts whole chunks, not the nodes in them
+    size_t chunks = resource.NumAllocatedChunks();
+    BOOST_CHECK(chunks > 0);
+    BOOST_CHECK(memusage::DynamicUsage(map) >= chunks * resource.ChunkSizeBytes());
+
+    // Erased nodes are reused, rather than taking new chunks
+    map.clear();
+    for (std::map<uint64_t, uint64_t>::iterator it = expected.begin(); it != expected.end(); ++it)
+        map[it->first] = it->second;
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), chunks);
+}
+
+BOOST_AUTO_TEST_CASE(coins_map_nodes)
+{
+    // The blocks must fit the nodes, or they would all fall back to operator new
+    CCoinsMapMemoryResource resource(1 << 12);
+    CCoinsMap map(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &resource);
+    for (int i = 0; i < 1000; i++)
+        map[COutPoint(GetRandHash(), i)].flags = CCoinsCacheEntry::DIRTY;
+    size_t chunks = resource.NumAllocatedChunks();
+    BOOST_CHECK(chunks >= 1000 * sizeof(CCoinsMap::value_type) / resource.ChunkSizeBytes());
+    BOOST_CHECK(chunks <= 1000 * (sizeof(CCoinsMap::value_type) + 4 * sizeof(void*)) / resource.ChunkSizeBytes() + 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -95,4 +95,145 @@ BOOST_AUTO_TEST_CASE(GetBlockProofEquivalentTime_test)
     }
 }
 
+/* Straight copy of the original KimotoGravityWell walk, as a reference for the memoized one */
+static unsigned int KimotoGravityWellReference(const CBlockIndex* pindexLast, const Consensus::Params& params)
+{
+    const CBlockIndex *BlockLastSolved = pindexLast;
+    const CBlockIndex *BlockReading = pindexLast;
+
+    uint64_t PastBlocksMass = 0;
+    int64_t PastRateActualSeconds = 0;
+    int64_t PastRateTargetSeconds = 0;
+    double PastRateAdjustmentRatio = double(1);
+    arith_uint256 PastDifficultyAverage;
+    arith_uint256 PastDifficultyAveragePrev;
+    arith_uint256 BlockReadingDifficulty;
+    double EventHorizonDeviation;
+    double EventHorizonDeviationFast;
+    double EventHorizonDeviationSlow;
+
+    static const int64_t TargetBlockSpacing = 60;
+    unsigned int TimeDaySeconds = 60 * 60 * 24;
+    int64_t PastSecondsMin = TimeDaySeconds * 0.25;
+    int64_t PastSecondsMax = TimeDaySeconds * 7;
+    uint64_t PastBlocksMin = PastSecondsMin / TargetBlockSpacing;
+    uint64_t PastBlocksMax = PastSecondsMax / TargetBlockSpacing;
+    arith_uint256 nProofOfWorkLimit = UintToArith256(params.powLimit);
+    int64_t TimeWarpFixHeight = params.Fork3Height;
+
+    if (BlockLastSolved == NULL || BlockLastSolved->nHeight == 0 ||
+        (uint64_t)BlockLastSolved->nHeight < PastBlocksMin) {
+        return nProofOfWorkLimit.GetCompact();
+    }
+
+    int64_t LatestBlockTime = BlockLastSolved->GetBlockTime();
+
+    for (unsigned int i = 1; BlockReading && BlockReading->nHeight > 0; i++) {
+        if (PastBlocksMax > 0 && i > PastBlocksMax) { break; }
+        PastBlocksMass++;
+
+        if (i == 1) {
+            PastDifficultyAverage.SetCompact(BlockReading->nBits);
+        } else {
+            BlockReadingDifficulty.SetCompact(BlockReading->nBits);
+            if (BlockReadingDifficulty > PastDifficultyAveragePrev) {
+                PastDifficultyAverage = PastDifficultyAveragePrev + ((BlockReadingDifficulty - PastDifficultyAveragePrev) / i);
+            } else {
+                PastDifficultyAverage = PastDifficultyAveragePrev - ((PastDifficultyAveragePrev - BlockReadingDifficulty) / i);
+            }
+        }
+        PastDifficultyAveragePrev = PastDifficultyAverage;
+
+        if (LatestBlockTime < BlockReading->GetBlockTime()) {
+            if (BlockReading->nHeight > TimeWarpFixHeight)
+                LatestBlockTime = BlockReading->GetBlockTime();
+        }
+        PastRateActualSeconds = LatestBlockTime - BlockReading->GetBlockTime();
+        PastRateTargetSeconds = TargetBlockSpacing * PastBlocksMass;
+        PastRateAdjustmentRatio = double(1);
+        if (BlockReading->nHeight > TimeWarpFixHeight) {
+            if (PastRateActualSeconds < 1) { PastRateActualSeconds = 1; }
+        } else {
+            if (PastRateActualSeconds < 0) { PastRateActualSeconds = 0; }
+        }
+        if (PastRateActualSeconds != 0 && PastRateTargetSeconds != 0) {
+            PastRateAdjustmentRatio = double(PastRateTargetSeconds) / double(PastRateActualSeconds);
+        }
+        EventHorizonDeviation = 1 + (0.7084 * pow((double(PastBlocksMass)/double(144)), -1.228));
+        EventHorizonDeviationFast = EventHorizonDeviation;
+        EventHorizonDeviationSlow = 1 / EventHorizonDeviation;
+
+        if (PastBlocksMass >= PastBlocksMin) {
+            if ((PastRateAdjustmentRatio <= EventHorizonDeviationSlow) ||
+                (PastRateAdjustmentRatio >= EventHorizonDeviationFast)) {
+                break;
+            }
+        }
+        if (BlockReading->pprev == NULL) { break; }
+        BlockReading = BlockReading->pprev;
+    }
+
+    arith_uint256 bnNew(PastDifficultyAverage);
+    if (PastRateActualSeconds != 0 && PastRateTargetSeconds != 0) {
+        bnNew *= PastRateActualSeconds;
+        bnNew /= PastRateTargetSeconds;
+    }
+    if (bnNew > nProofOfWorkLimit) { bnNew = nProofOfWorkLimit; }
+    return bnNew.GetCompact();
+}
+
+/* The memoized KimotoGravityWell must agree bit for bit with the original walk */
+BOOST_AUTO_TEST_CASE(kimoto_gravity_well_reference)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    const Consensus::Params& params = Params().GetConsensus();
+
+    // A long stretch close to the target spacing makes the walk go all the
+    // way back to PastBlocksMax; the erratic tail, which straddles the time
+    // warp fix height, makes it stop early at varying depths.
+    const int nBlocks = 11000;
+    const int nSteady = 10600;
+    std::vector<CBlockIndex> blocks(nBlocks);
+    std::vector<uint256> hashes(nBlocks);
+    arith_uint256 bnTarget = UintToArith256(params.powLimit) >> 12;
+    for (int i = 0; i < nBlocks; i++) {
+        hashes[i] = GetRandHash();
+        blocks[i].phashBlock = &hashes[i];
+        blocks[i].pprev = i ? &blocks[i - 1] : NULL;
+        blocks[i].nHeight = params.Fork3Height - nSteady - 200 + i;
+        if (i == 0)
+            blocks[i].nTime = 1400000000;
+        else if (i < nSteady)
+            blocks[i].nTime = blocks[i - 1].nTime + 55 + insecure_rand() % 11;
+        else
+            blocks[i].nTime = blocks[i - 1].nTime + (int)(insecure_rand() % 600) - 120;
+        if (insecure_rand() % 2)
+            bnTarget += bnTarget / (20 + insecure_rand() % 100);
+        else
+            bnTarget -= bnTarget / (20 + insecure_rand() % 100);
+        blocks[i].nBits = bnTarget.GetCompact();
+    }
+
+    for (int i = 0; i < nBlocks; i += (i < nSteady ? 347 : 1)) {
+        unsigned int nExpected = KimotoGravityWellReference(&blocks[i], params);
+        BOOST_CHECK_EQUAL(KimotoGravityWell(&blocks[i], params), nExpected);
+        // Second lookup is served from the cache
+        BOOST_CHECK_EQUAL(KimotoGravityWell(&blocks[i], params), nExpected);
+    }
+
+    // Results cached for one set of parameters are not served for another
+    Consensus::Params paramsOther = params;
+    paramsOther.Fork3Height -= 100;
+    int nDiffering = 0;
+    for (int i = nSteady; i < nBlocks; i++) {
+        unsigned int nExpected = KimotoGravityWellReference(&blocks[i], params);
+        unsigned int nExpectedOther = KimotoGravityWellReference(&blocks[i], paramsOther);
+        BOOST_CHECK_EQUAL(KimotoGravityWell(&blocks[i], params), nExpected);
+        BOOST_CHECK_EQUAL(KimotoGravityWell(&blocks[i], paramsOther), nExpectedOther);
+        if (nExpected != nExpectedOther)
+            nDiffering++;
+    }
+    BOOST_CHECK(nDiffering > 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,110 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coins.h"
+#include "consensus/validation.h"
+#include "main.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "script/script.h"
+#include "script/sigcache.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(scriptcache_tests, TestingSetup)
+
+static CMutableTransaction MakeSpend(const COutPoint& prevout)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = prevout;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 1000;
+    tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(scriptcache_entries)
+{
+    CScriptExecutionCache cache;
+    CTransaction tx1(MakeSpend(COutPoint(GetRandHash(), 0)));
+    CTransaction tx2(MakeSpend(COutPoint(GetRandHash(), 0)));
+
+    // Entries depend on both the transaction and the flags
+    uint256 entry1, entry2, entry1p2sh;
+    cache.ComputeEntry(entry1, tx1, SCRIPT_VERIFY_NONE);
+    cache.ComputeEntry(entry2, tx2, SCRIPT_VERIFY_NONE);
+    cache.ComputeEntry(entry1p2sh, tx1, SCRIPT_VERIFY_P2SH);
+    BOOST_CHECK(entry1 != entry2);
+    BOOST_CHECK(entry1 != entry1p2sh);
+
+    // and on the salt of the cache
+    CScriptExecutionCache other;
+    uint256 entryOther;
+    other.ComputeEntry(entryOther, tx1, SCRIPT_VERIFY_NONE);
+    BOOST_CHECK(entry1 != entryOther);
+
+    cache.Set(entry1);
+    BOOST_CHECK(!cache.Get(entry1p2sh, false));
+    BOOST_CHECK(cache.Get(entry1, false));
+    BOOST_CHECK_EQUAL(cache.Size(), 1U);
+    BOOST_CHECK_EQUAL(cache.Hits() + cache.Misses(), 0U);
+
+    // Consuming lookups count, and remove the entry
+    BOOST_CHECK(cache.Get(entry1, true));
+    BOOST_CHECK(!cache.Get(entry1, true));
+    BOOST_CHECK_EQUAL(cache.Hits(), 1U);
+    BOOST_CHECK_EQUAL(cache.Misses(), 1U);
+    BOOST_CHECK_EQUAL(cache.Size(), 0U);
+
+    // The size limit holds, and zero disables the cache
+    cache.SetMaxSize(1 << 16);
+    for (int i = 0; i < 10000; i++)
+        cache.Set(GetRandHash());
+    BOOST_CHECK(cache.Size() > 0);
+    BOOST_CHECK(cache.DynamicMemoryUsage() < 2 * cache.MaxSize());
+    cache.SetMaxSize(0);
+    BOOST_CHECK_EQUAL(cache.Size(), 0U);
+    cache.Set(entry1);
+    BOOST_CHECK(!cache.Get(entry1, false));
+}
+
+BOOST_AUTO_TEST_CASE(scriptcache_checkinputs)
+{
+    LOCK(cs_main);
+    CCoinsView viewDummy;
+    CCoinsViewCache view(&viewDummy);
+    view.SetBestBlock(chainActive.Tip()->GetBlockHash());
+
+    COutPoint prevout(GetRandHash(), 0);
+    Coin coin;
+    coin.out.nValue = 2000;
+    coin.out.scriptPubKey = CScript() << OP_TRUE;
+    coin.nHeight = 1;
+    view.AddCoin(prevout, coin, false);
+
+    CTransaction tx(MakeSpend(prevout));
+    PrecomputedTransactionData txdata(tx);
+    CValidationState state;
+    const unsigned int flags = SCRIPT_VERIFY_P2SH;
+
+    // Verified with cacheFullScriptStore, the transaction goes into the cache
+    BOOST_CHECK(CheckInputs(tx, state, view, true, flags, true, true, txdata));
+
+    // so block connection no longer runs the script, which would now fail
+    Coin coinFalse = coin;
+    coinFalse.out.scriptPubKey = CScript() << OP_FALSE;
+    view.SpendCoin(prevout);
+    view.AddCoin(prevout, coinFalse, false);
+    std::vector<CScriptCheck> vChecks;
+    BOOST_CHECK(CheckInputs(tx, state, view, true, flags, false, false, txdata, &vChecks));
+    BOOST_CHECK(vChecks.empty());
+
+    // The entry was consumed by connecting the block
+    BOOST_CHECK(!CheckInputs(tx, state, view, true, flags, false, false, txdata));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -1,6 +1,7 @@
 #include <boost/test/unit_test.hpp>
 
 #include "uint256.h"
+#include "random.h"
 #include "util.h"
 #include "utilstrencodings.h"
 #include "crypto/scrypt.h"
@@ -32,4 +33,34 @@ BOOST_AUTO_TEST_CASE(scrypt_hashtest)
     }
 }
 
+BOOST_AUTO_TEST_CASE(scrypt_batch)
+{
+    // Every batch size up to a few full rounds of the widest kernel, so each
+    // kernel and the single-lane tail are all exercised against the generic code
+    (void) scrypt_detect_batch();
+    const size_t nMaxCount = 3 * SCRYPT_MAX_LANES + 3;
+    std::vector<char> input(nMaxCount * 80);
+    for (size_t i = 0; i < input.size(); i++)
+        input[i] = (char)insecure_rand();
+    std::vector<uint256> expected(nMaxCount);
+    char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
+    for (size_t i = 0; i < nMaxCount; i++)
+        scrypt_1024_1_1_256_sp_generic(&input[i * 80], BEGIN(expected[i]), scratchpad);
+
+    for (size_t nCount = 0; nCount <= nMaxCount; nCount += (nCount < 2 * SCRYPT_MAX_LANES ? 1 : SCRYPT_MAX_LANES + 1)) {
+        std::vector<uint256> hashes(nCount);
+        scrypt_1024_1_1_256_batch(&input[0], nCount ? BEGIN(hashes[0]) : NULL, nCount);
+        for (size_t i = 0; i < nCount; i++)
+            BOOST_CHECK_EQUAL(hashes[i].ToString(), expected[i].ToString());
+    }
+
+#if defined(USE_SCRYPT_4WAY)
+    std::vector<char> scratchpad4way(SCRYPT_4WAY_SCRATCHPAD_SIZE);
+    std::vector<uint256> hashes(SCRYPT_4WAY_LANES);
+    scrypt_1024_1_1_256_sp_4way(&input[0], BEGIN(hashes[0]), &scratchpad4way[0]);
+    for (int i = 0; i < SCRYPT_4WAY_LANES; i++)
+        BOOST_CHECK_EQUAL(hashes[i].ToString(), expected[i].ToString());
+#endif
+}
+
 BOOST_AUTO_TEST_SUITE_END()
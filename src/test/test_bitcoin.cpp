@@ -14,6 +14,7 @@
 #include "miner.h"
 #include "pubkey.h"
 #include "random.h"
+#include "script/sigcache.h"
 #include "txdb.h"
 #include "txmempool.h"
 #include "ui_interface.h"
@@ -37,6 +38,7 @@ BasicTestingSetup::BasicTestingSetup(const std::string& chainName)
         fPrintToDebugLog = false; // don't want to write to debug.log file
         fCheckBlockIndex = true;
         SelectParams(chainName);
+        InitSignatureCache();
         noui_connect();
 }
 
@@ -58,7 +60,8 @@ TestingSetup::TestingSetup(const std::string& chainName) : BasicTestingSetup(cha
         mempool.setSanityCheck(1.0);
         pblocktree = new CBlockTreeDB(1 << 20, true);
         pcoinsdbview = new CCoinsViewDB(1 << 23, true);
-        pcoinsTip = new CCoinsViewCache(pcoinsdbview);
+        pcoinsflusher = new CCoinsViewBackgroundFlush(pcoinsdbview);
+        pcoinsTip = new CCoinsViewCache(pcoinsflusher);
         InitBlockIndex(chainparams);
         {
             CValidationState state;
@@ -78,6 +81,7 @@ TestingSetup::~TestingSetup()
         threadGroup.join_all();
         UnloadBlockIndex();
         delete pcoinsTip;
+        delete pcoinsflusher;
         delete pcoinsdbview;
         delete pblocktree;
         boost::filesystem::remove_all(pathTemp);
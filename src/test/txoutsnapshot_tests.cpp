@@ -0,0 +1,155 @@
+// Copyright (c) 2016 The Sexcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coins.h"
+#include "main.h"
+#include "random.h"
+#include "script/script.h"
+#include "txoutsnapshot.h"
+
+#include "test/test_bitcoin.h"
+
+#include <stdio.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(txoutsnapshot_tests, TestingSetup)
+
+static COutPoint AddRandomCoin()
+{
+    COutPoint outpoint(GetRandHash(), insecure_rand() % 4);
+    Coin coin(CTxOut(1 + insecure_rand() % 10000, CScript() << OP_DUP << ToByteVector(GetRandHash())), 1 + insecure_rand() % 100, insecure_rand() % 2);
+    LOCK(cs_main);
+    pcoinsTip->AddCoin(outpoint, coin, false);
+    return outpoint;
+}
+
+//! Forget the active chain, like a node that has not connected any block yet
+static CBlockIndex* ClearTip()
+{
+    LOCK(cs_main);
+    CBlockIndex* pindex = chainActive.Tip();
+    chainActive.SetTip(NULL);
+    return pindex;
+}
+
+BOOST_AUTO_TEST_CASE(txoutsnapshot_roundtrip)
+{
+    std::vector<COutPoint> vOutPoints;
+    for (int i = 0; i < 1000; i++)
+        vOutPoints.push_back(AddRandomCoin());
+
+    boost::filesystem::path path = pathTemp / "utxo.dat";
+    CTxOutSnapshotInfo info;
+    std::string strError;
+    BOOST_CHECK(DumpTxOutSet(path, info, strError));
+    BOOST_CHECK(info.hashBlock == chainActive.Tip()->GetBlockHash());
+    BOOST_CHECK_EQUAL(info.nHeight, 0);
+    BOOST_CHECK_EQUAL(info.nCoins, 1000U);
+    BOOST_CHECK(!DumpTxOutSet(path, info, strError));
+
+    // The active chain has to be below the snapshot
+    CTxOutSnapshotInfo infoLoaded;
+    BOOST_CHECK(!LoadTxOutSet(path, info.hashSerialized, infoLoaded, strError));
+
+    // Coins that are not in the snapshot are gone after loading it, which
+    // takes the hash the snapshot is expected to have
+    COutPoint outpointExtra = AddRandomCoin();
+    CBlockIndex* pindexGenesis = ClearTip();
+    BOOST_CHECK(!LoadTxOutSet(path, uint256(), infoLoaded, strError));
+    BOOST_CHECK(!LoadTxOutSet(path, info.hashBlock, infoLoaded, strError));
+    BOOST_CHECK(LoadTxOutSet(path, info.hashSerialized, infoLoaded, strError));
+    BOOST_CHECK(infoLoaded.hashSerialized == info.hashSerialized);
+    BOOST_CHECK(chainActive.Tip() == pindexGenesis);
+    BOOST_CHECK(pcoinsTip->GetBestBlock() == info.hashBlock);
+    for (size_t i = 0; i < vOutPoints.size(); i++)
+        BOOST_CHECK(pcoinsTip->HaveCoin(vOutPoints[i]));
+    BOOST_CHECK(!pcoinsTip->HaveCoin(outpointExtra));
+    BOOST_CHECK(fHaveTxOutSnapshot);
+
+    // Dumping again gives the same set
+    CTxOutSnapshotInfo infoAgain;
+    BOOST_CHECK(DumpTxOutSet(pathTemp / "utxo2.dat", infoAgain, strError));
+    BOOST_CHECK(infoAgain.hashSerialized == info.hashSerialized);
+    BOOST_CHECK_EQUAL(infoAgain.nCoins, info.nCoins);
+}
+
+BOOST_AUTO_TEST_CASE(txoutsnapshot_corrupt)
+{
+    for (int i = 0; i < 1000; i++)
+        AddRandomCoin();
+    boost::filesystem::path path = pathTemp / "utxo.dat";
+    CTxOutSnapshotInfo info;
+    std::string strError;
+    BOOST_CHECK(DumpTxOutSet(path, info, strError));
+    COutPoint outpointExtra = AddRandomCoin();
+    CBlockIndex* pindexGenesis = ClearTip();
+
+    // Flip a bit of some coin; the checksum no longer matches
+    FILE* file = fopen(path.string().c_str(), "r+b");
+    BOOST_REQUIRE(file);
+    long nPos = boost::filesystem::file_size(path) / 2;
+    fseek(file, nPos, SEEK_SET);
+    int ch = fgetc(file);
+    fseek(file, nPos, SEEK_SET);
+    fputc(ch ^ 1, file);
+    fclose(file);
+    CTxOutSnapshotInfo infoLoaded;
+    BOOST_CHECK(!LoadTxOutSet(path, info.hashSerialized, infoLoaded, strError));
+
+    // Neither is a truncated file loaded
+    boost::filesystem::resize_file(path, boost::filesystem::file_size(path) - 1);
+    BOOST_CHECK(!LoadTxOutSet(path, info.hashSerialized, infoLoaded, strError));
+
+    // and nothing was changed
+    BOOST_CHECK(chainActive.Tip() == NULL);
+    BOOST_CHECK(pcoinsTip->HaveCoin(outpointExtra));
+    BOOST_CHECK(!fHaveTxOutSnapshot);
+
+    LOCK(cs_main);
+    chainActive.SetTip(pindexGenesis);
+}
+
+//! Replace the coin at outpoint by a copy with another height or coinbase flag
+static void ChangeCoin(const COutPoint& outpoint, int nHeightDelta, bool fFlipCoinBase)
+{
+    LOCK(cs_main);
+    Coin coin;
+    BOOST_REQUIRE(pcoinsTip->SpendCoin(outpoint, &coin));
+    pcoinsTip->AddCoin(outpoint, Coin(coin.out, coin.nHeight + nHeightDelta, fFlipCoinBase ? !coin.fCoinBase : coin.fCoinBase), false);
+}
+
+BOOST_AUTO_TEST_CASE(txoutsnapshot_tampered)
+{
+    std::vector<COutPoint> vOutPoints;
+    for (int i = 0; i < 1000; i++)
+        vOutPoints.push_back(AddRandomCoin());
+    CTxOutSnapshotInfo info;
+    std::string strError;
+    BOOST_CHECK(DumpTxOutSet(pathTemp / "utxo.dat", info, strError));
+
+    // A snapshot whose heights or coinbase flags were edited is consistent
+    // in itself, checksum and all, but not with the expected hash
+    ChangeCoin(vOutPoints[500], 1, false);
+    CTxOutSnapshotInfo infoHeight;
+    BOOST_CHECK(DumpTxOutSet(pathTemp / "utxo_height.dat", infoHeight, strError));
+    BOOST_CHECK(infoHeight.hashSerialized != info.hashSerialized);
+    ChangeCoin(vOutPoints[500], -1, true);
+    CTxOutSnapshotInfo infoCoinBase;
+    BOOST_CHECK(DumpTxOutSet(pathTemp / "utxo_coinbase.dat", infoCoinBase, strError));
+    BOOST_CHECK(infoCoinBase.hashSerialized != info.hashSerialized);
+    BOOST_CHECK(infoCoinBase.hashSerialized != infoHeight.hashSerialized);
+
+    CBlockIndex* pindexGenesis = ClearTip();
+    CTxOutSnapshotInfo infoLoaded;
+    BOOST_CHECK(!LoadTxOutSet(pathTemp / "utxo_height.dat", info.hashSerialized, infoLoaded, strError));
+    BOOST_CHECK(!LoadTxOutSet(pathTemp / "utxo_coinbase.dat", info.hashSerialized, infoLoaded, strError));
+    BOOST_CHECK(!fHaveTxOutSnapshot);
+
+    LOCK(cs_main);
+    chainActive.SetTip(pindexGenesis);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -7,43 +7,80 @@
 
 #include "chainparams.h"
 #include "hash.h"
+#include "memusage.h"
 #include "pow.h"
 #include "auxpow/auxpow.h"
+#include "ui_interface.h"
 #include "uint256.h"
 
+#include <algorithm>
 #include <stdint.h>
 
 #include <boost/thread.hpp>
 
 using namespace std;
 
-static const char DB_COINS = 'c';
+static const char DB_COIN = 'C';
+static const char DB_COINS = 'c'; // per-transaction records, before the per-output format
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
-static const char DB_ADDRESSINDEX = 'a';
-static const char DB_ADDRESSUNSPENTINDEX = 'u';
+static const char DB_ADDRESSINDEX = 'X';
+static const char DB_ADDRESSUNSPENTINDEX = 'U';
+static const char DB_ADDRESSINDEX_LEGACY = 'a'; // fixed width format, before ADDRESSINDEX_FORMAT_VERSION 1
+static const char DB_ADDRESSUNSPENTINDEX_LEGACY = 'u';
 static const char DB_TIMESTAMPINDEX = 's';
 static const char DB_BLOCKHASHINDEX = 'z';
 static const char DB_SPENTINDEX = 'p';
+static const char DB_ADDRESSBALANCE = 'w';
+static const char DB_FLAGINDEX = 'g';
 static const char DB_BLOCK_INDEX = 'b';
-static const char DB_BLOCK_INDEX_AUXPOW = 'a';
+static const char DB_BLOCK_INDEX_AUXPOW = 'a'; // pre-split schema: header fields and auxpow together
+static const char DB_BLOCK_INDEX_HEADER = 'h';
+static const char DB_AUXPOW = 'A';
 
 static const char DB_BEST_BLOCK = 'B';
+static const char DB_SNAPSHOT_LOAD = 'L';
 static const char DB_FLAG = 'F';
+static const char DB_INDEX_BUILD = 'I';
+static const char DB_INDEX_BEST = 'i';
+static const char DB_INDEX_VERSION = 'V';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
 
 
+namespace {
+
+/** Chainstate key of one unspent output */
+struct CCoinKey
+{
+    char key;
+    COutPoint outpoint;
+
+    CCoinKey() : key(0) {}
+    CCoinKey(const COutPoint& outpointIn) : key(DB_COIN), outpoint(outpointIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(key);
+        READWRITE(outpoint.hash);
+        READWRITE(VARINT(outpoint.n));
+    }
+};
+
+} // anon namespace
+
 CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true)
 {
 }
 
-bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
-    return db.Read(make_pair(DB_COINS, txid), coins);
+bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    return db.Read(CCoinKey(outpoint), coin);
 }
 
-bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
-    return db.Exists(make_pair(DB_COINS, txid));
+bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
+    return db.Exists(CCoinKey(outpoint));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
@@ -54,29 +91,157 @@ uint256 CCoinsViewDB::GetBestBlock() const {
 }
 
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    bool ret = WriteCoins(mapCoins, hashBlock);
+    mapCoins.clear();
+    return ret;
+}
+
+bool CCoinsViewDB::WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock) {
     CDBBatch batch(db);
-    size_t count = 0;
     size_t changed = 0;
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            if (it->second.coins.IsPruned())
-                batch.Erase(make_pair(DB_COINS, it->first));
+            CCoinKey key(it->first);
+            if (it->second.coin.IsSpent())
+                batch.Erase(key);
             else
-                batch.Write(make_pair(DB_COINS, it->first), it->second.coins);
+                batch.Write(key, it->second.coin);
             changed++;
         }
-        count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
     }
     if (!hashBlock.IsNull())
         batch.Write(DB_BEST_BLOCK, hashBlock);
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    LogPrint("coindb", "Committing %u changed outputs (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)mapCoins.size());
     return db.WriteBatch(batch);
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+CCoinsViewBackgroundFlush::CCoinsViewBackgroundFlush(CCoinsViewDB *dbIn) : db(dbIn), fBackground(false), fFailed(false)
+{
+}
+
+bool CCoinsViewBackgroundFlush::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (pmapPending) {
+            CCoinsMap::const_iterator it = pmapPending->find(outpoint);
+            if (it != pmapPending->end()) {
+                if (it->second.coin.IsSpent())
+                    return false;
+                coin = it->second.coin;
+                return true;
+            }
+        }
+    }
+    // Not part of the pending write, so the database has it right even
+    // while that write goes on
+    return db->GetCoin(outpoint, coin);
+}
+
+bool CCoinsViewBackgroundFlush::HaveCoin(const COutPoint &outpoint) const {
+    Coin coin;
+    return GetCoin(outpoint, coin);
+}
+
+uint256 CCoinsViewBackgroundFlush::GetBestBlock() const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (pmapPending && !hashPending.IsNull())
+            return hashPending;
+    }
+    return db->GetBestBlock();
+}
+
+bool CCoinsViewBackgroundFlush::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    // Take a copy of the changes, the map of the caller goes on being used
+    boost::scoped_ptr<CCoinsMapMemoryResource> presource(new CCoinsMapMemoryResource());
+    boost::scoped_ptr<CCoinsMap> pmap(new CCoinsMap(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), presource.get()));
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY)
+            pmap->insert(*it);
+        CCoinsMap::iterator itOld = it++;
+        mapCoins.erase(itOld);
+    }
+
+    boost::unique_lock<boost::mutex> lock(cs);
+    WaitForWrite(lock);
+    if (fFailed)
+        return false;
+    presourcePending.swap(presource);
+    pmapPending.swap(pmap);
+    hashPending = hashBlock;
+    if (fBackground) {
+        cond.notify_all();
+    } else {
+        WritePending(lock);
+    }
+    return !fFailed;
+}
+
+CCoinsViewCursor *CCoinsViewBackgroundFlush::Cursor() const {
+    // The database cursor does not see the changes still being written
+    boost::unique_lock<boost::mutex> lock(cs);
+    WaitForWrite(lock);
+    return db->Cursor();
+}
+
+bool CCoinsViewBackgroundFlush::Sync() {
+    boost::unique_lock<boost::mutex> lock(cs);
+    WaitForWrite(lock);
+    return !fFailed;
+}
+
+void CCoinsViewBackgroundFlush::WaitForWrite(boost::unique_lock<boost::mutex>& lock) const
+{
+    // Callers may hold changes that exist nowhere else, don't drop them
+    // halfway because of a shutdown
+    boost::this_thread::disable_interruption di;
+    while (pmapPending && !fFailed)
+        cond.wait(lock);
+}
+
+void CCoinsViewBackgroundFlush::WritePending(boost::unique_lock<boost::mutex>& lock)
+{
+    // Lookups only read the pending map, so it is written without the lock
+    const CCoinsMap *pmap = pmapPending.get();
+    uint256 hash = hashPending;
+    lock.unlock();
+    bool fOk = false;
+    try {
+        fOk = db->WriteCoins(*pmap, hash);
+    } catch (const std::exception& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+    lock.lock();
+    if (fOk) {
+        pmapPending.reset();
+        presourcePending.reset();
+    } else {
+        fFailed = true;
+    }
+    cond.notify_all();
+}
+
+void CCoinsViewBackgroundFlush::Thread()
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    fBackground = true;
+    try {
+        while (true) {
+            while (!pmapPending || fFailed)
+                cond.wait(lock);
+            WritePending(lock);
+        }
+    } catch (const boost::thread_interrupted&) {
+        // Finish what is pending; later flushes are written synchronously
+        fBackground = false;
+        if (pmapPending && !fFailed)
+            WritePending(lock);
+        throw;
+    }
+}
+
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe), fSpentFilterLoaded(false) {
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -105,25 +270,30 @@ CCoinsViewCursor *CCoinsViewDB::Cursor() const
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
-    i->pcursor->Seek(DB_COINS);
+    i->pcursor->Seek(DB_COIN);
     // Cache key of first record
-    i->pcursor->GetKey(i->keyTmp);
+    CCoinKey entry;
+    if (i->pcursor->Valid() && i->pcursor->GetKey(entry)) {
+        i->keyTmp = make_pair(entry.key, entry.outpoint);
+    } else {
+        i->keyTmp.first = 0; // Make sure Valid() and GetKey() return false
+    }
     return i;
 }
 
-bool CCoinsViewDBCursor::GetKey(uint256 &key) const
+bool CCoinsViewDBCursor::GetKey(COutPoint &key) const
 {
     // Return cached key
-    if (keyTmp.first == DB_COINS) {
+    if (keyTmp.first == DB_COIN) {
         key = keyTmp.second;
         return true;
     }
     return false;
 }
 
-bool CCoinsViewDBCursor::GetValue(CCoins &coins) const
+bool CCoinsViewDBCursor::GetValue(Coin &coin) const
 {
-    return pcursor->GetValue(coins);
+    return pcursor->GetValue(coin);
 }
 
 unsigned int CCoinsViewDBCursor::GetValueSize() const
@@ -133,14 +303,168 @@ unsigned int CCoinsViewDBCursor::GetValueSize() const
 
 bool CCoinsViewDBCursor::Valid() const
 {
-    return keyTmp.first == DB_COINS;
+    return keyTmp.first == DB_COIN;
 }
 
 void CCoinsViewDBCursor::Next()
 {
     pcursor->Next();
-    if (!pcursor->Valid() || !pcursor->GetKey(keyTmp))
+    CCoinKey entry;
+    if (!pcursor->Valid() || !pcursor->GetKey(entry)) {
         keyTmp.first = 0; // Invalidate cached key after last record so that Valid() and GetKey() return false
+    } else {
+        keyTmp = make_pair(entry.key, entry.outpoint);
+    }
+}
+
+namespace {
+
+/**
+ * Per-transaction chainstate record from before the per-output format: the
+ * unspent outputs of one transaction, with an unspentness bitvector for all
+ * but the first two. Only needed to read old databases during the upgrade.
+ */
+struct CLegacyCoins
+{
+    bool fCoinBase;
+    std::vector<CTxOut> vout;
+    int nHeight;
+
+    CLegacyCoins() : fCoinBase(false), nHeight(0) {}
+
+    template<typename Stream>
+    void Unserialize(Stream &s, int nType, int nVersion) {
+        unsigned int nCode = 0;
+        // version
+        int nVersionDummy;
+        ::Unserialize(s, VARINT(nVersionDummy), nType, nVersion);
+        // header code
+        ::Unserialize(s, VARINT(nCode), nType, nVersion);
+        fCoinBase = nCode & 1;
+        std::vector<bool> vAvail(2, false);
+        vAvail[0] = (nCode & 2) != 0;
+        vAvail[1] = (nCode & 4) != 0;
+        unsigned int nMaskCode = (nCode / 8) + ((nCode & 6) != 0 ? 0 : 1);
+        // spentness bitmask
+        while (nMaskCode > 0) {
+            unsigned char chAvail = 0;
+            ::Unserialize(s, chAvail, nType, nVersion);
+            for (unsigned int p = 0; p < 8; p++) {
+                bool f = (chAvail & (1 << p)) != 0;
+                vAvail.push_back(f);
+            }
+            if (chAvail != 0)
+                nMaskCode--;
+        }
+        // txouts themself
+        vout.assign(vAvail.size(), CTxOut());
+        for (unsigned int i = 0; i < vAvail.size(); i++) {
+            if (vAvail[i])
+                ::Unserialize(s, REF(CTxOutCompressor(vout[i])), nType, nVersion);
+        }
+        // coinbase height
+        ::Unserialize(s, VARINT(nHeight), nType, nVersion);
+    }
+};
+
+} // anon namespace
+
+bool CCoinsViewDB::Upgrade() {
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(DB_COINS);
+    std::pair<char, uint256> key;
+    if (!pcursor->Valid() || !pcursor->GetKey(key) || key.first != DB_COINS)
+        return true;
+
+    // Every batch writes the outputs of a range of transactions under their
+    // own keys and erases the per-transaction records, so an interrupted
+    // upgrade resumes where it stopped.
+    LogPrintf("Upgrading the chainstate database to per-output records...\n");
+    uiInterface.ShowProgress(_("Upgrading UTXO database"), 0);
+    boost::scoped_ptr<CDBBatch> pbatch(new CDBBatch(db));
+    size_t nTransactions = 0;
+    size_t nOutputs = 0;
+    int nReportDone = 0;
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        if (!pcursor->GetKey(key) || key.first != DB_COINS)
+            break;
+        CLegacyCoins coins;
+        if (!pcursor->GetValue(coins))
+            return error("%s: cannot parse coins record of %s", __func__, key.second.ToString());
+        COutPoint outpoint(key.second, 0);
+        for (unsigned int i = 0; i < coins.vout.size(); i++) {
+            if (!coins.vout[i].IsNull() && !coins.vout[i].scriptPubKey.IsUnspendable()) {
+                outpoint.n = i;
+                pbatch->Write(CCoinKey(outpoint), Coin(coins.vout[i], coins.nHeight, coins.fCoinBase));
+                nOutputs++;
+            }
+        }
+        pbatch->Erase(key);
+        if (++nTransactions % 10000 == 0) {
+            if (!db.WriteBatch(*pbatch))
+                return error("%s: failed to write chainstate", __func__);
+            pbatch.reset(new CDBBatch(db));
+            // The records are ordered by txid, so its leading bytes tell how far along we are
+            uint32_t nHigh = 0x100 * *key.second.begin() + *(key.second.begin() + 1);
+            int nPercentageDone = (int)(nHigh * 100.0 / 65536.0 + 0.5);
+            uiInterface.ShowProgress(_("Upgrading UTXO database"), nPercentageDone);
+            if (nReportDone < nPercentageDone / 10) {
+                LogPrintf("[%d%%]...", nPercentageDone);
+                nReportDone = nPercentageDone / 10;
+            }
+        }
+        pcursor->Next();
+    }
+    if (!db.WriteBatch(*pbatch, true))
+        return error("%s: failed to write chainstate", __func__);
+    uiInterface.ShowProgress("", 100);
+    LogPrintf("Upgraded %u transactions into %u unspent outputs\n", nTransactions, nOutputs);
+    return true;
+}
+
+bool CCoinsViewDB::BeginSnapshotLoad(const uint256 &hashBlock) {
+    CDBBatch batch(db);
+    batch.Write(DB_SNAPSHOT_LOAD, hashBlock);
+    batch.Erase(DB_BEST_BLOCK);
+    if (!db.WriteBatch(batch, true))
+        return false;
+
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(DB_COIN);
+    boost::scoped_ptr<CDBBatch> pbatch(new CDBBatch(db));
+    size_t nErased = 0;
+    CCoinKey key;
+    while (pcursor->Valid() && pcursor->GetKey(key) && key.key == DB_COIN) {
+        boost::this_thread::interruption_point();
+        pbatch->Erase(key);
+        if (++nErased % 100000 == 0) {
+            if (!db.WriteBatch(*pbatch))
+                return false;
+            pbatch.reset(new CDBBatch(db));
+        }
+        pcursor->Next();
+    }
+    LogPrint("coindb", "Erased %u outputs for the snapshot of %s\n", nErased, hashBlock.ToString());
+    return db.WriteBatch(*pbatch);
+}
+
+bool CCoinsViewDB::WriteSnapshotCoins(const std::vector<std::pair<COutPoint, Coin> > &vCoins) {
+    CDBBatch batch(db);
+    for (std::vector<std::pair<COutPoint, Coin> >::const_iterator it = vCoins.begin(); it != vCoins.end(); it++)
+        batch.Write(CCoinKey(it->first), it->second);
+    return db.WriteBatch(batch);
+}
+
+bool CCoinsViewDB::EndSnapshotLoad(const uint256 &hashBlock) {
+    CDBBatch batch(db);
+    batch.Write(DB_BEST_BLOCK, hashBlock);
+    batch.Erase(DB_SNAPSHOT_LOAD);
+    return db.WriteBatch(batch, true);
+}
+
+bool CCoinsViewDB::IsSnapshotLoadInterrupted() const {
+    return db.Exists(DB_SNAPSHOT_LOAD);
 }
 
 /*
@@ -157,27 +481,58 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
 }
 */
 
-bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo, const std::map<uint256, std::shared_ptr<CAuxPow> >& auxpows) {
+bool CIndexCache::IsEmpty() const {
+    return mapAddressIndex.empty() && mapAddressUnspentIndex.empty() && mapAddressBalance.empty() &&
+           mapSpentIndex.empty() && mapTimestampIndex.empty() && mapFlagIndex.empty() && mapIndexBest.empty();
+}
+
+void CIndexCache::Clear() {
+    mapAddressIndex.clear();
+    mapAddressUnspentIndex.clear();
+    mapAddressBalance.clear();
+    mapSpentIndex.clear();
+    mapTimestampIndex.clear();
+    mapFlagIndex.clear();
+    mapIndexBest.clear();
+}
+
+size_t CIndexCache::DynamicMemoryUsage() const {
+    return memusage::DynamicUsage(mapAddressIndex) + memusage::DynamicUsage(mapAddressUnspentIndex) +
+           memusage::DynamicUsage(mapAddressBalance) + memusage::DynamicUsage(mapSpentIndex) +
+           memusage::DynamicUsage(mapTimestampIndex) + memusage::DynamicUsage(mapFlagIndex);
+}
+
+bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo, const std::map<uint256, std::shared_ptr<CAuxPow> >& auxpows, bool fIndexCache) {
+    LOCK(cs_indexcache);
     CDBBatch batch(*this);
+    if (fIndexCache)
+        BatchIndexCache(batch);
     for (std::vector<std::pair<int, const CBlockFileInfo*> >::const_iterator it=fileInfo.begin(); it != fileInfo.end(); it++) {
         batch.Write(make_pair(DB_BLOCK_FILES, it->first), *it->second);
     }
     batch.Write(DB_LAST_BLOCK, nLastFile);
     for (std::vector<const CBlockIndex*>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
-        const std::map<uint256, std::shared_ptr<CAuxPow> >::const_iterator auxIt = auxpows.find((*it)->GetBlockHash());
-        if (auxIt != auxpows.end()) {
-//                LogPrint("txdb", "CBlockTreeDB::WriteBatchSync(): writing an auxpow block (%s)) \n", (*it)->GetBlockHash().ToString()); // LEDTMP
-            batch.Write(make_pair(make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), DB_BLOCK_INDEX_AUXPOW), CDiskBlockIndex(*it, auxIt->second));
-        }
-//                LogPrint("txdb", "CBlockTreeDB::WriteBatchSync(): writing a normal block (%s)) \n", (*it)->GetBlockHash().ToString()); // LEDTMP
-        batch.Write(make_pair(make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), DB_BLOCK_INDEX), **it);
+        const uint256 hash = (*it)->GetBlockHash();
+        batch.Write(make_pair(make_pair(DB_BLOCK_INDEX, hash), DB_BLOCK_INDEX_HEADER), CDiskBlockHeaderIndex(*it));
+        const std::map<uint256, std::shared_ptr<CAuxPow> >::const_iterator auxIt = auxpows.find(hash);
+        if (auxIt != auxpows.end() && auxIt->second && ((*it)->nVersion & AuxPow::BLOCK_VERSION_AUXPOW))
+            batch.Write(make_pair(DB_AUXPOW, hash), *auxIt->second);
+        batch.Write(make_pair(make_pair(DB_BLOCK_INDEX, hash), DB_BLOCK_INDEX), **it);
     }
-    return WriteBatch(batch, true);
+    if (!WriteBatch(batch, true))
+        return false;
+    if (fIndexCache)
+        indexCache.Clear();
+    return true;
 }
 
-bool CBlockTreeDB::ReadDiskBlockIndex(const uint256 &blkid, CDiskBlockIndex &diskblockindex)
+bool CBlockTreeDB::ReadAuxPow(const uint256 &blkid, std::shared_ptr<CAuxPow>& auxpow)
 {
-    return Read(make_pair(make_pair(DB_BLOCK_INDEX, blkid), DB_BLOCK_INDEX_AUXPOW), diskblockindex);
+    std::shared_ptr<CAuxPow> auxpowRead(new CAuxPow());
+    if (!Read(make_pair(DB_AUXPOW, blkid), *auxpowRead))
+        return false;
+    auxpow = auxpowRead;
+    return true;
 }
 
 
@@ -194,11 +549,80 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
 
 
 bool CBlockTreeDB::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value) {
+    {
+        LOCK(cs_indexcache);
+        std::map<CSpentIndexKey, CSpentIndexValue, CSpentIndexKeyCompare>::const_iterator it = indexCache.mapSpentIndex.find(key);
+        if (it != indexCache.mapSpentIndex.end()) {
+            if (it->second.IsNull())
+                return false;
+            value = it->second;
+            return true;
+        }
+    }
+    {
+        // Most lookups are for outputs that are still unspent
+        LOCK(cs_spentfilter);
+        if (fSpentFilterLoaded && !pspentfilter->contains(COutPoint(key.txid, key.outputIndex)))
+            return false;
+    }
     return Read(make_pair(DB_SPENTINDEX, key), value);
 }
 
-bool CBlockTreeDB::UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >&vect) {
-    CDBBatch batch(*this);
+void CBlockTreeDB::AddSpentFilter(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > &vect) {
+    LOCK(cs_spentfilter);
+    if (!pspentfilter)
+        return;
+    for (std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
+        if (!it->second.IsNull())
+            pspentfilter->insert(COutPoint(it->first.txid, it->first.outputIndex));
+    }
+}
+
+void CBlockTreeDB::InitSpentFilter(unsigned int nElements) {
+    // Keys written from now on are added by the writers, keys already
+    // buffered are added here and keys on disk by LoadSpentFilter.
+    // Disconnected blocks leave theirs in the filter, which only costs a
+    // lookup.
+    LOCK2(cs_indexcache, cs_spentfilter);
+    pspentfilter.reset(new CBlockedBloomFilter(nElements, 0.01));
+    fSpentFilterLoaded = false;
+    LogPrintf("Using %.1fMiB for the spent index filter (room for %u outputs)\n", pspentfilter->DynamicMemoryUsage() * (1.0 / 1024 / 1024), nElements);
+    for (std::map<CSpentIndexKey, CSpentIndexValue, CSpentIndexKeyCompare>::const_iterator it=indexCache.mapSpentIndex.begin(); it!=indexCache.mapSpentIndex.end(); it++) {
+        if (!it->second.IsNull())
+            pspentfilter->insert(COutPoint(it->first.txid, it->first.outputIndex));
+    }
+}
+
+bool CBlockTreeDB::LoadSpentFilter() {
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(DB_SPENTINDEX);
+    std::vector<COutPoint> vKeys;
+    while (true) {
+        boost::this_thread::interruption_point();
+        std::pair<char, CSpentIndexKey> key;
+        const bool fValid = pcursor->Valid() && pcursor->GetKey(key) && key.first == DB_SPENTINDEX;
+        if (fValid)
+            vKeys.push_back(COutPoint(key.second.txid, key.second.outputIndex));
+        if (!fValid || vKeys.size() >= 10000) {
+            LOCK(cs_spentfilter);
+            if (!pspentfilter)
+                return false;
+            for (std::vector<COutPoint>::const_iterator it=vKeys.begin(); it!=vKeys.end(); it++)
+                pspentfilter->insert(*it);
+            vKeys.clear();
+        }
+        if (!fValid)
+            break;
+        pcursor->Next();
+    }
+
+    LOCK(cs_spentfilter);
+    fSpentFilterLoaded = true;
+    return true;
+}
+
+void CBlockTreeDB::BatchSpentIndex(CDBBatch &batch, const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > &vect) {
+    AddSpentFilter(vect);
     for (std::vector<std::pair<CSpentIndexKey,CSpentIndexValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
         if (it->second.IsNull()) {
             batch.Erase(make_pair(DB_SPENTINDEX, it->first));
@@ -206,11 +630,25 @@ bool CBlockTreeDB::UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey,
             batch.Write(make_pair(DB_SPENTINDEX, it->first), it->second);
         }
     }
-    return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect) {
+void CBlockTreeDB::BatchFlagIndex(CDBBatch &batch, const std::vector<std::pair<CFlagIndexKey, CFlagIndexValue> > &vect) {
+    for (std::vector<std::pair<CFlagIndexKey, CFlagIndexValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
+        if (it->second.IsNull()) {
+            batch.Erase(make_pair(DB_FLAGINDEX, it->first));
+        } else {
+            batch.Write(make_pair(DB_FLAGINDEX, it->first), it->second);
+        }
+    }
+}
+
+bool CBlockTreeDB::UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >&vect) {
     CDBBatch batch(*this);
+    BatchSpentIndex(batch, vect);
+    return WriteBatch(batch);
+}
+
+void CBlockTreeDB::BatchAddressUnspentIndex(CDBBatch &batch, const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect) {
     for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
         if (it->second.IsNull()) {
             batch.Erase(make_pair(DB_ADDRESSUNSPENTINDEX, it->first));
@@ -218,22 +656,100 @@ bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<std::pair<CAddres
             batch.Write(make_pair(DB_ADDRESSUNSPENTINDEX, it->first), it->second);
         }
     }
+}
+
+bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect) {
+    CDBBatch batch(*this);
+    BatchAddressUnspentIndex(batch, vect);
     return WriteBatch(batch);
 }
 
+namespace {
+
+/**
+ * Apply records buffered in the index cache to the records read from the
+ * database from nStart on. Both are sorted by Compare, which follows the
+ * database order within one address or flag. A buffered record replaces a
+ * stored one with the same key, or drops it when it is an erasure. Keeps at
+ * most nLimit records, unless that is 0.
+ */
+template<typename K, typename V, typename Compare>
+void MergeCachedRecords(std::vector<std::pair<K, V> > &vect, size_t nStart,
+                        const std::vector<std::pair<K, std::pair<bool, V> > > &vCached, size_t nLimit)
+{
+    if (vCached.empty())
+        return;
+    Compare compare;
+    std::vector<std::pair<K, V> > vMerged;
+    vMerged.reserve(vect.size() - nStart + vCached.size());
+    typename std::vector<std::pair<K, V> >::const_iterator it = vect.begin() + nStart;
+    typename std::vector<std::pair<K, std::pair<bool, V> > >::const_iterator cit = vCached.begin();
+    while (it != vect.end() || cit != vCached.end()) {
+        if (cit == vCached.end() || (it != vect.end() && compare(it->first, cit->first))) {
+            vMerged.push_back(*it++);
+            continue;
+        }
+        if (it != vect.end() && !compare(cit->first, it->first))
+            it++;
+        if (!cit->second.first)
+            vMerged.push_back(std::make_pair(cit->first, cit->second.second));
+        cit++;
+    }
+    if (nLimit > 0 && vMerged.size() > nLimit)
+        vMerged.resize(nLimit);
+    vect.resize(nStart);
+    vect.insert(vect.end(), vMerged.begin(), vMerged.end());
+}
+
+}
+
 bool CBlockTreeDB::ReadAddressUnspentIndex(uint160 addressHash, int type,
-                                           std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs) {
+                                           std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs,
+                                           const CAddressUnspentKey *pAfter, size_t nLimit) {
+
+    // Buffered records of the address, behind pAfter
+    std::vector<std::pair<CAddressUnspentKey, std::pair<bool, CAddressUnspentValue> > > vCached;
+    size_t nErased = 0;
+    {
+        LOCK(cs_indexcache);
+        CAddressUnspentKeyCompare compare;
+        std::map<CAddressUnspentKey, CAddressUnspentValue, CAddressUnspentKeyCompare>::const_iterator it =
+            indexCache.mapAddressUnspentIndex.lower_bound(CAddressUnspentKey(type, addressHash, uint256(), 0));
+        for (; it != indexCache.mapAddressUnspentIndex.end() && (int)it->first.type == type && it->first.hashBytes == addressHash; it++) {
+            if (pAfter && !compare(*pAfter, it->first))
+                continue;
+            vCached.push_back(std::make_pair(it->first, std::make_pair(it->second.IsNull(), it->second)));
+            vCached.back().second.second.script = GetAddressScript(it->first.type, it->first.hashBytes);
+            if (it->second.IsNull())
+                nErased++;
+        }
+    }
 
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
-    pcursor->Seek(make_pair(DB_ADDRESSUNSPENTINDEX, CAddressIndexIteratorKey(type, addressHash)));
+    if (pAfter) {
+        // Continue behind the last output of the previous page
+        pcursor->Seek(make_pair(DB_ADDRESSUNSPENTINDEX, *pAfter));
+        std::pair<char,CAddressUnspentKey> key;
+        if (pcursor->Valid() && pcursor->GetKey(key) && key.first == DB_ADDRESSUNSPENTINDEX &&
+            key.second.hashBytes == pAfter->hashBytes && key.second.txhash == pAfter->txhash && key.second.index == pAfter->index) {
+            pcursor->Next();
+        }
+    } else {
+        pcursor->Seek(make_pair(DB_ADDRESSUNSPENTINDEX, CAddressIndexIteratorKey(type, addressHash)));
+    }
 
+    const size_t nStart = unspentOutputs.size();
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
+        if (nLimit > 0 && unspentOutputs.size() - nStart >= nLimit + nErased) {
+            break;
+        }
         std::pair<char,CAddressUnspentKey> key;
         if (pcursor->GetKey(key) && key.first == DB_ADDRESSUNSPENTINDEX && key.second.hashBytes == addressHash) {
             CAddressUnspentValue nValue;
             if (pcursor->GetValue(nValue)) {
+                nValue.script = GetAddressScript(key.second.type, key.second.hashBytes);
                 unspentOutputs.push_back(make_pair(key.second, nValue));
                 pcursor->Next();
             } else {
@@ -244,44 +760,450 @@ bool CBlockTreeDB::ReadAddressUnspentIndex(uint160 addressHash, int type,
         }
     }
 
+    MergeCachedRecords<CAddressUnspentKey, CAddressUnspentValue, CAddressUnspentKeyCompare>(unspentOutputs, nStart, vCached, nLimit);
     return true;
 }
 
+/**
+ * Add the balance changes of the address index entries of one block to
+ * mapDeltas, or subtract them for fUndo. Addresses whose changes cancel out
+ * are removed again.
+ */
+static void AddAddressBalanceDeltas(std::map<std::pair<unsigned int, uint160>, CAddressBalanceValue> &mapDeltas,
+                                    const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect, bool fUndo) {
+    // vect holds the entries of one block. The entries of a transaction are
+    // contiguous for each address, so a change of txhash starts a new
+    // transaction for that address.
+    const int nSign = fUndo ? -1 : 1;
+    std::map<std::pair<unsigned int, uint160>, uint256> mapLastTx;
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
+        const std::pair<unsigned int, uint160> address(it->first.type, it->first.hashBytes);
+        CAddressBalanceValue &delta = mapDeltas[address];
+        delta.balance += nSign * it->second;
+        if (!it->first.spending)
+            delta.received += nSign * it->second;
+        std::map<std::pair<unsigned int, uint160>, uint256>::iterator itLast = mapLastTx.find(address);
+        if (itLast == mapLastTx.end() || itLast->second != it->first.txhash) {
+            delta.txCount += nSign;
+            mapLastTx[address] = it->first.txhash;
+        }
+    }
+
+    for (std::map<std::pair<unsigned int, uint160>, uint256>::const_iterator it=mapLastTx.begin(); it!=mapLastTx.end(); it++) {
+        const CAddressBalanceValue &delta = mapDeltas[it->first];
+        if (delta.balance == 0 && delta.received == 0 && delta.txCount == 0)
+            mapDeltas.erase(it->first);
+    }
+}
+
+void CBlockTreeDB::BatchAddressBalances(CDBBatch &batch, const std::map<std::pair<unsigned int, uint160>, CAddressBalanceValue> &mapDeltas) {
+    for (std::map<std::pair<unsigned int, uint160>, CAddressBalanceValue>::const_iterator it=mapDeltas.begin(); it!=mapDeltas.end(); it++) {
+        const CAddressIndexIteratorKey key(it->first.first, it->first.second);
+        CAddressBalanceValue value;
+        Read(make_pair(DB_ADDRESSBALANCE, key), value);
+        value.balance += it->second.balance;
+        value.received += it->second.received;
+        value.txCount += it->second.txCount;
+        if (value.txCount <= 0) {
+            batch.Erase(make_pair(DB_ADDRESSBALANCE, key));
+        } else {
+            batch.Write(make_pair(DB_ADDRESSBALANCE, key), value);
+        }
+    }
+}
+
+void CBlockTreeDB::UpdateAddressBalances(CDBBatch &batch, const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect, bool fUndo) {
+    std::map<std::pair<unsigned int, uint160>, CAddressBalanceValue> mapDeltas;
+    AddAddressBalanceDeltas(mapDeltas, vect, fUndo);
+    BatchAddressBalances(batch, mapDeltas);
+}
+
+void CBlockTreeDB::BatchAddressIndex(CDBBatch &batch, const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect, bool fErase) {
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
+        if (fErase) {
+            batch.Erase(make_pair(DB_ADDRESSINDEX, it->first));
+        } else {
+            batch.Write(make_pair(DB_ADDRESSINDEX, it->first), CAddressIndexAmount(REF(it->second)));
+        }
+    }
+    UpdateAddressBalances(batch, vect, fErase);
+}
+
 bool CBlockTreeDB::WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
     CDBBatch batch(*this);
-    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
-        batch.Write(make_pair(DB_ADDRESSINDEX, it->first), it->second);
+    BatchAddressIndex(batch, vect, false);
     return WriteBatch(batch);
 }
 
 bool CBlockTreeDB::EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
     CDBBatch batch(*this);
-    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
-        batch.Erase(make_pair(DB_ADDRESSINDEX, it->first));
+    BatchAddressIndex(batch, vect, true);
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::ReadAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &value) {
+    LOCK(cs_indexcache);
+    const bool fFound = Read(make_pair(DB_ADDRESSBALANCE, CAddressIndexIteratorKey(type, addressHash)), value);
+    std::map<std::pair<unsigned int, uint160>, CAddressBalanceValue>::const_iterator it = indexCache.mapAddressBalance.find(std::make_pair((unsigned int)type, addressHash));
+    if (it == indexCache.mapAddressBalance.end())
+        return fFound;
+    if (!fFound)
+        value.SetNull();
+    value.balance += it->second.balance;
+    value.received += it->second.received;
+    value.txCount += it->second.txCount;
+    return value.txCount > 0;
+}
+
+void CBlockTreeDB::CacheAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect, bool fErase) {
+    LOCK(cs_indexcache);
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        indexCache.mapAddressIndex[it->first] = std::make_pair(fErase, it->second);
+    AddAddressBalanceDeltas(indexCache.mapAddressBalance, vect, fErase);
+}
+
+void CBlockTreeDB::CacheAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect) {
+    LOCK(cs_indexcache);
+    for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        indexCache.mapAddressUnspentIndex[it->first] = it->second;
+}
+
+void CBlockTreeDB::CacheSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > &vect) {
+    LOCK(cs_indexcache);
+    for (std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        indexCache.mapSpentIndex[it->first] = it->second;
+    AddSpentFilter(vect);
+}
+
+void CBlockTreeDB::CacheTimestampIndex(const uint256 &hash, unsigned int logicalTS) {
+    LOCK(cs_indexcache);
+    indexCache.mapTimestampIndex[hash] = logicalTS;
+}
+
+void CBlockTreeDB::CacheIndexBest(const std::string &name, const uint256 &hashBlock) {
+    LOCK(cs_indexcache);
+    indexCache.mapIndexBest[name] = hashBlock;
+}
+
+void CBlockTreeDB::CacheFlagIndex(const std::vector<std::pair<CFlagIndexKey, CFlagIndexValue> > &vect) {
+    LOCK(cs_indexcache);
+    for (std::vector<std::pair<CFlagIndexKey, CFlagIndexValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        indexCache.mapFlagIndex[it->first] = it->second;
+}
+
+size_t CBlockTreeDB::IndexCacheUsage() const {
+    LOCK(cs_indexcache);
+    return indexCache.DynamicMemoryUsage();
+}
+
+void CBlockTreeDB::BatchIndexCache(CDBBatch &batch) {
+    AssertLockHeld(cs_indexcache);
+    for (std::map<CAddressIndexKey, std::pair<bool, CAmount>, CAddressIndexKeyHeightCompare>::iterator it=indexCache.mapAddressIndex.begin(); it!=indexCache.mapAddressIndex.end(); it++) {
+        if (it->second.first) {
+            batch.Erase(make_pair(DB_ADDRESSINDEX, it->first));
+        } else {
+            batch.Write(make_pair(DB_ADDRESSINDEX, it->first), CAddressIndexAmount(it->second.second));
+        }
+    }
+    for (std::map<CAddressUnspentKey, CAddressUnspentValue, CAddressUnspentKeyCompare>::const_iterator it=indexCache.mapAddressUnspentIndex.begin(); it!=indexCache.mapAddressUnspentIndex.end(); it++) {
+        if (it->second.IsNull()) {
+            batch.Erase(make_pair(DB_ADDRESSUNSPENTINDEX, it->first));
+        } else {
+            batch.Write(make_pair(DB_ADDRESSUNSPENTINDEX, it->first), it->second);
+        }
+    }
+    BatchAddressBalances(batch, indexCache.mapAddressBalance);
+    for (std::map<CSpentIndexKey, CSpentIndexValue, CSpentIndexKeyCompare>::const_iterator it=indexCache.mapSpentIndex.begin(); it!=indexCache.mapSpentIndex.end(); it++) {
+        if (it->second.IsNull()) {
+            batch.Erase(make_pair(DB_SPENTINDEX, it->first));
+        } else {
+            batch.Write(make_pair(DB_SPENTINDEX, it->first), it->second);
+        }
+    }
+    for (std::map<uint256, unsigned int>::const_iterator it=indexCache.mapTimestampIndex.begin(); it!=indexCache.mapTimestampIndex.end(); it++) {
+        batch.Write(make_pair(DB_TIMESTAMPINDEX, CTimestampIndexKey(it->second, it->first)), 0);
+        batch.Write(make_pair(DB_BLOCKHASHINDEX, CTimestampBlockIndexKey(it->first)), CTimestampBlockIndexValue(it->second));
+    }
+    for (std::map<CFlagIndexKey, CFlagIndexValue, CFlagIndexKeyCompare>::const_iterator it=indexCache.mapFlagIndex.begin(); it!=indexCache.mapFlagIndex.end(); it++) {
+        if (it->second.IsNull()) {
+            batch.Erase(make_pair(DB_FLAGINDEX, it->first));
+        } else {
+            batch.Write(make_pair(DB_FLAGINDEX, it->first), it->second);
+        }
+    }
+    for (std::map<std::string, uint256>::const_iterator it=indexCache.mapIndexBest.begin(); it!=indexCache.mapIndexBest.end(); it++)
+        batch.Write(std::make_pair(DB_INDEX_BEST, it->first), it->second);
+}
+
+bool CBlockTreeDB::EraseAddressBalances() {
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(make_pair(DB_ADDRESSBALANCE, CAddressIndexIteratorKey()));
+
+    CDBBatch batch(*this);
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, CAddressIndexIteratorKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_ADDRESSBALANCE)
+            break;
+        batch.Erase(key);
+        pcursor->Next();
+    }
+    batch.Write(make_pair(DB_FLAG, std::string("addressbalance")), '1');
+    return WriteBatch(batch, true);
+}
+
+namespace {
+
+/** Address index key in the fixed width format from before ADDRESSINDEX_FORMAT_VERSION 1 */
+struct CLegacyAddressIndexKey
+{
+    CAddressIndexKey key;
+
+    size_t GetSerializeSize(int nType, int nVersion) const {
+        return 66;
+    }
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const {
+        ser_writedata8(s, key.type);
+        key.hashBytes.Serialize(s, nType, nVersion);
+        ser_writedata32be(s, key.blockHeight);
+        ser_writedata32be(s, key.txindex);
+        key.txhash.Serialize(s, nType, nVersion);
+        ser_writedata32(s, key.index);
+        ser_writedata8(s, key.spending);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion) {
+        key.type = ser_readdata8(s);
+        key.hashBytes.Unserialize(s, nType, nVersion);
+        key.blockHeight = ser_readdata32be(s);
+        key.txindex = ser_readdata32be(s);
+        key.txhash.Unserialize(s, nType, nVersion);
+        key.index = ser_readdata32(s);
+        key.spending = ser_readdata8(s);
+    }
+};
+
+struct CLegacyAddressUnspentKey
+{
+    CAddressUnspentKey key;
+
+    size_t GetSerializeSize(int nType, int nVersion) const {
+        return 57;
+    }
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const {
+        ser_writedata8(s, key.type);
+        key.hashBytes.Serialize(s, nType, nVersion);
+        key.txhash.Serialize(s, nType, nVersion);
+        ser_writedata32(s, key.index);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion) {
+        key.type = ser_readdata8(s);
+        key.hashBytes.Unserialize(s, nType, nVersion);
+        key.txhash.Unserialize(s, nType, nVersion);
+        key.index = ser_readdata32(s);
+    }
+};
+
+struct CLegacyAddressUnspentValue
+{
+    CAddressUnspentValue value;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(value.satoshis);
+        READWRITE(*(CScriptBase*)(&value.script));
+        READWRITE(value.blockHeight);
+    }
+};
+
+} // anon namespace
+
+bool CBlockTreeDB::UpgradeAddressIndexFormat() {
+    int nVersion = 0;
+    if (Read(std::make_pair(DB_INDEX_VERSION, std::string("addressindex")), nVersion) && nVersion >= ADDRESSINDEX_FORMAT_VERSION)
+        return true;
+
+    // Every batch writes a range of records under the new keys and erases
+    // them under the old ones, so an interrupted upgrade resumes where it
+    // stopped.
+    LogPrintf("Upgrading the address index to format version %d...\n", ADDRESSINDEX_FORMAT_VERSION);
+    boost::scoped_ptr<CDBBatch> pbatch(new CDBBatch(*this));
+    size_t nRecords = 0;
+    {
+        boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+        pcursor->Seek(DB_ADDRESSINDEX_LEGACY);
+        while (pcursor->Valid()) {
+            boost::this_thread::interruption_point();
+            std::pair<char, CLegacyAddressIndexKey> key;
+            if (!pcursor->GetKey(key) || key.first != DB_ADDRESSINDEX_LEGACY)
+                break;
+            CAmount nValue;
+            if (!pcursor->GetValue(nValue))
+                return error("%s: failed to get address index value", __func__);
+            pbatch->Write(make_pair(DB_ADDRESSINDEX, key.second.key), CAddressIndexAmount(nValue));
+            pbatch->Erase(key);
+            if (++nRecords % 10000 == 0) {
+                if (!WriteBatch(*pbatch))
+                    return error("%s: failed to write address index", __func__);
+                pbatch.reset(new CDBBatch(*this));
+            }
+            pcursor->Next();
+        }
+    }
+    {
+        boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+        pcursor->Seek(DB_ADDRESSUNSPENTINDEX_LEGACY);
+        while (pcursor->Valid()) {
+            boost::this_thread::interruption_point();
+            std::pair<char, CLegacyAddressUnspentKey> key;
+            if (!pcursor->GetKey(key) || key.first != DB_ADDRESSUNSPENTINDEX_LEGACY)
+                break;
+            CLegacyAddressUnspentValue value;
+            if (!pcursor->GetValue(value))
+                return error("%s: failed to get address unspent value", __func__);
+            pbatch->Write(make_pair(DB_ADDRESSUNSPENTINDEX, key.second.key), value.value);
+            pbatch->Erase(key);
+            if (++nRecords % 10000 == 0) {
+                if (!WriteBatch(*pbatch))
+                    return error("%s: failed to write address unspent index", __func__);
+                pbatch.reset(new CDBBatch(*this));
+            }
+            pcursor->Next();
+        }
+    }
+    pbatch->Write(std::make_pair(DB_INDEX_VERSION, std::string("addressindex")), ADDRESSINDEX_FORMAT_VERSION);
+    if (!WriteBatch(*pbatch, true))
+        return error("%s: failed to write address index", __func__);
+    LogPrintf("Upgraded %u address index records\n", nRecords);
+    return true;
+}
+
+bool CBlockTreeDB::UpgradeAddressBalances() {
+    bool fBalances = false;
+    if (ReadFlag("addressbalance", fBalances) && fBalances)
+        return true;
+
+    // Sum up the existing address index. Its keys are ordered by address,
+    // then height, txindex and txhash, so every address and every
+    // transaction within it is one contiguous run.
+    LogPrintf("Building address balance index...\n");
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey()));
+
+    boost::scoped_ptr<CDBBatch> pbatch(new CDBBatch(*this));
+    std::pair<char, CAddressIndexKey> key;
+    CAddressIndexIteratorKey current;
+    CAddressBalanceValue value;
+    uint256 lastTx;
+    size_t nAddresses = 0;
+    while (true) {
+        boost::this_thread::interruption_point();
+        bool fValid = pcursor->Valid() && pcursor->GetKey(key) && key.first == DB_ADDRESSINDEX;
+        if (!value.IsNull() && (!fValid || key.second.type != current.type || key.second.hashBytes != current.hashBytes)) {
+            pbatch->Write(make_pair(DB_ADDRESSBALANCE, current), value);
+            value.SetNull();
+            if (++nAddresses % 10000 == 0) {
+                if (!WriteBatch(*pbatch))
+                    return error("%s: failed to write address balances", __func__);
+                pbatch.reset(new CDBBatch(*this));
+            }
+        }
+        if (!fValid)
+            break;
+
+        CAmount nValue;
+        CAddressIndexAmount amount(nValue);
+        if (!pcursor->GetValue(amount))
+            return error("%s: failed to get address index value", __func__);
+        current = CAddressIndexIteratorKey(key.second.type, key.second.hashBytes);
+        value.balance += nValue;
+        if (!key.second.spending)
+            value.received += nValue;
+        if (value.txCount == 0 || lastTx != key.second.txhash) {
+            value.txCount++;
+            lastTx = key.second.txhash;
+        }
+        pcursor->Next();
+    }
+    pbatch->Write(make_pair(DB_FLAG, std::string("addressbalance")), '1');
+    if (!WriteBatch(*pbatch, true))
+        return error("%s: failed to write address balances", __func__);
+    LogPrintf("Built address balance index for %u addresses\n", nAddresses);
+    return true;
+}
+
+void CBlockTreeDB::GetCachedAddressIndex(const std::vector<std::pair<uint160, int> > &addresses, int start, int end,
+                                         const CAddressIndexKey *pAfter,
+                                         std::vector<std::pair<CAddressIndexKey, std::pair<bool, CAmount> > > &vCached) {
+    LOCK(cs_indexcache);
+    CAddressIndexKeyHeightCompare compare;
+    int height = 0;
+    if (pAfter) {
+        height = pAfter->blockHeight;
+    } else if (start > 0 && end > 0) {
+        height = start;
+    }
+    std::map<CAddressIndexKey, std::pair<bool, CAmount>, CAddressIndexKeyHeightCompare>::const_iterator it =
+        indexCache.mapAddressIndex.lower_bound(CAddressIndexKey(0, uint160(), height, 0, uint256(), 0, false));
+    for (; it != indexCache.mapAddressIndex.end(); it++) {
+        if (end > 0 && it->first.blockHeight > end)
+            break;
+        if (pAfter && !compare(*pAfter, it->first))
+            continue;
+        if (std::find(addresses.begin(), addresses.end(), std::make_pair(it->first.hashBytes, (int)it->first.type)) != addresses.end())
+            vCached.push_back(*it);
+    }
+}
+
 bool CBlockTreeDB::ReadAddressIndex(uint160 addressHash, int type,
                                     std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
-                                    int start, int end) {
+                                    int start, int end, const CAddressIndexKey *pAfter, size_t nLimit) {
+
+    std::vector<std::pair<CAddressIndexKey, std::pair<bool, CAmount> > > vCached;
+    GetCachedAddressIndex(std::vector<std::pair<uint160, int> >(1, std::make_pair(addressHash, type)), start, end, pAfter, vCached);
+    size_t nErased = 0;
+    for (size_t i = 0; i < vCached.size(); i++) {
+        if (vCached[i].second.first)
+            nErased++;
+    }
 
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
-    if (start > 0 && end > 0) {
+    if (pAfter) {
+        // Continue behind the last entry of the previous page
+        pcursor->Seek(make_pair(DB_ADDRESSINDEX, *pAfter));
+        std::pair<char,CAddressIndexKey> key;
+        if (pcursor->Valid() && pcursor->GetKey(key) && key.first == DB_ADDRESSINDEX &&
+            key.second.hashBytes == pAfter->hashBytes && key.second.blockHeight == pAfter->blockHeight &&
+            key.second.txindex == pAfter->txindex && key.second.txhash == pAfter->txhash &&
+            key.second.index == pAfter->index && key.second.spending == pAfter->spending) {
+            pcursor->Next();
+        }
+    } else if (start > 0 && end > 0) {
         pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(type, addressHash, start)));
     } else {
         pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey(type, addressHash)));
     }
 
+    const size_t nStart = addressIndex.size();
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
+        if (nLimit > 0 && addressIndex.size() - nStart >= nLimit + nErased) {
+            break;
+        }
         std::pair<char,CAddressIndexKey> key;
         if (pcursor->GetKey(key) && key.first == DB_ADDRESSINDEX && key.second.hashBytes == addressHash) {
             if (end > 0 && key.second.blockHeight > end) {
                 break;
             }
             CAmount nValue;
-            if (pcursor->GetValue(nValue)) {
+            CAddressIndexAmount value(nValue);
+            if (pcursor->GetValue(value)) {
                 addressIndex.push_back(make_pair(key.second, nValue));
                 pcursor->Next();
             } else {
@@ -292,6 +1214,129 @@ bool CBlockTreeDB::ReadAddressIndex(uint160 addressHash, int type,
         }
     }
 
+    MergeCachedRecords<CAddressIndexKey, CAmount, CAddressIndexKeyHeightCompare>(addressIndex, nStart, vCached, nLimit);
+    return true;
+}
+
+namespace {
+
+/** The address index entries of one address in a merged read */
+struct CAddressIndexSource
+{
+    std::shared_ptr<CDBIterator> pcursor;
+    uint160 addressHash;
+    int type;
+    CAddressIndexKey key;
+    CAmount value;
+
+    /** Load the entry under the cursor. Returns false once past the address or the end height. */
+    bool Load(int end, bool &fError) {
+        std::pair<char, CAddressIndexKey> dbkey;
+        if (!pcursor->Valid() || !pcursor->GetKey(dbkey) || dbkey.first != DB_ADDRESSINDEX ||
+            dbkey.second.hashBytes != addressHash || (int)dbkey.second.type != type)
+            return false;
+        if (end > 0 && dbkey.second.blockHeight > end)
+            return false;
+        CAddressIndexAmount amount(value);
+        if (!pcursor->GetValue(amount)) {
+            fError = true;
+            return false;
+        }
+        key = dbkey.second;
+        return true;
+    }
+};
+
+/** Heap order with the source holding the lowest key on top */
+struct CAddressIndexSourceCompare
+{
+    const std::vector<CAddressIndexSource> &sources;
+    CAddressIndexSourceCompare(const std::vector<CAddressIndexSource> &sourcesIn) : sources(sourcesIn) {}
+
+    bool operator()(size_t a, size_t b) const {
+        return CAddressIndexKeyHeightCompare()(sources[b].key, sources[a].key);
+    }
+};
+
+}
+
+bool CBlockTreeDB::ReadAddressIndexMerged(const std::vector<std::pair<uint160, int> > &addresses, int start, int end,
+                                          const CAddressIndexKey *pAfter,
+                                          boost::function<bool(const CAddressIndexKey&, CAmount)> visit) {
+    // An address requested twice would yield all its entries twice
+    std::vector<std::pair<uint160, int> > unique(addresses);
+    std::sort(unique.begin(), unique.end());
+    unique.erase(std::unique(unique.begin(), unique.end()), unique.end());
+
+    // Buffered records come in the same order as the merged ones from disk
+    std::vector<std::pair<CAddressIndexKey, std::pair<bool, CAmount> > > vCached;
+    GetCachedAddressIndex(unique, start, end, pAfter, vCached);
+    size_t nCached = 0;
+
+    // Open one cursor per address, positioned at the first entry to return
+    std::vector<CAddressIndexSource> sources;
+    sources.reserve(unique.size());
+    std::vector<size_t> heap;
+    bool fError = false;
+    for (std::vector<std::pair<uint160, int> >::const_iterator it=unique.begin(); it!=unique.end(); it++) {
+        CAddressIndexSource source;
+        source.pcursor.reset(NewIterator());
+        source.addressHash = it->first;
+        source.type = it->second;
+
+        int height = 0;
+        if (pAfter) {
+            height = pAfter->blockHeight;
+        } else if (start > 0 && end > 0) {
+            height = start;
+        }
+        source.pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(source.type, source.addressHash, height)));
+
+        bool fValid = source.Load(end, fError);
+        // Skip what an earlier page already returned
+        while (fValid && pAfter && !CAddressIndexKeyHeightCompare()(*pAfter, source.key)) {
+            source.pcursor->Next();
+            fValid = source.Load(end, fError);
+        }
+        if (fError)
+            return error("failed to get address index value");
+        if (fValid) {
+            heap.push_back(sources.size());
+            sources.push_back(source);
+        }
+    }
+
+    CAddressIndexSourceCompare compare(sources);
+    CAddressIndexKeyHeightCompare compareKeys;
+    std::make_heap(heap.begin(), heap.end(), compare);
+    while (!heap.empty() || nCached < vCached.size()) {
+        boost::this_thread::interruption_point();
+        if (nCached < vCached.size() && (heap.empty() || !compareKeys(sources[heap.front()].key, vCached[nCached].first))) {
+            // A buffered record comes first, and replaces or erases a
+            // stored one with the same key
+            const std::pair<CAddressIndexKey, std::pair<bool, CAmount> > &cached = vCached[nCached++];
+            if (!cached.second.first && !visit(cached.first, cached.second.second))
+                break;
+            if (heap.empty() || compareKeys(cached.first, sources[heap.front()].key))
+                continue;
+            std::pop_heap(heap.begin(), heap.end(), compare);
+        } else {
+            std::pop_heap(heap.begin(), heap.end(), compare);
+            CAddressIndexSource &source = sources[heap.back()];
+            if (!visit(source.key, source.value))
+                break;
+        }
+        CAddressIndexSource &source = sources[heap.back()];
+        source.pcursor->Next();
+        if (source.Load(end, fError)) {
+            std::push_heap(heap.begin(), heap.end(), compare);
+        } else if (fError) {
+            return error("failed to get address index value");
+        } else {
+            heap.pop_back();
+        }
+    }
+
     return true;
 }
 
@@ -303,6 +1348,17 @@ bool CBlockTreeDB::WriteTimestampIndex(const CTimestampIndexKey &timestampIndex)
 
 bool CBlockTreeDB::ReadTimestampIndex(const unsigned int &high, const unsigned int &low, const bool fActiveOnly, std::vector<std::pair<uint256, unsigned int> > &hashes) {
 
+    // Timestamp records are never erased, so the buffered ones are simply
+    // added to those on disk, in the same order
+    std::set<std::pair<unsigned int, uint256> > setTimestamps;
+    {
+        LOCK(cs_indexcache);
+        for (std::map<uint256, unsigned int>::const_iterator it=indexCache.mapTimestampIndex.begin(); it!=indexCache.mapTimestampIndex.end(); it++) {
+            if (it->second >= low && it->second < high)
+                setTimestamps.insert(std::make_pair(it->second, it->first));
+        }
+    }
+
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
     pcursor->Seek(make_pair(DB_TIMESTAMPINDEX, CTimestampIndexIteratorKey(low)));
@@ -311,20 +1367,18 @@ bool CBlockTreeDB::ReadTimestampIndex(const unsigned int &high, const unsigned i
         boost::this_thread::interruption_point();
         std::pair<char, CTimestampIndexKey> key;
         if (pcursor->GetKey(key) && key.first == DB_TIMESTAMPINDEX && key.second.timestamp < high) {
-            if (fActiveOnly) {
-                if (HashOnchainActive(key.second.blockHash)) {
-                    hashes.push_back(std::make_pair(key.second.blockHash, key.second.timestamp));
-                }
-            } else {
-                hashes.push_back(std::make_pair(key.second.blockHash, key.second.timestamp));
-            }
-
+            setTimestamps.insert(std::make_pair(key.second.timestamp, key.second.blockHash));
             pcursor->Next();
         } else {
             break;
         }
     }
 
+    for (std::set<std::pair<unsigned int, uint256> >::const_iterator it=setTimestamps.begin(); it!=setTimestamps.end(); it++) {
+        if (!fActiveOnly || HashOnchainActive(it->second))
+            hashes.push_back(std::make_pair(it->second, it->first));
+    }
+
     return true;
 }
 
@@ -336,6 +1390,15 @@ bool CBlockTreeDB::WriteTimestampBlockIndex(const CTimestampBlockIndexKey &block
 
 bool CBlockTreeDB::ReadTimestampBlockIndex(const uint256 &hash, unsigned int &ltimestamp) {
 
+    {
+        LOCK(cs_indexcache);
+        std::map<uint256, unsigned int>::const_iterator it = indexCache.mapTimestampIndex.find(hash);
+        if (it != indexCache.mapTimestampIndex.end()) {
+            ltimestamp = it->second;
+            return true;
+        }
+    }
+
     CTimestampBlockIndexValue(lts);
     if (!Read(std::make_pair(DB_BLOCKHASHINDEX, hash), lts))
 	return false;
@@ -344,6 +1407,131 @@ bool CBlockTreeDB::ReadTimestampBlockIndex(const uint256 &hash, unsigned int &lt
     return true;
 }
 
+bool CBlockTreeDB::ReadFlagIndex(uint16_t flag, int start, int end, std::vector<std::pair<CFlagIndexKey, CFlagIndexValue> > &vect) {
+
+    std::vector<std::pair<CFlagIndexKey, std::pair<bool, CFlagIndexValue> > > vCached;
+    {
+        LOCK(cs_indexcache);
+        std::map<CFlagIndexKey, CFlagIndexValue, CFlagIndexKeyCompare>::const_iterator it =
+            indexCache.mapFlagIndex.lower_bound(CFlagIndexKey(flag, std::max(start, 0), uint256()));
+        for (; it != indexCache.mapFlagIndex.end() && it->first.flag == flag && (end <= 0 || it->first.blockHeight <= end); it++)
+            vCached.push_back(std::make_pair(it->first, std::make_pair(it->second.IsNull(), it->second)));
+    }
+
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(make_pair(DB_FLAGINDEX, CFlagIndexIteratorHeightKey(flag, std::max(start, 0))));
+
+    const size_t nStart = vect.size();
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, CFlagIndexKey> key;
+        if (pcursor->GetKey(key) && key.first == DB_FLAGINDEX && key.second.flag == flag) {
+            if (end > 0 && key.second.blockHeight > end) {
+                break;
+            }
+            CFlagIndexValue value;
+            if (pcursor->GetValue(value)) {
+                vect.push_back(make_pair(key.second, value));
+                pcursor->Next();
+            } else {
+                return error("failed to get flag index value");
+            }
+        } else {
+            break;
+        }
+    }
+
+    MergeCachedRecords<CFlagIndexKey, CFlagIndexValue, CFlagIndexKeyCompare>(vect, nStart, vCached, 0);
+    return true;
+}
+
+bool CBlockTreeDB::ReadIndexBuildBest(const std::string &name, uint256 &hashBlock) {
+    return Read(std::make_pair(DB_INDEX_BUILD, name), hashBlock);
+}
+
+bool CBlockTreeDB::WriteIndexBuildBlock(const std::string &name, const uint256 &hashBlock, const CIndexBlockUpdate &update) {
+    // The records of the block and the new position of the builder are
+    // committed together, so a restart never applies a block twice.
+    CDBBatch batch(*this);
+    if (!update.addressIndex.empty())
+        BatchAddressIndex(batch, update.addressIndex, update.fDisconnect);
+    BatchAddressUnspentIndex(batch, update.addressUnspentIndex);
+    BatchSpentIndex(batch, update.spentIndex);
+    for (std::vector<CTimestampIndexKey>::const_iterator it=update.timestampIndex.begin(); it!=update.timestampIndex.end(); it++) {
+        batch.Write(make_pair(DB_TIMESTAMPINDEX, *it), 0);
+        batch.Write(make_pair(DB_BLOCKHASHINDEX, CTimestampBlockIndexKey(it->blockHash)), CTimestampBlockIndexValue(it->timestamp));
+    }
+    BatchFlagIndex(batch, update.flagIndex);
+    batch.Write(std::make_pair(DB_INDEX_BUILD, name), hashBlock);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::FinishIndexBuild(const std::string &name, const uint256 &hashBlock) {
+    CDBBatch batch(*this);
+    batch.Erase(std::make_pair(DB_INDEX_BUILD, name));
+    batch.Write(std::make_pair(DB_FLAG, name), '1');
+    batch.Write(std::make_pair(DB_INDEX_BEST, name), hashBlock);
+    return WriteBatch(batch, true);
+}
+
+bool CBlockTreeDB::ResumeIndexBuild(const std::string &name, const uint256 &hashBlock) {
+    CDBBatch batch(*this);
+    batch.Write(std::make_pair(DB_FLAG, name), '0');
+    batch.Write(std::make_pair(DB_INDEX_BUILD, name), hashBlock);
+    return WriteBatch(batch, true);
+}
+
+bool CBlockTreeDB::ReadIndexBest(const std::string &name, uint256 &hashBlock) {
+    return Read(std::make_pair(DB_INDEX_BEST, name), hashBlock);
+}
+
+bool CBlockTreeDB::EraseIndexBuild(const std::string &name) {
+    return Erase(std::make_pair(DB_INDEX_BUILD, name));
+}
+
+template<typename K>
+bool CBlockTreeDB::EraseIndexRecords(char chPrefix) {
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(chPrefix);
+
+    boost::scoped_ptr<CDBBatch> pbatch(new CDBBatch(*this));
+    size_t nErased = 0;
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, K> key;
+        if (!pcursor->GetKey(key) || key.first != chPrefix)
+            break;
+        pbatch->Erase(key);
+        if (++nErased % 10000 == 0) {
+            if (!WriteBatch(*pbatch))
+                return false;
+            pbatch.reset(new CDBBatch(*this));
+        }
+        pcursor->Next();
+    }
+    return WriteBatch(*pbatch);
+}
+
+bool CBlockTreeDB::WipeAddressIndex() {
+    return EraseIndexRecords<CAddressIndexKey>(DB_ADDRESSINDEX) &&
+           EraseIndexRecords<CAddressUnspentKey>(DB_ADDRESSUNSPENTINDEX) &&
+           EraseAddressBalances();
+}
+
+bool CBlockTreeDB::WipeSpentIndex() {
+    return EraseIndexRecords<CSpentIndexKey>(DB_SPENTINDEX);
+}
+
+bool CBlockTreeDB::WipeTimestampIndex() {
+    return EraseIndexRecords<CTimestampIndexKey>(DB_TIMESTAMPINDEX) &&
+           EraseIndexRecords<CTimestampBlockIndexKey>(DB_BLOCKHASHINDEX);
+}
+
+bool CBlockTreeDB::WipeFlagIndex() {
+    return EraseIndexRecords<CFlagIndexKey>(DB_FLAGINDEX);
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
@@ -360,28 +1548,22 @@ bool CBlockTreeDB::LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256
 {
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
-    auto ssKeySet(std::make_pair(std::make_pair(DB_BLOCK_INDEX, uint256()), DB_BLOCK_INDEX_AUXPOW));
-    pcursor->Seek(ssKeySet);
-//    LogPrint("txdb", "ssKeySet: '%x%s%x'\n", ssKeySet.first.first, ssKeySet.first.second.ToString(), ssKeySet.second); // LEDTMP
+    pcursor->Seek(make_pair(make_pair(DB_BLOCK_INDEX, uint256()), DB_BLOCK_INDEX_AUXPOW));
 
-    // Load mapBlockIndex
+    // Load mapBlockIndex. Each block has a compact header record and a
+    // record with its mutable fields; auxpows stay on disk until needed.
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
-        std::pair < std::pair < char, uint256 > , char > key;
+        std::pair<std::pair<char, uint256>, char> key;
         if (pcursor->GetKey(key) && key.first.first == DB_BLOCK_INDEX) {
-
-            assert(key.second == DB_BLOCK_INDEX_AUXPOW);
-
-//            LogPrint("txdb", "key: '%x%s%x'\n", key.first.first, key.first.second.ToString(), key.second); // LEDTMP
-
-            CDiskBlockIndex diskindex;
-            if (pcursor->GetValue(diskindex)) {
+            const uint256& hash = key.first.second;
+            if (key.second == DB_BLOCK_INDEX_HEADER) {
+                CDiskBlockHeaderIndex diskindex;
+                if (!pcursor->GetValue(diskindex))
+                    return error("LoadBlockIndex() : failed to read value");
 
                 // Construct immutable parts of block index object
-                uint256 hash = key.first.second;
                 CBlockIndex* pindexNew = insertBlockIndex(hash);
-//                LogPrint("txdb", "                    hash: '%s'\n", hash.ToString()); // LEDTMP
-//                LogPrint("txdb", "diskindex.GetBlockHash(): '%s'\n", diskindex.GetBlockHash().ToString()); // LEDTMP
                 assert(diskindex.GetBlockHash() == *pindexNew->phashBlock); // paranoia check
 
                 pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
@@ -392,23 +1574,14 @@ bool CBlockTreeDB::LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256
                 pindexNew->nBits          = diskindex.nBits;
                 pindexNew->nNonce         = diskindex.nNonce;
                 pindexNew->nTx            = diskindex.nTx;
-
-                pcursor->Next(); // now we should be on the 'b' subkey
-                assert(pcursor->Valid());
-
-                pcursor->GetKey(key);
-                assert(key.first.second == hash);     // next key's hash must be the same
-                assert(key.second == DB_BLOCK_INDEX); // next key must be a 'b' subkey of the same b block
-
-//            LogPrint("txdb", "    key2: '%x%s%x'\n", key.first.first, key.first.second.ToString(), key.second); // LEDTMP
-
+            } else if (key.second == DB_BLOCK_INDEX) {
                 // read all mutable data
-                pcursor->GetValue(*pindexNew);
-
-                pcursor->Next();
+                if (!pcursor->GetValue(*insertBlockIndex(hash)))
+                    return error("LoadBlockIndex() : failed to read value");
             } else {
-                return error("LoadBlockIndex() : failed to read value");
+                return error("LoadBlockIndex() : unexpected block index record type %c", key.second);
             }
+            pcursor->Next();
         } else {
             break;
         }
@@ -416,3 +1589,46 @@ bool CBlockTreeDB::LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256
 
     return true;
 }
+
+bool CBlockTreeDB::UpgradeBlockIndexAuxPow()
+{
+    bool fSplit = false;
+    if (ReadFlag("splitauxpow", fSplit) && fSplit)
+        return true;
+
+    // Move every combined header+auxpow record into a compact header record
+    // and, for merge-mined blocks, a separate auxpow record.
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(make_pair(make_pair(DB_BLOCK_INDEX, uint256()), DB_BLOCK_INDEX_AUXPOW));
+
+    boost::scoped_ptr<CDBBatch> pbatch(new CDBBatch(*this));
+    size_t nUpgraded = 0;
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<std::pair<char, uint256>, char> key;
+        if (!pcursor->GetKey(key) || key.first.first != DB_BLOCK_INDEX)
+            break;
+        if (key.second == DB_BLOCK_INDEX_AUXPOW) {
+            CDiskBlockIndex diskindex;
+            if (!pcursor->GetValue(diskindex))
+                return error("%s: failed to read block index entry %s", __func__, key.first.second.ToString());
+            pbatch->Write(make_pair(key.first, DB_BLOCK_INDEX_HEADER), CDiskBlockHeaderIndex(diskindex));
+            if (diskindex.auxpow && diskindex.IsAuxPow())
+                pbatch->Write(make_pair(DB_AUXPOW, key.first.second), *diskindex.auxpow);
+            pbatch->Erase(key);
+            if (++nUpgraded % 10000 == 0) {
+                if (!WriteBatch(*pbatch))
+                    return error("%s: failed to write upgraded block index", __func__);
+                pbatch.reset(new CDBBatch(*this));
+                LogPrintf("Upgrading block index auxpow records... (%u done)\n", nUpgraded);
+            }
+        }
+        pcursor->Next();
+    }
+    pbatch->Write(make_pair(DB_FLAG, std::string("splitauxpow")), '1');
+    if (!WriteBatch(*pbatch, true))
+        return error("%s: failed to write upgraded block index", __func__);
+    if (nUpgraded > 0)
+        LogPrintf("Upgraded %u block index entries to separate auxpow records\n", nUpgraded);
+    return true;
+}
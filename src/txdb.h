@@ -7,10 +7,12 @@
 #define BITCOIN_TXDB_H
 
 #include "main.h"
+#include "bloom.h"
 #include "coins.h"
 #include "dbwrapper.h"
 #include "chain.h"
 #include "spentindex.h"
+#include "sync.h"
 
 #include <map>
 #include <string>
@@ -18,6 +20,10 @@
 #include <vector>
 
 #include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
 
 class CBlockIndex;
 class CCoinsViewDBCursor;
@@ -25,6 +31,8 @@ class uint256;
 
 //! -dbcache default (MiB)
 static const int64_t nDefaultDbCache = 300;
+//! -backgroundflush default
+static const bool DEFAULT_BACKGROUND_FLUSH = true;
 //! max. -dbcache (MiB)
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache (MiB)
@@ -71,11 +79,74 @@ protected:
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
-    bool GetCoins(const uint256 &txid, CCoins &coins) const;
-    bool HaveCoins(const uint256 &txid) const;
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
     CCoinsViewCursor *Cursor() const;
+
+    //! Write the changed entries of mapCoins like BatchWrite, but leave the map alone
+    bool WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock);
+
+    //! Convert per-transaction records from before the per-output format; resumes if interrupted
+    bool Upgrade();
+
+    /**
+     * Erase all coins to make room for a UTXO set snapshot of hashBlock.
+     * Until EndSnapshotLoad(), the database has no best block and is marked
+     * as being loaded, so an interrupted load is noticed on startup.
+     */
+    bool BeginSnapshotLoad(const uint256 &hashBlock);
+    //! Write coins of the snapshot being loaded in one batch
+    bool WriteSnapshotCoins(const std::vector<std::pair<COutPoint, Coin> > &vCoins);
+    //! Make hashBlock, whose snapshot has been written, the best block
+    bool EndSnapshotLoad(const uint256 &hashBlock);
+    bool IsSnapshotLoadInterrupted() const;
+};
+
+/**
+ * CCoinsView in front of the coin database that takes the changes of a cache
+ * flush and writes them on a background thread (see Thread()), so the cache
+ * above carries on right away. Lookups see the changes still being written.
+ * Every write is still one atomic batch that includes its best block, and a
+ * flush first waits for the previous write, so at most one is in flight.
+ * Without a running thread, flushes are written before BatchWrite returns.
+ */
+class CCoinsViewBackgroundFlush : public CCoinsView
+{
+private:
+    CCoinsViewDB *db;
+
+    mutable boost::mutex cs;
+    mutable boost::condition_variable cond;
+
+    //! Changes of the last flush until they are in the database, and the pool they live in
+    boost::scoped_ptr<CCoinsMapMemoryResource> presourcePending;
+    boost::scoped_ptr<CCoinsMap> pmapPending;
+    uint256 hashPending;
+
+    //! Whether Thread() is running
+    bool fBackground;
+    //! Whether a write failed; its changes stay pending and later flushes fail
+    bool fFailed;
+
+    void WaitForWrite(boost::unique_lock<boost::mutex>& lock) const;
+    void WritePending(boost::unique_lock<boost::mutex>& lock);
+
+public:
+    CCoinsViewBackgroundFlush(CCoinsViewDB *dbIn);
+
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
+    uint256 GetBestBlock() const;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    CCoinsViewCursor *Cursor() const;
+
+    //! Wait until the changes of the last flush are in the database
+    bool Sync();
+
+    //! Write the changes of flushes as they come in, until interrupted
+    void Thread();
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -84,8 +155,8 @@ class CCoinsViewDBCursor: public CCoinsViewCursor
 public:
     ~CCoinsViewDBCursor() {}
 
-    bool GetKey(uint256 &key) const;
-    bool GetValue(CCoins &coins) const;
+    bool GetKey(COutPoint &key) const;
+    bool GetValue(Coin &coin) const;
     unsigned int GetValueSize() const;
 
     bool Valid() const;
@@ -95,11 +166,57 @@ private:
     CCoinsViewDBCursor(CDBIterator* pcursorIn, const uint256 &hashBlockIn):
         CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn) {}
     boost::scoped_ptr<CDBIterator> pcursor;
-    std::pair<char, uint256> keyTmp;
+    std::pair<char, COutPoint> keyTmp;
 
     friend class CCoinsViewDB;
 };
 
+/**
+ * Address, spent, timestamp and flag index records of one block, as written
+ * by the background index builders.
+ */
+struct CIndexBlockUpdate
+{
+    //! The block is disconnected: its address index entries are erased
+    bool fDisconnect;
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
+    std::vector<CTimestampIndexKey> timestampIndex;
+    std::vector<std::pair<CFlagIndexKey, CFlagIndexValue> > flagIndex;
+
+    CIndexBlockUpdate() : fDisconnect(false) {}
+};
+
+/**
+ * Address, spent, timestamp and flag index records of connected and disconnected
+ * blocks that have not been written yet. They are committed together with
+ * the block index when the chain state is flushed; a block disconnected
+ * before that only changes the buffered records. Reads apply them on top of
+ * the records on disk.
+ */
+struct CIndexCache
+{
+    //! Address index records; true in the pair erases the record
+    std::map<CAddressIndexKey, std::pair<bool, CAmount>, CAddressIndexKeyHeightCompare> mapAddressIndex;
+    //! Address unspent records; a null value erases the record
+    std::map<CAddressUnspentKey, CAddressUnspentValue, CAddressUnspentKeyCompare> mapAddressUnspentIndex;
+    //! Changes to the address balances, added to the stored totals on flush
+    std::map<std::pair<unsigned int, uint160>, CAddressBalanceValue> mapAddressBalance;
+    //! Spent index records; a null value erases the record
+    std::map<CSpentIndexKey, CSpentIndexValue, CSpentIndexKeyCompare> mapSpentIndex;
+    //! Logical timestamps of connected blocks
+    std::map<uint256, unsigned int> mapTimestampIndex;
+    //! Flag index records; a null value erases the record
+    std::map<CFlagIndexKey, CFlagIndexValue, CFlagIndexKeyCompare> mapFlagIndex;
+    //! Block every index kept by ConnectBlock is at once the records are written
+    std::map<std::string, uint256> mapIndexBest;
+
+    bool IsEmpty() const;
+    void Clear();
+    size_t DynamicMemoryUsage() const;
+};
+
 /** Access to the block database (blocks/index/) */
 class CBlockTreeDB : public CDBWrapper
 {
@@ -108,9 +225,27 @@ public:
 private:
     CBlockTreeDB(const CBlockTreeDB&);
     void operator=(const CBlockTreeDB&);
+    mutable CCriticalSection cs_indexcache;
+    CIndexCache indexCache;
+    //! Every spent index key ever written, once fSpentFilterLoaded is set
+    mutable CCriticalSection cs_spentfilter;
+    boost::scoped_ptr<CBlockedBloomFilter> pspentfilter;
+    bool fSpentFilterLoaded;
+    void AddSpentFilter(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > &vect);
+    void BatchIndexCache(CDBBatch &batch);
+    void BatchAddressBalances(CDBBatch &batch, const std::map<std::pair<unsigned int, uint160>, CAddressBalanceValue> &mapDeltas);
+    void UpdateAddressBalances(CDBBatch &batch, const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect, bool fUndo);
+    void BatchAddressIndex(CDBBatch &batch, const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect, bool fErase);
+    void BatchAddressUnspentIndex(CDBBatch &batch, const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect);
+    void BatchSpentIndex(CDBBatch &batch, const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > &vect);
+    void BatchFlagIndex(CDBBatch &batch, const std::vector<std::pair<CFlagIndexKey, CFlagIndexValue> > &vect);
+    template<typename K> bool EraseIndexRecords(char chPrefix);
+    void GetCachedAddressIndex(const std::vector<std::pair<uint160, int> > &addresses, int start, int end,
+                               const CAddressIndexKey *pAfter,
+                               std::vector<std::pair<CAddressIndexKey, std::pair<bool, CAmount> > > &vCached);
 public:
-    bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo, const std::map<uint256, std::shared_ptr<CAuxPow> >& auxpows = mapDirtyAuxPow);
-    bool ReadDiskBlockIndex(const uint256 &blkid, CDiskBlockIndex& diskblockindex);
+    bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo, const std::map<uint256, std::shared_ptr<CAuxPow> >& auxpows = mapDirtyAuxPow, bool fIndexCache = false);
+    bool ReadAuxPow(const uint256 &blkid, std::shared_ptr<CAuxPow>& auxpow);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &fileinfo);
     bool ReadLastBlockFile(int &nFile);
     bool WriteReindexing(bool fReindex);
@@ -119,21 +254,50 @@ public:
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
     bool ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
     bool UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >&vect);
+    void InitSpentFilter(unsigned int nElements);
+    bool LoadSpentFilter();
     bool UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect);
     bool ReadAddressUnspentIndex(uint160 addressHash, int type,
-                                 std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect);
+                                 std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect,
+                                 const CAddressUnspentKey *pAfter = NULL, size_t nLimit = 0);
     bool WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
     bool EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
     bool ReadAddressIndex(uint160 addressHash, int type,
                           std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
-                          int start = 0, int end = 0);
+                          int start = 0, int end = 0, const CAddressIndexKey *pAfter = NULL, size_t nLimit = 0);
+    bool ReadAddressIndexMerged(const std::vector<std::pair<uint160, int> > &addresses, int start, int end,
+                                const CAddressIndexKey *pAfter,
+                                boost::function<bool(const CAddressIndexKey&, CAmount)> visit);
+    bool ReadAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &value);
+    bool EraseAddressBalances();
+    bool UpgradeAddressBalances();
+    bool UpgradeAddressIndexFormat();
+    void CacheAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect, bool fErase);
+    void CacheAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect);
+    void CacheSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > &vect);
+    void CacheTimestampIndex(const uint256 &hash, unsigned int logicalTS);
+    void CacheFlagIndex(const std::vector<std::pair<CFlagIndexKey, CFlagIndexValue> > &vect);
+    void CacheIndexBest(const std::string &name, const uint256 &hashBlock);
+    size_t IndexCacheUsage() const;
     bool WriteTimestampIndex(const CTimestampIndexKey &timestampIndex);
     bool ReadTimestampIndex(const unsigned int &high, const unsigned int &low, const bool fActiveOnly, std::vector<std::pair<uint256, unsigned int> > &vect);
     bool WriteTimestampBlockIndex(const CTimestampBlockIndexKey &blockhashIndex, const CTimestampBlockIndexValue &logicalts);
     bool ReadTimestampBlockIndex(const uint256 &hash, unsigned int &logicalTS);
+    bool ReadFlagIndex(uint16_t flag, int start, int end, std::vector<std::pair<CFlagIndexKey, CFlagIndexValue> > &vect);
+    bool ReadIndexBuildBest(const std::string &name, uint256 &hashBlock);
+    bool WriteIndexBuildBlock(const std::string &name, const uint256 &hashBlock, const CIndexBlockUpdate &update);
+    bool FinishIndexBuild(const std::string &name, const uint256 &hashBlock);
+    bool ResumeIndexBuild(const std::string &name, const uint256 &hashBlock);
+    bool ReadIndexBest(const std::string &name, uint256 &hashBlock);
+    bool EraseIndexBuild(const std::string &name);
+    bool WipeAddressIndex();
+    bool WipeSpentIndex();
+    bool WipeTimestampIndex();
+    bool WipeFlagIndex();
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex);
+    bool UpgradeBlockIndexAuxPow();
 };
 
 #endif // BITCOIN_TXDB_H
@@ -0,0 +1,446 @@
+// Copyright (c) 2016 The Sexcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txoutsnapshot.h"
+
+#include "chainparams.h"
+#include "coins.h"
+#include "consensus/validation.h"
+#include "hash.h"
+#include "init.h"
+#include "main.h"
+#include "net.h"
+#include "streams.h"
+#include "txdb.h"
+#include "txmempool.h"
+#include "ui_interface.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <map>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+
+// A snapshot file consists of
+//  - a header: SNAPSHOT_MAGIC, the network's message start, the format
+//    version, and the hash, height and chain transaction count of the block
+//  - the coins, each a 1 byte followed by its outpoint and the coin as the
+//    chain state stores it, ascending by txid, and a 0 byte after the last
+//  - a trailer: the number of coins, the hash of the unspent outputs as
+//    gettxoutsetinfo computes it, and a checksum of everything before it.
+// The checksum only guards against damage; whoever edits a file can redo
+// it. The hash of the unspent outputs is what a snapshot is trusted by, so
+// it covers everything that is loaded, heights and coinbase flags too.
+static const unsigned char SNAPSHOT_MAGIC[4] = {'u', 't', 'x', 'o'};
+
+CTxOutSetHasher::CTxOutSetHasher(const uint256& hashBlock) : ss(SER_GETHASH, PROTOCOL_VERSION)
+{
+    ss << hashBlock;
+}
+
+void CTxOutSetHasher::FinishTx()
+{
+    if (outputs.empty())
+        return;
+    ss << hashTx;
+    for (std::map<uint32_t, Coin>::const_iterator it = outputs.begin(); it != outputs.end(); ++it) {
+        ss << VARINT(it->first + 1);
+        ss << it->second;
+    }
+    ss << VARINT(0);
+    outputs.clear();
+}
+
+bool CTxOutSetHasher::Add(const COutPoint& outpoint, const Coin& coin)
+{
+    if (!outputs.empty() && outpoint.hash != hashTx) {
+        if (outpoint.hash < hashTx)
+            return false;
+        FinishTx();
+    }
+    hashTx = outpoint.hash;
+    return outputs.insert(std::make_pair(outpoint.n, coin)).second;
+}
+
+uint256 CTxOutSetHasher::GetHash()
+{
+    FinishTx();
+    return ss.GetHash();
+}
+
+namespace {
+
+/** Writes to a snapshot file, hashing everything written for the checksum */
+class CSnapshotWriter
+{
+private:
+    CAutoFile& file;
+    CHashWriter hasher;
+
+public:
+    CSnapshotWriter(CAutoFile& fileIn) : file(fileIn), hasher(SER_DISK, CLIENT_VERSION) {}
+
+    template<typename T>
+    CSnapshotWriter& operator<<(const T& obj)
+    {
+        file << obj;
+        hasher << obj;
+        return *this;
+    }
+
+    uint256 GetHash() { return hasher.GetHash(); }
+};
+
+/** Reads from a snapshot file, hashing everything read for the checksum */
+class CSnapshotReader
+{
+private:
+    CAutoFile& file;
+    CHashWriter hasher;
+
+public:
+    CSnapshotReader(CAutoFile& fileIn) : file(fileIn), hasher(SER_DISK, CLIENT_VERSION) {}
+
+    template<typename T>
+    CSnapshotReader& operator>>(T& obj)
+    {
+        file >> obj;
+        hasher << obj;
+        return *this;
+    }
+
+    uint256 GetHash() { return hasher.GetHash(); }
+};
+
+} // anon namespace
+
+static bool WriteSnapshot(CAutoFile& fileout, CCoinsViewCursor* pcursor, CTxOutSnapshotInfo& info, std::string& strError)
+{
+    CSnapshotWriter writer(fileout);
+    writer << FLATDATA(SNAPSHOT_MAGIC) << FLATDATA(Params().MessageStart()) << TXOUTSNAPSHOT_VERSION;
+    writer << info.hashBlock << info.nHeight << info.nChainTx;
+
+    CTxOutSetHasher hasher(info.hashBlock);
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        COutPoint outpoint;
+        Coin coin;
+        if (!pcursor->GetKey(outpoint) || !pcursor->GetValue(coin)) {
+            strError = "Unable to read the coin database";
+            return false;
+        }
+        if (!hasher.Add(outpoint, coin)) {
+            strError = "The coin database is not ordered by txid";
+            return false;
+        }
+        writer << (unsigned char)1 << outpoint << coin;
+        info.nCoins++;
+        pcursor->Next();
+    }
+    info.hashSerialized = hasher.GetHash();
+    writer << (unsigned char)0 << info.nCoins << info.hashSerialized;
+    fileout << writer.GetHash();
+    return true;
+}
+
+bool DumpTxOutSet(const boost::filesystem::path& path, CTxOutSnapshotInfo& info, std::string& strError)
+{
+    if (boost::filesystem::exists(path)) {
+        strError = strprintf("%s already exists", path.string());
+        return false;
+    }
+
+    boost::scoped_ptr<CCoinsViewCursor> pcursor;
+    {
+        LOCK(cs_main);
+        // No other flush can come between this one and taking the cursor
+        FlushStateToDisk();
+        pcursor.reset(pcoinsflusher->Cursor());
+        BlockMap::iterator mi = mapBlockIndex.find(pcursor->GetBestBlock());
+        if (mi == mapBlockIndex.end()) {
+            strError = "The chain state is not at a known block";
+            return false;
+        }
+        info.hashBlock = mi->first;
+        info.nHeight = mi->second->nHeight;
+        info.nChainTx = mi->second->nChainTx;
+    }
+    LogPrintf("Writing UTXO set snapshot of block %s at height %d to %s...\n", info.hashBlock.ToString(), info.nHeight, path.string());
+
+    // Written under another name first, so that an interrupted dump leaves no
+    // file that looks complete
+    boost::filesystem::path pathTmp = path;
+    pathTmp += ".incomplete";
+    CAutoFile fileout(fopen(pathTmp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull()) {
+        strError = strprintf("Unable to open %s for writing", pathTmp.string());
+        return false;
+    }
+    bool fWritten = false;
+    try {
+        fWritten = WriteSnapshot(fileout, pcursor.get(), info, strError);
+        if (fWritten) {
+            FileCommit(fileout.Get());
+            fileout.fclose();
+        }
+    } catch (const std::ios_base::failure& e) {
+        strError = strprintf("Unable to write %s: %s", pathTmp.string(), e.what());
+    }
+    if (!fWritten || !RenameOver(pathTmp, path)) {
+        fileout.fclose();
+        boost::filesystem::remove(pathTmp);
+        if (fWritten)
+            strError = strprintf("Unable to rename %s to %s", pathTmp.string(), path.string());
+        return false;
+    }
+
+    LogPrintf("Wrote %u coins with hash %s\n", info.nCoins, info.hashSerialized.ToString());
+    return true;
+}
+
+static bool ReadSnapshotHeader(CSnapshotReader& reader, CTxOutSnapshotInfo& info, std::string& strError)
+{
+    unsigned char pchMagic[sizeof(SNAPSHOT_MAGIC)];
+    CMessageHeader::MessageStartChars pchMessageStart;
+    uint32_t nVersion;
+    reader >> FLATDATA(pchMagic) >> FLATDATA(pchMessageStart) >> nVersion;
+    if (memcmp(pchMagic, SNAPSHOT_MAGIC, sizeof(pchMagic))) {
+        strError = "Not a UTXO set snapshot";
+        return false;
+    }
+    if (memcmp(pchMessageStart, Params().MessageStart(), sizeof(pchMessageStart))) {
+        strError = "The UTXO set snapshot is for another network";
+        return false;
+    }
+    if (nVersion != TXOUTSNAPSHOT_VERSION) {
+        strError = strprintf("Unsupported UTXO set snapshot version %u", nVersion);
+        return false;
+    }
+    reader >> info.hashBlock >> info.nHeight >> info.nChainTx;
+    return true;
+}
+
+/**
+ * Read the coins of a snapshot after its header, and check them against its
+ * trailer. With pdb, the coins are also written to it in batches.
+ */
+static bool ReadSnapshotCoins(CAutoFile& filein, CSnapshotReader& reader, CTxOutSnapshotInfo& info, CCoinsViewDB* pdb, std::string& strError)
+{
+    CTxOutSetHasher hasher(info.hashBlock);
+    std::vector<std::pair<COutPoint, Coin> > vBatch;
+    size_t nBatchSize = 0;
+    uint64_t nCoins = 0;
+    while (true) {
+        boost::this_thread::interruption_point();
+        unsigned char chType;
+        reader >> chType;
+        if (chType == 0)
+            break;
+        COutPoint outpoint;
+        Coin coin;
+        reader >> outpoint >> coin;
+        if (chType != 1 || coin.IsSpent() || !hasher.Add(outpoint, coin)) {
+            strError = strprintf("The UTXO set snapshot is corrupt at coin %u", nCoins);
+            return false;
+        }
+        nCoins++;
+        if (pdb) {
+            nBatchSize += sizeof(outpoint) + coin.GetSerializeSize(SER_DISK, CLIENT_VERSION);
+            vBatch.push_back(std::make_pair(outpoint, coin));
+            if (nBatchSize >= TXOUTSNAPSHOT_BATCH_SIZE) {
+                if (!pdb->WriteSnapshotCoins(vBatch)) {
+                    strError = "Unable to write to the coin database";
+                    return false;
+                }
+                LogPrintf("Loaded %u coins of the UTXO set snapshot\n", nCoins);
+                vBatch.clear();
+                nBatchSize = 0;
+            }
+        }
+    }
+    if (pdb && !vBatch.empty() && !pdb->WriteSnapshotCoins(vBatch)) {
+        strError = "Unable to write to the coin database";
+        return false;
+    }
+
+    reader >> info.nCoins >> info.hashSerialized;
+    uint256 hashChecksum = reader.GetHash();
+    uint256 hashFileChecksum;
+    filein >> hashFileChecksum;
+    if (hashChecksum != hashFileChecksum) {
+        strError = "The UTXO set snapshot checksum does not match its contents";
+        return false;
+    }
+    if (nCoins != info.nCoins || hasher.GetHash() != info.hashSerialized) {
+        strError = "The UTXO set snapshot does not match its own hash";
+        return false;
+    }
+    return true;
+}
+
+/** Read and check a whole snapshot file; with fHeaderOnly, just its header */
+static bool ReadSnapshotFile(const boost::filesystem::path& path, CTxOutSnapshotInfo& info, bool fHeaderOnly, CCoinsViewDB* pdb, std::string& strError)
+{
+    CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        strError = strprintf("Unable to open %s", path.string());
+        return false;
+    }
+    try {
+        CSnapshotReader reader(filein);
+        if (!ReadSnapshotHeader(reader, info, strError))
+            return false;
+        return fHeaderOnly || ReadSnapshotCoins(filein, reader, info, pdb, strError);
+    } catch (const std::ios_base::failure& e) {
+        strError = strprintf("Unable to read the UTXO set snapshot: %s", e.what());
+        return false;
+    }
+}
+
+/** The block of a snapshot, if the chain state can be replaced by the snapshot */
+static CBlockIndex* FindSnapshotBlock(const CTxOutSnapshotInfo& info, std::string& strError)
+{
+    AssertLockHeld(cs_main);
+    BlockMap::iterator mi = mapBlockIndex.find(info.hashBlock);
+    if (mi == mapBlockIndex.end()) {
+        strError = strprintf("The header of the snapshot block %s is not known yet", info.hashBlock.ToString());
+        return NULL;
+    }
+    CBlockIndex* pindex = mi->second;
+    if (pindex->nHeight != info.nHeight) {
+        strError = strprintf("The snapshot block %s is at height %d, not %d", info.hashBlock.ToString(), pindex->nHeight, info.nHeight);
+        return NULL;
+    }
+    if (pindexBestHeader == NULL || pindexBestHeader->GetAncestor(pindex->nHeight) != pindex) {
+        strError = strprintf("The snapshot block %s is not on the best header chain", info.hashBlock.ToString());
+        return NULL;
+    }
+    if (chainActive.Height() >= pindex->nHeight) {
+        strError = strprintf("The active chain is at height %d, past the snapshot already", chainActive.Height());
+        return NULL;
+    }
+    return pindex;
+}
+
+/** Replace the coins in the database by those of the checked snapshot file */
+static bool ReplaceCoinsBySnapshot(const boost::filesystem::path& path, const CTxOutSnapshotInfo& info, std::string& strError)
+{
+    if (!pcoinsdbview->BeginSnapshotLoad(info.hashBlock)) {
+        strError = "Unable to write to the coin database";
+        return false;
+    }
+    CTxOutSnapshotInfo infoLoaded;
+    if (!ReadSnapshotFile(path, infoLoaded, false, pcoinsdbview, strError))
+        return false;
+    if (infoLoaded.hashSerialized != info.hashSerialized) {
+        strError = "The UTXO set snapshot changed while it was loaded";
+        return false;
+    }
+    if (!pcoinsdbview->EndSnapshotLoad(info.hashBlock)) {
+        strError = "Unable to write to the coin database";
+        return false;
+    }
+    return true;
+}
+
+bool LoadTxOutSet(const boost::filesystem::path& path, const uint256& hashExpected, CTxOutSnapshotInfo& info, std::string& strError)
+{
+    if (fTxIndex || fAddressIndex || fSpentIndex || fTimestampIndex || fFlagIndex) {
+        strError = "A UTXO set snapshot cannot be loaded with -txindex, -addressindex, -spentindex, -timestampindex or -flagindex";
+        return false;
+    }
+    if (hashExpected.IsNull()) {
+        strError = "The expected hash of the UTXO set snapshot is required";
+        return false;
+    }
+    if (!ReadSnapshotFile(path, info, true, NULL, strError))
+        return false;
+    {
+        LOCK(cs_main);
+        if (!FindSnapshotBlock(info, strError))
+            return false;
+    }
+
+    // Check the whole file before the chain state is touched
+    LogPrintf("Checking UTXO set snapshot %s of block %s at height %d...\n", path.string(), info.hashBlock.ToString(), info.nHeight);
+    if (!ReadSnapshotFile(path, info, false, NULL, strError))
+        return false;
+    if (info.hashSerialized != hashExpected) {
+        strError = strprintf("The UTXO set snapshot hash %s is not the expected %s", info.hashSerialized.ToString(), hashExpected.ToString());
+        return false;
+    }
+
+    CBlockIndex* pindex;
+    {
+        LOCK(cs_main);
+        pindex = FindSnapshotBlock(info, strError);
+        if (!pindex)
+            return false;
+
+        // Nothing of the old chain state may be left in the cache or on its
+        // way to the database, nor in the mempool
+        FlushStateToDisk();
+        if (!pcoinsflusher->Sync()) {
+            strError = "Unable to flush the chain state";
+            return false;
+        }
+        mempool.clear();
+
+        // cs_main stays held until the new chain state is in place, as any
+        // block connected meanwhile would be written into the half-replaced
+        // coin database. Validation and the RPCs that need the lock wait for
+        // the coins to be written, which takes minutes for a full set.
+        LogPrintf("Loading %u coins of the UTXO set snapshot...\n", info.nCoins);
+        if (!ReplaceCoinsBySnapshot(path, info, strError)) {
+            // The coin database may be half written, and is unusable until rebuilt
+            strError = strprintf("Loading the UTXO set snapshot failed: %s. Restart with -reindex-chainstate", strError);
+            StartShutdown();
+            return false;
+        }
+        pcoinsTip->SetBestBlock(info.hashBlock);
+        if (!ActivateTxOutSnapshot(pindex, info.nChainTx)) {
+            strError = "Unable to write the block index";
+            return false;
+        }
+        LogPrintf("Loaded UTXO set snapshot, new tip %s height=%d\n", pindex->GetBlockHash().ToString(), pindex->nHeight);
+    }
+    // Blocks below the snapshot cannot be served
+    nLocalServices = ServiceFlags(nLocalServices & ~NODE_NETWORK);
+    uiInterface.NotifyBlockTip(IsInitialBlockDownload(), pindex);
+
+    // Connect any blocks after the snapshot that are there already
+    CValidationState state;
+    ActivateBestChain(state, Params());
+    return true;
+}
+
+void ThreadLoadTxOutSet(const boost::filesystem::path& path, const uint256& hashExpected)
+{
+    RenameThread("sexcoin-loadutxo");
+    CTxOutSnapshotInfo info;
+    std::string strError;
+    if (ReadSnapshotFile(path, info, true, NULL, strError)) {
+        // Headers are only synced once no blocks are imported anymore
+        while (true) {
+            {
+                LOCK(cs_main);
+                if (chainActive.Height() >= info.nHeight) {
+                    LogPrintf("Ignoring -loadtxoutset, the active chain is past height %d already\n", info.nHeight);
+                    return;
+                }
+                if (!fImporting && !fReindex && mapBlockIndex.count(info.hashBlock))
+                    break;
+            }
+            MilliSleep(1000);
+        }
+        if (LoadTxOutSet(path, hashExpected, info, strError))
+            return;
+    }
+    LogPrintf("Error: -loadtxoutset: %s\n", strError);
+    uiInterface.ThreadSafeMessageBox(strError, "", CClientUIInterface::MSG_ERROR);
+    StartShutdown();
+}
@@ -0,0 +1,88 @@
+// Copyright (c) 2016 The Sexcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TXOUTSNAPSHOT_H
+#define BITCOIN_TXOUTSNAPSHOT_H
+
+#include "coins.h"
+#include "hash.h"
+#include "uint256.h"
+
+#include <map>
+#include <stdint.h>
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+
+/** Format version of UTXO set snapshot files */
+static const uint32_t TXOUTSNAPSHOT_VERSION = 2;
+/** Serialized size of the coins written to the database in one batch while loading a snapshot */
+static const size_t TXOUTSNAPSHOT_BATCH_SIZE = 64 << 20;
+
+/**
+ * Hash of the unspent outputs of a chain state, as gettxoutsetinfo reports
+ * it and snapshots are checked by. It commits to every coin in full: its
+ * outpoint, height, coinbase flag and output. Coins have to be added
+ * grouped by txid, in ascending order.
+ */
+class CTxOutSetHasher
+{
+private:
+    CHashWriter ss;
+    uint256 hashTx;
+    std::map<uint32_t, Coin> outputs;
+
+    void FinishTx();
+
+public:
+    CTxOutSetHasher(const uint256& hashBlock);
+
+    //! Add a coin; false if its txid comes before the last one, or it was added already
+    bool Add(const COutPoint& outpoint, const Coin& coin);
+
+    uint256 GetHash();
+};
+
+/** What a UTXO set snapshot file holds, from its header and trailer */
+struct CTxOutSnapshotInfo
+{
+    //! The block the unspent outputs are the chain state of
+    uint256 hashBlock;
+    int nHeight;
+    //! Number of transactions in the chain up to and including the block
+    uint64_t nChainTx;
+    uint64_t nCoins;
+    //! Hash of the unspent outputs, the same as hash_serialized of gettxoutsetinfo at the block
+    uint256 hashSerialized;
+
+    CTxOutSnapshotInfo() : nHeight(0), nChainTx(0), nCoins(0) {}
+};
+
+/**
+ * Write the unspent outputs of the current chain state to a new snapshot
+ * file at path. The chain state is flushed first, and the outputs are
+ * streamed from the coin database as of that flush, so blocks can be
+ * connected meanwhile.
+ */
+bool DumpTxOutSet(const boost::filesystem::path& path, CTxOutSnapshotInfo& info, std::string& strError);
+
+/**
+ * Replace the chain state by the snapshot file at path, and continue from
+ * its block. The block header must be known and on the best header chain,
+ * and the active chain must not have reached it yet. The whole file is
+ * checked before the coin database is touched: its checksum, and its hash
+ * against hashExpected, which is required. Blocks below the snapshot are
+ * never downloaded, as if they were pruned, so no indexes can be kept.
+ * cs_main is held while the coins are written, which stalls validation.
+ */
+bool LoadTxOutSet(const boost::filesystem::path& path, const uint256& hashExpected, CTxOutSnapshotInfo& info, std::string& strError);
+
+/**
+ * -loadtxoutset: wait until the header of the snapshot at path has been
+ * received and blocks are no longer imported, then load it. Does nothing if
+ * the active chain is already past the snapshot.
+ */
+void ThreadLoadTxOutSet(const boost::filesystem::path& path, const uint256& hashExpected);
+
+#endif // BITCOIN_TXOUTSNAPSHOT_H